@@ -119,7 +119,8 @@ MyGymEnv::GetObservation()
 {
   NS_LOG_FUNCTION (this);
   std::vector<uint32_t> shape = {m_channelNum,};
-  Ptr<OpenGymBoxContainer<uint32_t> > box = CreateObject<OpenGymBoxContainer<uint32_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint32_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint32_t> >();
+  box->SetShape(shape);
 
   for (uint32_t i = 0; i < m_channelOccupation.size(); ++i) {
     uint32_t value = m_channelOccupation.at(i);
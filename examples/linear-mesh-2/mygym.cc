@@ -136,7 +136,8 @@ MyGymEnv::GetObservation()
   NS_LOG_FUNCTION (this);
   uint32_t nodeNum = NodeList::GetNNodes ();
   std::vector<uint32_t> shape = {nodeNum,};
-  Ptr<OpenGymBoxContainer<uint32_t> > box = CreateObject<OpenGymBoxContainer<uint32_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint32_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint32_t> >();
+  box->SetShape(shape);
 
   for (NodeList::Iterator i = NodeList::Begin (); i != NodeList::End (); ++i) {
     Ptr<Node> node = *i;
@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+from ns3gym import ns3env
+
+__author__ = "Piotr Gawlowicz"
+__copyright__ = "Copyright (c) 2020, Technische Universität Berlin"
+__version__ = "0.1.0"
+__email__ = "gawlowicz@tkn.tu-berlin.de"
+
+
+# serves both agents of sim.cc over one socket, start the simulation with:
+# ./waf --run "multi-agent --multiplexed=true"
+port = 5555
+env = ns3env.Ns3MultiEnv(port=port, startSim=False)
+
+stepIdx = 0
+activeEnvs = set()
+
+try:
+    while True:
+        envId, obs, reward, done, info = env.recv()
+        activeEnvs.add(envId)
+        stepIdx += 1
+        print("Step: ", stepIdx, " env: ", envId)
+        print("---obs, reward, done, info: ", obs, reward, done, info)
+
+        if done:
+            activeEnvs.discard(envId)
+            env.send(envId, None)
+            if not activeEnvs:
+                break
+            continue
+
+        action = env.get_action_space(envId).sample()
+        print("---action: ", action)
+        env.send(envId, action)
+
+except KeyboardInterrupt:
+    print("Ctrl-C -> Exit")
+finally:
+    env.close()
+    print("Done")
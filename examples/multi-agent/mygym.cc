@@ -155,7 +155,8 @@ MyGymEnv::GetObservation()
   Ptr<UniformRandomVariable> rngInt = CreateObject<UniformRandomVariable> ();
 
   std::vector<uint32_t> shape = {nodeNum,};
-  Ptr<OpenGymBoxContainer<uint32_t> > box = CreateObject<OpenGymBoxContainer<uint32_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint32_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint32_t> >();
+  box->SetShape(shape);
 
   // generate random data
   for (uint32_t i = 0; i<nodeNum; i++){
@@ -163,11 +164,11 @@ MyGymEnv::GetObservation()
     box->AddValue(value);
   }
 
-  Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer>(nodeNum);
+  Ptr<OpenGymDiscreteContainer> discrete = CreatePooledContainer<OpenGymDiscreteContainer>();
   uint32_t value = rngInt->GetInteger(low, high);
   discrete->SetValue(value);
 
-  Ptr<OpenGymTupleContainer> data = CreateObject<OpenGymTupleContainer> ();
+  Ptr<OpenGymTupleContainer> data = CreatePooledContainer<OpenGymTupleContainer>();
   data->Add(box);
   data->Add(discrete);
 
@@ -36,6 +36,7 @@ main (int argc, char *argv[])
   double envStepTime = 0.1; //seconds, ns3gym env step time interval
   uint32_t openGymPort = 5555;
   uint32_t testArg = 0;
+  bool multiplexed = false;
 
   CommandLine cmd;
   // required parameters for OpenGym interface
@@ -45,6 +46,7 @@ main (int argc, char *argv[])
   cmd.AddValue ("simTime", "Simulation time in seconds. Default: 10s", simulationTime);
   cmd.AddValue ("stepTime", "Gym Env step time in seconds. Default: 0.1s", envStepTime);
   cmd.AddValue ("testArg", "Extra simulation argument. Default: 0", testArg);
+  cmd.AddValue ("multiplexed", "Serve both agents over one connection. Default: false", multiplexed);
   cmd.Parse (argc, argv);
 
   NS_LOG_UNCOND("Ns3Env parameters:");
@@ -53,21 +55,30 @@ main (int argc, char *argv[])
   NS_LOG_UNCOND("--envStepTime: " << envStepTime);
   NS_LOG_UNCOND("--seed: " << simSeed);
   NS_LOG_UNCOND("--testArg: " << testArg);
+  NS_LOG_UNCOND("--multiplexed: " << multiplexed);
 
   RngSeedManager::SetSeed (1);
   RngSeedManager::SetRun (simSeed);
 
+  if (multiplexed) {
+    // both interfaces share one connection, messages are tagged with EnvId
+    Config::SetDefault ("OpenGymInterface::Multiplexed", BooleanValue (true));
+  }
+
   // OpenGym Env for agent 1
   uint32_t agentId = 1;
-  openGymPort = 5555;
+  uint32_t basePort = openGymPort;
+  openGymPort = multiplexed ? basePort : 5555;
   Ptr<OpenGymInterface> openGymInterface1 = CreateObject<OpenGymInterface> (openGymPort);
+  openGymInterface1->SetAttribute ("EnvId", UintegerValue (agentId));
   Ptr<MyGymEnv> myGymEnv1 = CreateObject<MyGymEnv> (agentId, Seconds(envStepTime));
   myGymEnv1->SetOpenGymInterface(openGymInterface1);
 
   // OpenGym Env for agent 2
   agentId = 2;
-  openGymPort = 5556;
+  openGymPort = multiplexed ? basePort : 5556;
   Ptr<OpenGymInterface> openGymInterface2 = CreateObject<OpenGymInterface> (openGymPort);
+  openGymInterface2->SetAttribute ("EnvId", UintegerValue (agentId));
   Ptr<MyGymEnv> myGymEnv2 = CreateObject<MyGymEnv> (agentId, Seconds(envStepTime));
   myGymEnv2->SetOpenGymInterface(openGymInterface2);
 
@@ -77,6 +77,7 @@ void
 MyGymEnv::DoDispose ()
 {
   NS_LOG_FUNCTION (this);
+  m_obsKeys = 0;
 }
 
 /*
@@ -97,6 +98,7 @@ MyGymEnv::GetObservationSpace()
   Ptr<OpenGymDictSpace> space = CreateObject<OpenGymDictSpace> ();
   space->Add("myVector", box);
   space->Add("myValue", discrete);
+  m_obsKeys = space->GetKeys();
 
   NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
   return space;
@@ -154,7 +156,8 @@ MyGymEnv::GetObservation()
   Ptr<UniformRandomVariable> rngInt = CreateObject<UniformRandomVariable> ();
 
   std::vector<uint32_t> shape = {nodeNum,};
-  Ptr<OpenGymBoxContainer<uint32_t> > box = CreateObject<OpenGymBoxContainer<uint32_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint32_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint32_t> >();
+  box->SetShape(shape);
 
   // generate random data
   for (uint32_t i = 0; i<nodeNum; i++){
@@ -162,13 +165,16 @@ MyGymEnv::GetObservation()
     box->AddValue(value);
   }
 
-  Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer>(nodeNum);
+  Ptr<OpenGymDiscreteContainer> discrete = CreatePooledContainer<OpenGymDiscreteContainer>();
   uint32_t value = rngInt->GetInteger(low, high);
   discrete->SetValue(value);
 
-  Ptr<OpenGymDictContainer> data = CreateObject<OpenGymDictContainer> ();
-  data->Add("myVector",box);
-  data->Add("myValue",discrete);
+  // elements are set by the key ids of the observation space, so they are
+  // sent as ids to agents with CAP_DICT_KEY_IDS
+  Ptr<OpenGymDictContainer> data = CreatePooledContainer<OpenGymDictContainer>();
+  data->SetKeys(m_obsKeys);
+  data->Set(m_obsKeys->Find("myVector"), box);
+  data->Set(m_obsKeys->Find("myValue"), discrete);
 
   // Print data from tuple
   Ptr<OpenGymBoxContainer<uint32_t> > mbox = DynamicCast<OpenGymBoxContainer<uint32_t> >(data->Get("myVector"));
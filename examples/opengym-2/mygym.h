@@ -48,6 +48,8 @@ private:
   void ScheduleNextStateRead();
 
   Time m_interval;
+  // key table of the observation space, shared by the observation Dicts
+  Ptr<OpenGymDictKeys> m_obsKeys;
 };
 
 }
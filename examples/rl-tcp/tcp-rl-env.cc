@@ -298,7 +298,8 @@ TcpEventGymEnv::GetObservation()
   uint32_t parameterNum = 15;
   std::vector<uint32_t> shape = {parameterNum,};
 
-  Ptr<OpenGymBoxContainer<uint64_t> > box = CreateObject<OpenGymBoxContainer<uint64_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint64_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint64_t> >();
+  box->SetShape(shape);
 
   box->AddValue(m_socketUuid);
   box->AddValue(0);
@@ -492,7 +493,8 @@ TcpTimeStepGymEnv::GetObservation()
   uint32_t parameterNum = 16;
   std::vector<uint32_t> shape = {parameterNum,};
 
-  Ptr<OpenGymBoxContainer<uint64_t> > box = CreateObject<OpenGymBoxContainer<uint64_t> >(shape);
+  Ptr<OpenGymBoxContainer<uint64_t> > box = CreatePooledContainer<OpenGymBoxContainer<uint64_t> >();
+  box->SetShape(shape);
 
   box->AddValue(m_socketUuid);
   box->AddValue(1);
@@ -19,6 +19,9 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include "ns3/log.h"
 #include "container.h"
 
@@ -61,98 +64,309 @@ OpenGymDataContainer::DoInitialize (void)
   //NS_LOG_FUNCTION (this);
 }
 
+bool
+OpenGymDataContainer::GetElement(uint32_t idx, double &value)
+{
+  return false;
+}
+
+ns3opengym::DataContainer
+OpenGymDataContainer::GetDataContainerPbMsg()
+{
+  ns3opengym::DataContainer dataContainerPbMsg;
+  FillDataContainerPbMsg(dataContainerPbMsg, OpenGymWireFormat());
+  return dataContainerPbMsg;
+}
+
+void
+OpenGymDataContainer::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
+{
+  // containers implementing only GetDataContainerPbMsg always use the v1 encoding
+  dataContainerPbMsg.CopyFrom(GetDataContainerPbMsg());
+}
+
+ns3opengym::Dtype
+OpenGymLegacyDtype (ns3opengym::Dtype dtype)
+{
+  switch (dtype) {
+    case ns3opengym::INT8:
+    case ns3opengym::INT16:
+    case ns3opengym::INT64:
+      return ns3opengym::INT;
+    case ns3opengym::UINT8:
+    case ns3opengym::UINT16:
+    case ns3opengym::UINT64:
+    case ns3opengym::BOOL:
+      return ns3opengym::UINT;
+    case ns3opengym::FLOAT16:
+      return ns3opengym::FLOAT;
+    default:
+      return dtype;
+  }
+}
+
+uint32_t
+OpenGymDtypeSize (ns3opengym::Dtype dtype)
+{
+  switch (dtype) {
+    case ns3opengym::INT8:
+    case ns3opengym::UINT8:
+    case ns3opengym::BOOL:
+      return 1;
+    case ns3opengym::INT16:
+    case ns3opengym::UINT16:
+    case ns3opengym::FLOAT16:
+      return 2;
+    case ns3opengym::INT64:
+    case ns3opengym::UINT64:
+    case ns3opengym::DOUBLE:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+namespace {
+
+Ptr<OpenGymDataContainer>
+CreateFromDiscretePbMsg(const ns3opengym::DiscreteDataContainer &discreteContainerPbMsg, OpenGymContainerPool *pool)
+{
+  Ptr<OpenGymDiscreteContainer> discrete = OpenGymCreateContainer<OpenGymDiscreteContainer>(pool);
+  discrete->SetValue(discreteContainerPbMsg.data());
+  return discrete;
+}
+
+template <typename W>
+Ptr<OpenGymBoxContainer<W> >
+NewBoxContainer(const std::vector<uint32_t> &shape, OpenGymContainerPool *pool)
+{
+  Ptr<OpenGymBoxContainer<W> > box = OpenGymCreateContainer<OpenGymBoxContainer<W> >(pool);
+  box->SetShape(shape);
+  return box;
+}
+
+template <typename W, typename InputIt>
+Ptr<OpenGymDataContainer>
+CreateBoxContainer(const std::vector<uint32_t> &shape, InputIt first, InputIt last, OpenGymContainerPool *pool)
+{
+  Ptr<OpenGymBoxContainer<W> > box = NewBoxContainer<W>(shape, pool);
+  box->Assign(first, last);
+  return box;
+}
+
+template <typename W>
+Ptr<OpenGymDataContainer>
+CreateRawBoxContainer(const std::vector<uint32_t> &shape, const uint8_t *data, uint32_t count, OpenGymContainerPool *pool)
+{
+  // copied straight into the storage of the (possibly recycled) Box
+  Ptr<OpenGymBoxContainer<W> > box = NewBoxContainer<W>(shape, pool);
+  box->Resize(count);
+  std::memcpy(box->GetDataPtr(), data, count * sizeof(W));
+  return box;
+}
+
+float
+HalfToFloat(uint16_t half)
+{
+  uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent == 0) {
+    // zero or subnormal
+    float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+Ptr<OpenGymDataContainer>
+CreateFromBoxPbMsg(const ns3opengym::BoxDataContainer &boxContainerPbMsg, OpenGymContainerPool *pool)
+{
+  std::vector<uint32_t> shape(boxContainerPbMsg.shape().begin(), boxContainerPbMsg.shape().end());
+  const std::string &rawData = boxContainerPbMsg.rawdata();
+  if (!rawData.empty()) {
+    ns3opengym::Dtype dtype = boxContainerPbMsg.dtype();
+    return OpenGymDataContainer::CreateFromRawData(dtype, shape, reinterpret_cast<const uint8_t*>(rawData.data()),
+                                                   rawData.size() / OpenGymDtypeSize(dtype), pool);
+  }
+
+  // repeated fields only carry the v1 dtypes
+  if (boxContainerPbMsg.dtype() == ns3opengym::INT) {
+    return CreateBoxContainer<int32_t>(shape, boxContainerPbMsg.intdata().begin(), boxContainerPbMsg.intdata().end(), pool);
+  } else if (boxContainerPbMsg.dtype() == ns3opengym::UINT) {
+    return CreateBoxContainer<uint32_t>(shape, boxContainerPbMsg.uintdata().begin(), boxContainerPbMsg.uintdata().end(), pool);
+  } else if (boxContainerPbMsg.dtype() == ns3opengym::DOUBLE) {
+    return CreateBoxContainer<double>(shape, boxContainerPbMsg.doubledata().begin(), boxContainerPbMsg.doubledata().end(), pool);
+  } else {
+    return CreateBoxContainer<float>(shape, boxContainerPbMsg.floatdata().begin(), boxContainerPbMsg.floatdata().end(), pool);
+  }
+}
+
+Ptr<OpenGymDataContainer>
+CreateFromTuplePbMsg(const ns3opengym::TupleDataContainer &tupleContainerPbMsg, OpenGymContainerPool *pool,
+                     Ptr<OpenGymSpace> space)
+{
+  Ptr<OpenGymTupleSpace> tupleSpace = DynamicCast<OpenGymTupleSpace>(space);
+  Ptr<OpenGymTupleContainer> tupleData = OpenGymCreateContainer<OpenGymTupleContainer>(pool);
+  for (int i = 0; i < tupleContainerPbMsg.element_size(); ++i)
+  {
+    Ptr<OpenGymSpace> subSpace = tupleSpace ? tupleSpace->Get(i) : 0;
+    Ptr<OpenGymDataContainer> subData = OpenGymDataContainer::CreateFromDataContainerPbMsg(tupleContainerPbMsg.element(i), pool, subSpace);
+    tupleData->Add(subData);
+  }
+  return tupleData;
+}
+
+Ptr<OpenGymDataContainer>
+CreateFromDictPbMsg(const ns3opengym::DictDataContainer &dictContainerPbMsg, OpenGymContainerPool *pool,
+                    Ptr<OpenGymSpace> space)
+{
+  Ptr<OpenGymDictSpace> dictSpace = DynamicCast<OpenGymDictSpace>(space);
+  Ptr<OpenGymDictContainer> dictData = OpenGymCreateContainer<OpenGymDictContainer>(pool);
+  if (dictSpace) {
+    dictData->SetKeys(dictSpace->GetKeys());
+  }
+
+  bool keyIds = dictContainerPbMsg.key_size() == dictContainerPbMsg.element_size() && dictContainerPbMsg.key_size() > 0;
+  if (keyIds && !dictSpace) {
+    NS_LOG_ERROR("Dict key ids without a Dict space to resolve them");
+    return 0;
+  }
+  for (int i = 0; i < dictContainerPbMsg.element_size(); ++i)
+  {
+    const ns3opengym::DataContainer &element = dictContainerPbMsg.element(i);
+    if (keyIds) {
+      uint32_t id = dictContainerPbMsg.key(i);
+      Ptr<OpenGymDataContainer> subData = OpenGymDataContainer::CreateFromDataContainerPbMsg(element, pool, dictSpace->Get(id));
+      if (!dictData->Set(id, subData)) {
+        NS_LOG_ERROR("Dict key id " << id << " out of range");
+        return 0;
+      }
+    } else {
+      Ptr<OpenGymSpace> subSpace = dictSpace ? dictSpace->Get(element.name()) : 0;
+      Ptr<OpenGymDataContainer> subData = OpenGymDataContainer::CreateFromDataContainerPbMsg(element, pool, subSpace);
+      dictData->Add(element.name(), subData);
+    }
+  }
+  return dictData;
+}
+
+} // anonymous namespace
+
 Ptr<OpenGymDataContainer>
-OpenGymDataContainer::CreateFromDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg)
+OpenGymDataContainer::CreateFromRawData(ns3opengym::Dtype dtype, const std::vector<uint32_t> &shape,
+                                        const uint8_t *data, uint32_t count, OpenGymContainerPool *pool)
+{
+  switch (dtype) {
+    case ns3opengym::INT8:
+      return CreateRawBoxContainer<int8_t>(shape, data, count, pool);
+    case ns3opengym::UINT8:
+      return CreateRawBoxContainer<uint8_t>(shape, data, count, pool);
+    case ns3opengym::INT16:
+      return CreateRawBoxContainer<int16_t>(shape, data, count, pool);
+    case ns3opengym::UINT16:
+      return CreateRawBoxContainer<uint16_t>(shape, data, count, pool);
+    case ns3opengym::INT:
+      return CreateRawBoxContainer<int32_t>(shape, data, count, pool);
+    case ns3opengym::UINT:
+      return CreateRawBoxContainer<uint32_t>(shape, data, count, pool);
+    case ns3opengym::INT64:
+      return CreateRawBoxContainer<int64_t>(shape, data, count, pool);
+    case ns3opengym::UINT64:
+      return CreateRawBoxContainer<uint64_t>(shape, data, count, pool);
+    case ns3opengym::DOUBLE:
+      return CreateRawBoxContainer<double>(shape, data, count, pool);
+
+    case ns3opengym::BOOL:
+      return CreateBoxContainer<bool>(shape, data, data + count, pool);
+
+    case ns3opengym::FLOAT16: {
+      // no native half type, widen to float
+      Ptr<OpenGymBoxContainer<float> > box = NewBoxContainer<float>(shape, pool);
+      box->Resize(count);
+      float *values = box->GetDataPtr();
+      for (uint32_t i = 0; i < count; ++i) {
+        uint16_t half;
+        std::memcpy(&half, data + i * sizeof(half), sizeof(half));
+        values[i] = HalfToFloat(half);
+      }
+      return box;
+    }
+
+    default:
+      return CreateRawBoxContainer<float>(shape, data, count, pool);
+  }
+}
+
+bool
+OpenGymDataContainer::WriteRawData(ns3opengym::Dtype dtype, uint32_t count, uint8_t *out)
+{
+  return false;
+}
+
+bool
+OpenGymDataContainer::WritePacked(uint32_t size, uint8_t *out)
 {
+  return false;
+}
+
+void
+OpenGymDataContainer::Clear()
+{
+}
+
+Ptr<OpenGymDataContainer>
+OpenGymDataContainer::CreateFromDataContainerPbMsg(const ns3opengym::DataContainer &dataContainerPbMsg,
+                                                   OpenGymContainerPool *pool, Ptr<OpenGymSpace> space)
+{
+  // protocol v2: typed payload
+  switch (dataContainerPbMsg.value_case())
+  {
+    case ns3opengym::DataContainer::kDiscrete:
+      return CreateFromDiscretePbMsg(dataContainerPbMsg.discrete(), pool);
+    case ns3opengym::DataContainer::kBox:
+      return CreateFromBoxPbMsg(dataContainerPbMsg.box(), pool);
+    case ns3opengym::DataContainer::kTuple:
+      return CreateFromTuplePbMsg(dataContainerPbMsg.tuple(), pool, space);
+    case ns3opengym::DataContainer::kDict:
+      return CreateFromDictPbMsg(dataContainerPbMsg.dict(), pool, space);
+    default:
+      break;
+  }
+
+  // protocol v1: payload packed into google.protobuf.Any
   Ptr<OpenGymDataContainer> actDataContainer;
 
   if (dataContainerPbMsg.type() == ns3opengym::Discrete)
   {
     ns3opengym::DiscreteDataContainer discreteContainerPbMsg;
     dataContainerPbMsg.data().UnpackTo(&discreteContainerPbMsg);
-
-    Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer>();
-    discrete->SetValue(discreteContainerPbMsg.data());
-    actDataContainer = discrete;
+    actDataContainer = CreateFromDiscretePbMsg(discreteContainerPbMsg, pool);
   }
   else if (dataContainerPbMsg.type() == ns3opengym::Box)
   {
     ns3opengym::BoxDataContainer boxContainerPbMsg;
     dataContainerPbMsg.data().UnpackTo(&boxContainerPbMsg);
-
-    if (boxContainerPbMsg.dtype() == ns3opengym::INT) {
-      Ptr<OpenGymBoxContainer<int32_t> > box = CreateObject<OpenGymBoxContainer<int32_t> >();
-      std::vector<int32_t> myData;
-      myData.assign(boxContainerPbMsg.intdata().begin(), boxContainerPbMsg.intdata().end());
-      box->SetData(myData);
-      actDataContainer = box;
-
-    } else if (boxContainerPbMsg.dtype() == ns3opengym::UINT) {
-      Ptr<OpenGymBoxContainer<uint32_t> > box = CreateObject<OpenGymBoxContainer<uint32_t> >();
-      std::vector<uint32_t> myData;
-      myData.assign(boxContainerPbMsg.uintdata().begin(), boxContainerPbMsg.uintdata().end());
-      box->SetData(myData);
-      actDataContainer = box;
-
-    } else if (boxContainerPbMsg.dtype() == ns3opengym::FLOAT) {
-      Ptr<OpenGymBoxContainer<float> > box = CreateObject<OpenGymBoxContainer<float> >();
-      std::vector<float> myData;
-      myData.assign(boxContainerPbMsg.floatdata().begin(), boxContainerPbMsg.floatdata().end());
-      box->SetData(myData);
-      actDataContainer = box;
-
-    } else if (boxContainerPbMsg.dtype() == ns3opengym::DOUBLE) {
-      Ptr<OpenGymBoxContainer<double> > box = CreateObject<OpenGymBoxContainer<double> >();
-      std::vector<double> myData;
-      myData.assign(boxContainerPbMsg.doubledata().begin(), boxContainerPbMsg.doubledata().end());
-      box->SetData(myData);
-      actDataContainer = box;
-
-    } else {
-      Ptr<OpenGymBoxContainer<float> > box = CreateObject<OpenGymBoxContainer<float> >();
-      std::vector<float> myData;
-      myData.assign(boxContainerPbMsg.floatdata().begin(), boxContainerPbMsg.floatdata().end());
-      box->SetData(myData);
-      actDataContainer = box;
-    }
+    actDataContainer = CreateFromBoxPbMsg(boxContainerPbMsg, pool);
   }
   else if (dataContainerPbMsg.type() == ns3opengym::Tuple)
   {
-    Ptr<OpenGymTupleContainer> tupleData = CreateObject<OpenGymTupleContainer> ();
-
     ns3opengym::TupleDataContainer tupleContainerPbMsg;
     dataContainerPbMsg.data().UnpackTo(&tupleContainerPbMsg);
-
-    std::vector< ns3opengym::DataContainer > elements;
-    elements.assign(tupleContainerPbMsg.element().begin(), tupleContainerPbMsg.element().end());
-
-    std::vector< ns3opengym::DataContainer >::iterator it;
-    for(it=elements.begin();it!=elements.end();++it)
-    {
-      Ptr<OpenGymDataContainer> subData = OpenGymDataContainer::CreateFromDataContainerPbMsg(*it);
-      tupleData->Add(subData);
-    }
-
-    actDataContainer = tupleData;
+    actDataContainer = CreateFromTuplePbMsg(tupleContainerPbMsg, pool, space);
   }
   else if (dataContainerPbMsg.type() == ns3opengym::Dict)
   {
-    Ptr<OpenGymDictContainer> dictData = CreateObject<OpenGymDictContainer> ();
-
     ns3opengym::DictDataContainer dictContainerPbMsg;
     dataContainerPbMsg.data().UnpackTo(&dictContainerPbMsg);
-
-    std::vector< ns3opengym::DataContainer > elements;
-    elements.assign(dictContainerPbMsg.element().begin(), dictContainerPbMsg.element().end());
-
-    std::vector< ns3opengym::DataContainer >::iterator it;
-    for(it=elements.begin();it!=elements.end();++it)
-    {
-      Ptr<OpenGymDataContainer> subSpace = OpenGymDataContainer::CreateFromDataContainerPbMsg(*it);
-      dictData->Add((*it).name(), subSpace);
-    }
-
-    actDataContainer = dictData;
+    actDataContainer = CreateFromDictPbMsg(dictContainerPbMsg, pool, space);
   }
   return actDataContainer;
 }
@@ -198,16 +412,17 @@ OpenGymDiscreteContainer::DoInitialize (void)
   //NS_LOG_FUNCTION (this);
 }
 
-ns3opengym::DataContainer
-OpenGymDiscreteContainer::GetDataContainerPbMsg()
+void
+OpenGymDiscreteContainer::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
 {
-  ns3opengym::DataContainer dataContainerPbMsg;
-  ns3opengym::DiscreteDataContainer discreteContainerPbMsg;
+  ns3opengym::DiscreteDataContainer packedDiscrete;
+  ns3opengym::DiscreteDataContainer &discreteContainerPbMsg = format.typed ? *dataContainerPbMsg.mutable_discrete() : packedDiscrete;
   discreteContainerPbMsg.set_data(GetValue());
 
   dataContainerPbMsg.set_type(ns3opengym::Discrete);
-  dataContainerPbMsg.mutable_data()->PackFrom(discreteContainerPbMsg);
-  return dataContainerPbMsg;
+  if (!format.typed) {
+    dataContainerPbMsg.mutable_data()->PackFrom(packedDiscrete);
+  }
 }
 
 bool
@@ -223,6 +438,23 @@ OpenGymDiscreteContainer::GetValue()
   return m_value;
 }
 
+void
+OpenGymDiscreteContainer::Clear()
+{
+  m_value = 0;
+}
+
+bool
+OpenGymDiscreteContainer::GetElement(uint32_t idx, double &value)
+{
+  if (idx != 0)
+  {
+    return false;
+  }
+  value = m_value;
+  return true;
+}
+
 void
 OpenGymDiscreteContainer::Print(std::ostream& where) const
 {
@@ -262,25 +494,30 @@ OpenGymTupleContainer::DoInitialize (void)
   //NS_LOG_FUNCTION (this);
 }
 
-ns3opengym::DataContainer
-OpenGymTupleContainer::GetDataContainerPbMsg()
+void
+OpenGymTupleContainer::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
 {
-  ns3opengym::DataContainer dataContainerPbMsg;
   dataContainerPbMsg.set_type(ns3opengym::Tuple);
 
-  ns3opengym::TupleDataContainer tupleContainerPbMsg;
+  ns3opengym::TupleDataContainer packedTuple;
+  ns3opengym::TupleDataContainer &tupleContainerPbMsg = format.typed ? *dataContainerPbMsg.mutable_tuple() : packedTuple;
 
   std::vector< Ptr<OpenGymDataContainer> >::iterator it;
   for (it=m_tuple.begin(); it!=m_tuple.end(); ++it)
   {
     Ptr<OpenGymDataContainer> subSpace = *it;
-    ns3opengym::DataContainer subDataContainer = subSpace->GetDataContainerPbMsg();
+    subSpace->FillDataContainerPbMsg(*tupleContainerPbMsg.add_element(), format);
+  }
 
-    tupleContainerPbMsg.add_element()->CopyFrom(subDataContainer);
+  if (!format.typed) {
+    dataContainerPbMsg.mutable_data()->PackFrom(packedTuple);
   }
+}
 
-  dataContainerPbMsg.mutable_data()->PackFrom(tupleContainerPbMsg);
-  return dataContainerPbMsg;
+void
+OpenGymTupleContainer::Clear()
+{
+  m_tuple.clear();
 }
 
 bool
@@ -325,6 +562,57 @@ OpenGymTupleContainer::Print(std::ostream& where) const
 }
 
 
+OpenGymDictKeys::OpenGymDictKeys(bool interned)
+  : m_interned(interned)
+{
+}
+
+OpenGymDictKeys::OpenGymDictKeys(const OpenGymDictKeys &keys, bool interned)
+  : m_names(keys.m_names),
+    m_interned(interned)
+{
+}
+
+uint32_t
+OpenGymDictKeys::Find(const std::string &key) const
+{
+  std::vector<std::string>::const_iterator it = std::lower_bound(m_names.begin(), m_names.end(), key);
+  if (it == m_names.end() || *it != key) {
+    return m_names.size();
+  }
+  return it - m_names.begin();
+}
+
+const std::string &
+OpenGymDictKeys::GetName(uint32_t id) const
+{
+  return m_names.at(id);
+}
+
+uint32_t
+OpenGymDictKeys::GetSize() const
+{
+  return m_names.size();
+}
+
+bool
+OpenGymDictKeys::IsInterned() const
+{
+  return m_interned;
+}
+
+uint32_t
+OpenGymDictKeys::Insert(const std::string &key)
+{
+  std::vector<std::string>::iterator it = std::lower_bound(m_names.begin(), m_names.end(), key);
+  uint32_t id = it - m_names.begin();
+  if (it == m_names.end() || *it != key) {
+    m_names.insert(it, key);
+  }
+  return id;
+}
+
+
 TypeId
 OpenGymDictContainer::GetTypeId (void)
 {
@@ -341,6 +629,12 @@ OpenGymDictContainer::OpenGymDictContainer()
   //NS_LOG_FUNCTION (this);
 }
 
+OpenGymDictContainer::OpenGymDictContainer(Ptr<OpenGymDictKeys> keys)
+{
+  //NS_LOG_FUNCTION (this);
+  SetKeys(keys);
+}
+
 OpenGymDictContainer::~OpenGymDictContainer ()
 {
   //NS_LOG_FUNCTION (this);
@@ -358,35 +652,63 @@ OpenGymDictContainer::DoInitialize (void)
   //NS_LOG_FUNCTION (this);
 }
 
-ns3opengym::DataContainer
-OpenGymDictContainer::GetDataContainerPbMsg()
+void
+OpenGymDictContainer::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
 {
-  ns3opengym::DataContainer dataContainerPbMsg;
   dataContainerPbMsg.set_type(ns3opengym::Dict);
 
-  ns3opengym::DictDataContainer dictContainerPbMsg;
+  ns3opengym::DictDataContainer packedDict;
+  ns3opengym::DictDataContainer &dictContainerPbMsg = format.typed ? *dataContainerPbMsg.mutable_dict() : packedDict;
 
-  std::map< std::string, Ptr<OpenGymDataContainer> >::iterator it;
-  for (it=m_dict.begin(); it!=m_dict.end(); ++it)
+  // the agent knows the names of interned keys from the space description
+  bool keyIds = format.dictKeyIds && m_keys && m_keys->IsInterned();
+  for (uint32_t id = 0; id < m_elements.size(); ++id)
   {
-    std::string name = it->first;
-    Ptr<OpenGymDataContainer> subSpace = it->second;
+    Ptr<OpenGymDataContainer> subSpace = m_elements[id];
+    if (!subSpace) {
+      continue;
+    }
 
-    ns3opengym::DataContainer subDataContainer = subSpace->GetDataContainerPbMsg();
-    subDataContainer.set_name(name);
+    ns3opengym::DataContainer *subDataContainer = dictContainerPbMsg.add_element();
+    subSpace->FillDataContainerPbMsg(*subDataContainer, format);
+    if (keyIds) {
+      dictContainerPbMsg.add_key(id);
+    } else {
+      subDataContainer->set_name(m_keys->GetName(id));
+    }
+  }
 
-    dictContainerPbMsg.add_element()->CopyFrom(subDataContainer);
+  if (!format.typed) {
+    dataContainerPbMsg.mutable_data()->PackFrom(packedDict);
   }
+}
 
-  dataContainerPbMsg.mutable_data()->PackFrom(dictContainerPbMsg);
-  return dataContainerPbMsg;
+void
+OpenGymDictContainer::Clear()
+{
+  std::fill(m_elements.begin(), m_elements.end(), Ptr<OpenGymDataContainer>());
 }
 
 bool
 OpenGymDictContainer::Add(std::string key, Ptr<OpenGymDataContainer> data)
 {
   NS_LOG_FUNCTION (this);
-  m_dict.insert(std::pair<std::string, Ptr<OpenGymDataContainer> > (key, data));
+  if (!m_keys) {
+    m_keys = Create<OpenGymDictKeys>();
+  }
+  uint32_t id = m_keys->Find(key);
+  if (id == m_keys->GetSize()) {
+    // keys of a space or of other containers stay as they are
+    if (m_keys->IsInterned() || m_keys->GetReferenceCount() > 1) {
+      m_keys = Create<OpenGymDictKeys>(*m_keys, false);
+    }
+    id = m_keys->Insert(key);
+    m_elements.insert(m_elements.begin() + id, Ptr<OpenGymDataContainer>());
+  }
+  // an element added before is kept
+  if (!m_elements[id]) {
+    m_elements[id] = data;
+  }
   return true;
 }
 
@@ -394,34 +716,116 @@ Ptr<OpenGymDataContainer>
 OpenGymDictContainer::Get(std::string key)
 {
   Ptr<OpenGymDataContainer> data;
-  std::map< std::string, Ptr<OpenGymDataContainer> >::iterator it = m_dict.find(key);
-  if ( it != m_dict.end() ) {
-    data = it->second;
+  if (m_keys) {
+    data = Get(m_keys->Find(key));
+  }
+  return data;
+}
+
+bool
+OpenGymDictContainer::Set(uint32_t id, Ptr<OpenGymDataContainer> data)
+{
+  if (id >= m_elements.size()) {
+    return false;
+  }
+  m_elements[id] = data;
+  return true;
+}
+
+Ptr<OpenGymDataContainer>
+OpenGymDictContainer::Get(uint32_t id)
+{
+  Ptr<OpenGymDataContainer> data;
+  if (id < m_elements.size()) {
+    data = m_elements[id];
   }
   return data;
 }
 
+void
+OpenGymDictContainer::SetKeys(Ptr<OpenGymDictKeys> keys)
+{
+  if (keys == m_keys) {
+    return;
+  }
+  // elements added before move to the ids of their keys in keys
+  Ptr<OpenGymDictKeys> oldKeys = m_keys;
+  std::vector< Ptr<OpenGymDataContainer> > oldElements;
+  oldElements.swap(m_elements);
+  m_keys = keys;
+  m_elements.assign(keys ? keys->GetSize() : 0, Ptr<OpenGymDataContainer>());
+  for (uint32_t id = 0; id < oldElements.size(); ++id) {
+    if (oldElements[id]) {
+      Add(oldKeys->GetName(id), oldElements[id]);
+    }
+  }
+}
+
+Ptr<OpenGymDictKeys>
+OpenGymDictContainer::GetKeys() const
+{
+  return m_keys;
+}
+
 void
 OpenGymDictContainer::Print(std::ostream& where) const
 {
   where << "Dict(";
 
-  std::map< std::string, Ptr<OpenGymDataContainer> >::const_iterator it;
-  std::map< std::string, Ptr<OpenGymDataContainer> >::const_iterator it2;
-  for (it=m_dict.cbegin(); it!=m_dict.cend(); ++it)
+  bool first = true;
+  for (uint32_t id = 0; id < m_elements.size(); ++id)
   {
-    std::string name = it->first;
-    Ptr<OpenGymDataContainer> subSpace = it->second;
-
-    where << name << "=";
-    subSpace->Print(where);
-
-    it2 = it;
-    it2++;
-    if (it2 != m_dict.end())
+    if (!m_elements[id]) {
+      continue;
+    }
+    if (!first)
       where << ", ";
+    first = false;
+
+    where << m_keys->GetName(id) << "=";
+    m_elements[id]->Print(where);
   }
   where << ")";
 }
 
-}
\ No newline at end of file
+uint32_t
+OpenGymContainerPool::GetSize() const
+{
+  return m_containers.size();
+}
+
+void
+OpenGymContainerPool::Reclaim()
+{
+  // the free lists hold references too, drop them before counting
+  for (auto &entry : m_free)
+  {
+    entry.second.clear();
+  }
+
+  // clearing an unused Tuple or Dict releases its elements, repeated for
+  // every level of nesting
+  uint32_t unused = 0;
+  uint32_t previous;
+  do {
+    previous = unused;
+    unused = 0;
+    for (const auto &entry : m_containers)
+    {
+      if (entry.second->GetReferenceCount() == 1) {
+        entry.second->Clear();
+        ++unused;
+      }
+    }
+  } while (unused > previous);
+
+  for (const auto &entry : m_containers)
+  {
+    // only the pool holds it
+    if (entry.second->GetReferenceCount() == 1) {
+      m_free[entry.first].push_back(entry.second);
+    }
+  }
+}
+
+}
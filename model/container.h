@@ -23,11 +23,73 @@
 #define OPENGYM_CONTAINER_H
 
 #include "ns3/object.h"
+#include "ns3/simple-ref-count.h"
 #include "ns3/type-name.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "messages.pb.h"
+#include "spaces.h"
 
 namespace ns3 {
 
+// raw Box data sent in chunk frames after the message
+struct OpenGymStreamedData
+{
+  uint64_t size; // bytes
+  uint32_t elementSize;
+  // write count elements starting at element first to out
+  std::function<void (uint64_t first, uint64_t count, uint8_t *out)> write;
+};
+
+/**
+ * Encoding of data containers agreed on with the agent in the init
+ * handshake, passed down through nested containers.
+ */
+struct OpenGymWireFormat
+{
+  OpenGymWireFormat () : typed (false), rawBox (false), fullDtypes (false), chunkSize (0), streamed (0), sparseBox (false), dictKeyIds (false) {}
+
+  bool typed;  // protocol v2: typed oneof payloads instead of google.protobuf.Any
+  bool rawBox; // protocol v3: Box data as raw bytes instead of repeated fields
+  bool fullDtypes; // protocol v4: 8/16/64 bit, bool and float16 dtypes, needs rawBox
+  // protocol v6: raw Box data larger than chunkSize is not put into the
+  // message but added to streamed, to be sent in chunks after it (0: never)
+  uint32_t chunkSize;
+  std::vector<OpenGymStreamedData> *streamed;
+  bool sparseBox; // protocol v8: sparse Boxes as SparseBoxDataContainer, dense Box before
+  bool dictKeyIds; // CAP_DICT_KEY_IDS: elements of Dicts with interned keys sent by key id
+};
+
+// INT, UINT, FLOAT or DOUBLE a dtype is sent as to peers before protocol v4
+ns3opengym::Dtype OpenGymLegacyDtype (ns3opengym::Dtype dtype);
+// bytes per element of dtype in raw data
+uint32_t OpenGymDtypeSize (ns3opengym::Dtype dtype);
+
+// dtype of a Box element type, FLOAT for types without a specialization
+template <typename T>
+struct OpenGymDtype
+{
+  static const ns3opengym::Dtype value = ns3opengym::FLOAT;
+};
+
+template <> struct OpenGymDtype<int8_t> { static const ns3opengym::Dtype value = ns3opengym::INT8; };
+template <> struct OpenGymDtype<uint8_t> { static const ns3opengym::Dtype value = ns3opengym::UINT8; };
+template <> struct OpenGymDtype<int16_t> { static const ns3opengym::Dtype value = ns3opengym::INT16; };
+template <> struct OpenGymDtype<uint16_t> { static const ns3opengym::Dtype value = ns3opengym::UINT16; };
+template <> struct OpenGymDtype<int32_t> { static const ns3opengym::Dtype value = ns3opengym::INT; };
+template <> struct OpenGymDtype<uint32_t> { static const ns3opengym::Dtype value = ns3opengym::UINT; };
+template <> struct OpenGymDtype<int64_t> { static const ns3opengym::Dtype value = ns3opengym::INT64; };
+template <> struct OpenGymDtype<uint64_t> { static const ns3opengym::Dtype value = ns3opengym::UINT64; };
+template <> struct OpenGymDtype<bool> { static const ns3opengym::Dtype value = ns3opengym::BOOL; };
+template <> struct OpenGymDtype<double> { static const ns3opengym::Dtype value = ns3opengym::DOUBLE; };
+
+class OpenGymContainerPool;
+
 class OpenGymDataContainer : public Object
 {
 public:
@@ -36,8 +98,32 @@ public:
 
   static TypeId GetTypeId ();
 
-  virtual ns3opengym::DataContainer GetDataContainerPbMsg() = 0;
-  static Ptr<OpenGymDataContainer> CreateFromDataContainerPbMsg(ns3opengym::DataContainer &dataContainer);
+  // protocol v1 encoding; subclasses override at least one of the two
+  virtual ns3opengym::DataContainer GetDataContainerPbMsg();
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  // accepts both the v1 and the v2 encoding; containers are taken from
+  // pool and filled in place if one is given. Dict key ids are resolved
+  // with the Dict spaces of space, Dicts then share the keys of their space
+  static Ptr<OpenGymDataContainer> CreateFromDataContainerPbMsg(const ns3opengym::DataContainer &dataContainer,
+                                                                OpenGymContainerPool *pool = nullptr,
+                                                                Ptr<OpenGymSpace> space = 0);
+  // Box of count little-endian elements of dtype
+  static Ptr<OpenGymDataContainer> CreateFromRawData(ns3opengym::Dtype dtype, const std::vector<uint32_t> &shape,
+                                                     const uint8_t *data, uint32_t count,
+                                                     OpenGymContainerPool *pool = nullptr);
+
+  // write the Box elements as count little-endian values of dtype to out,
+  // false if this is no Box of count elements
+  virtual bool WriteRawData(ns3opengym::Dtype dtype, uint32_t count, uint8_t *out);
+  // write the whole container in the packed layout of its space (size
+  // bytes), false to let OpenGymLayout walk it instead
+  virtual bool WritePacked(uint32_t size, uint8_t *out);
+
+  // element idx as double, false if there is no such scalar element
+  virtual bool GetElement(uint32_t idx, double &value);
+
+  // drop the elements but keep the allocated storage, see OpenGymContainerPool
+  virtual void Clear();
 
   virtual void Print(std::ostream& where) const = 0;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymDataContainer> container)
@@ -62,7 +148,9 @@ public:
 
   static TypeId GetTypeId ();
 
-  virtual ns3opengym::DataContainer GetDataContainerPbMsg();
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  virtual bool GetElement(uint32_t idx, double &value);
+  virtual void Clear();
 
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymDiscreteContainer> container)
@@ -83,6 +171,29 @@ protected:
   uint32_t m_value;
 };
 
+/**
+ * Strided 1-D view of Box elements, e.g. a row or column of a matrix.
+ * Valid until the number of elements of the Box changes.
+ */
+template <typename T>
+class OpenGymBoxView
+{
+public:
+  OpenGymBoxView (std::vector<T> &data, uint64_t first, uint64_t stride, uint32_t size)
+    : m_data (&data), m_first (first), m_stride (stride), m_size (size) {}
+
+  // std::vector<bool> hands out proxies instead of references
+  typename std::vector<T>::reference operator[] (uint32_t i) { return (*m_data)[m_first + i * m_stride]; }
+  typename std::vector<T>::const_reference operator[] (uint32_t i) const { return (*m_data)[m_first + i * m_stride]; }
+  uint32_t GetSize () const { return m_size; }
+
+private:
+  std::vector<T> *m_data;
+  uint64_t m_first;
+  uint64_t m_stride;
+  uint32_t m_size;
+};
+
 template <typename T = float>
 class OpenGymBoxContainer : public OpenGymDataContainer
 {
@@ -93,7 +204,10 @@ public:
 
   static TypeId GetTypeId ();
 
-  virtual ns3opengym::DataContainer GetDataContainerPbMsg();
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  virtual bool GetElement(uint32_t idx, double &value);
+  virtual bool WriteRawData(ns3opengym::Dtype dtype, uint32_t count, uint8_t *out);
+  virtual void Clear();
 
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymBoxContainer> container)
@@ -105,10 +219,40 @@ public:
   bool AddValue(T value);
   T GetValue(uint32_t idx);
 
-  bool SetData(std::vector<T> data);
-  std::vector<T> GetData();
-
-  std::vector<uint32_t> GetShape();
+  bool SetData(const std::vector<T> &data);
+  // takes over the storage of data without copying
+  bool SetData(std::vector<T> &&data);
+  const std::vector<T> &GetData() const;
+  // replace the elements by the range [first, last)
+  template <typename InputIt>
+  void Assign(InputIt first, InputIt last);
+  void Reserve(uint32_t n);
+  void Resize(uint32_t n);
+
+  // the elements in place, e.g. to fill them after Resize; not for
+  // T = bool, valid until the number of elements changes
+  template <typename U = T>
+  typename std::enable_if<!std::is_same<U, bool>::value, const U *>::type GetDataPtr() const;
+  template <typename U = T>
+  typename std::enable_if<!std::is_same<U, bool>::value, U *>::type GetDataPtr();
+  uint32_t GetSize() const;
+
+  void SetShape(const std::vector<uint32_t> &shape);
+  const std::vector<uint32_t> &GetShape() const;
+
+  // row-major offset of index (one entry per dimension of the shape),
+  // false if it is outside the shape
+  bool GetLinearIndex(const std::vector<uint32_t> &index, uint64_t &idx) const;
+  // elements between neighbours along each dimension
+  std::vector<uint64_t> GetStrides() const;
+  T GetValue(const std::vector<uint32_t> &index);
+  // grows the data to the full shape (zero-filled) if it is smaller
+  bool SetValue(const std::vector<uint32_t> &index, T value);
+  // elements along dimension dim, through index (its entry for dim is ignored)
+  OpenGymBoxView<T> GetSlice(uint32_t dim, std::vector<uint32_t> index);
+  // a Box of shape (rows, ...) as rows x (elements per row) matrix
+  OpenGymBoxView<T> GetRow(uint32_t row);
+  OpenGymBoxView<T> GetColumn(uint32_t column);
 
 protected:
   // Inherited
@@ -117,9 +261,13 @@ protected:
 
 private:
   void SetDtype();
-	std::vector<uint32_t> m_shape;
-	ns3opengym::Dtype m_dtype;
-	std::vector<T> m_data;
+  bool CopyRawData(ns3opengym::Dtype dtype, uint64_t first, uint64_t count, uint8_t *out) const;
+  template <typename W>
+  void CopyRawData(uint64_t first, uint64_t count, uint8_t *out) const;
+
+  std::vector<uint32_t> m_shape;
+  ns3opengym::Dtype m_dtype;
+  std::vector<T> m_data;
 };
 
 template <typename T>
@@ -143,7 +291,7 @@ OpenGymBoxContainer<T>::OpenGymBoxContainer()
 
 template <typename T>
 OpenGymBoxContainer<T>::OpenGymBoxContainer(std::vector<uint32_t> shape):
-	m_shape(shape)
+  m_shape(shape)
 {
   SetDtype();
 }
@@ -157,17 +305,7 @@ template <typename T>
 void
 OpenGymBoxContainer<T>::SetDtype ()
 {
-  std::string name = TypeNameGet<T> ();
-  if (name == "int8_t" || name == "int16_t" || name == "int32_t" || name == "int64_t") 
-    m_dtype = ns3opengym::INT;
-  else if (name == "uint8_t" || name == "uint16_t" || name == "uint32_t" || name == "uint64_t") 
-    m_dtype = ns3opengym::UINT;
-  else if (name == "float")
-    m_dtype = ns3opengym::FLOAT;
-  else if (name == "double")
-    m_dtype = ns3opengym::DOUBLE;
-  else
-    m_dtype = ns3opengym::FLOAT;
+  m_dtype = OpenGymDtype<T>::value;
 }
 
 template <typename T>
@@ -183,38 +321,103 @@ OpenGymBoxContainer<T>::DoInitialize (void)
 }
 
 template <typename T>
-ns3opengym::DataContainer
-OpenGymBoxContainer<T>::GetDataContainerPbMsg()
+void
+OpenGymBoxContainer<T>::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
 {
-  ns3opengym::DataContainer dataContainerPbMsg;
-  ns3opengym::BoxDataContainer boxContainerPbMsg;
+  ns3opengym::BoxDataContainer packedBox;
+  ns3opengym::BoxDataContainer &boxContainerPbMsg = format.typed ? *dataContainerPbMsg.mutable_box() : packedBox;
+
+  *boxContainerPbMsg.mutable_shape() = {m_shape.begin(), m_shape.end()};
 
-  std::vector<uint32_t> shape = GetShape();
-  *boxContainerPbMsg.mutable_shape() = {shape.begin(), shape.end()};
 
+  ns3opengym::Dtype dtype = m_dtype;
+  if (!format.fullDtypes || !format.rawBox) {
+    dtype = OpenGymLegacyDtype(m_dtype);
+  }
+  boxContainerPbMsg.set_dtype(dtype);
+
+  uint32_t elementSize = OpenGymDtypeSize(dtype);
+  uint64_t rawSize = m_data.size() * elementSize;
+  if (format.rawBox && format.streamed && format.chunkSize > 0 && rawSize > format.chunkSize) {
+    // copied chunk by chunk straight from m_data when the message is sent
+    boxContainerPbMsg.set_streamedsize(rawSize);
+    Ptr<OpenGymBoxContainer<T> > box = this;
+    format.streamed->push_back({rawSize, elementSize, [box, dtype] (uint64_t first, uint64_t count, uint8_t *out) {
+      box->CopyRawData(dtype, first, count, out);
+    }});
 
-  boxContainerPbMsg.set_dtype(m_dtype);
-  std::vector<T> data = GetData();
+  } else if (format.rawBox) {
+    std::string *rawData = boxContainerPbMsg.mutable_rawdata();
+    rawData->resize(rawSize);
+    CopyRawData(dtype, 0, m_data.size(), reinterpret_cast<uint8_t*>(&(*rawData)[0]));
 
-  if (m_dtype == ns3opengym::INT) {
-    *boxContainerPbMsg.mutable_intdata() = {data.begin(), data.end()};
+  } else if (dtype == ns3opengym::INT) {
+    *boxContainerPbMsg.mutable_intdata() = {m_data.begin(), m_data.end()};
 
-  } else if (m_dtype == ns3opengym::UINT) {
-    *boxContainerPbMsg.mutable_uintdata() = {data.begin(), data.end()};
+  } else if (dtype == ns3opengym::UINT) {
+    *boxContainerPbMsg.mutable_uintdata() = {m_data.begin(), m_data.end()};
 
-  } else if (m_dtype == ns3opengym::FLOAT) {
-    *boxContainerPbMsg.mutable_floatdata() = {data.begin(), data.end()};
+  } else if (dtype == ns3opengym::FLOAT) {
+    *boxContainerPbMsg.mutable_floatdata() = {m_data.begin(), m_data.end()};
 
-  } else if (m_dtype == ns3opengym::DOUBLE) {
-    *boxContainerPbMsg.mutable_doubledata() = {data.begin(), data.end()};
+  } else if (dtype == ns3opengym::DOUBLE) {
+    *boxContainerPbMsg.mutable_doubledata() = {m_data.begin(), m_data.end()};
 
   } else {
-    *boxContainerPbMsg.mutable_floatdata() = {data.begin(), data.end()};
+    *boxContainerPbMsg.mutable_floatdata() = {m_data.begin(), m_data.end()};
   }
 
   dataContainerPbMsg.set_type(ns3opengym::Box);
-  dataContainerPbMsg.mutable_data()->PackFrom(boxContainerPbMsg);
-  return dataContainerPbMsg;
+  if (!format.typed) {
+    dataContainerPbMsg.mutable_data()->PackFrom(packedBox);
+  }
+}
+
+template <typename T>
+bool
+OpenGymBoxContainer<T>::WriteRawData(ns3opengym::Dtype dtype, uint32_t count, uint8_t *out)
+{
+  if (m_data.size() != count) {
+    return false;
+  }
+  return CopyRawData(dtype, 0, count, out);
+}
+
+template <typename T>
+bool
+OpenGymBoxContainer<T>::CopyRawData(ns3opengym::Dtype dtype, uint64_t first, uint64_t count, uint8_t *out) const
+{
+  switch (dtype) {
+    case ns3opengym::INT8: CopyRawData<int8_t>(first, count, out); break;
+    case ns3opengym::UINT8: CopyRawData<uint8_t>(first, count, out); break;
+    case ns3opengym::BOOL: CopyRawData<uint8_t>(first, count, out); break;
+    case ns3opengym::INT16: CopyRawData<int16_t>(first, count, out); break;
+    case ns3opengym::UINT16: CopyRawData<uint16_t>(first, count, out); break;
+    case ns3opengym::INT: CopyRawData<int32_t>(first, count, out); break;
+    case ns3opengym::UINT: CopyRawData<uint32_t>(first, count, out); break;
+    case ns3opengym::INT64: CopyRawData<int64_t>(first, count, out); break;
+    case ns3opengym::UINT64: CopyRawData<uint64_t>(first, count, out); break;
+    case ns3opengym::DOUBLE: CopyRawData<double>(first, count, out); break;
+    case ns3opengym::FLOAT16: return false; // no half type to convert to
+    default: CopyRawData<float>(first, count, out); break;
+  }
+  return true;
+}
+
+template <typename T>
+template <typename W>
+void
+OpenGymBoxContainer<T>::CopyRawData(uint64_t first, uint64_t count, uint8_t *out) const
+{
+  // element type on the wire is W; the host is assumed to be little-endian
+  if constexpr (std::is_same<T, W>::value) {
+    std::memcpy(out, m_data.data() + first, count * sizeof(T));
+  } else {
+    for (uint64_t i = 0; i < count; ++i) {
+      W value = static_cast<W>(m_data[first + i]);
+      std::memcpy(out + i * sizeof(W), &value, sizeof(W));
+    }
+  }
 }
 
 template <typename T>
@@ -239,26 +442,202 @@ OpenGymBoxContainer<T>::GetValue(uint32_t idx)
 
 template <typename T>
 bool
-OpenGymBoxContainer<T>::SetData(std::vector<T> data)
+OpenGymBoxContainer<T>::GetElement(uint32_t idx, double &value)
+{
+  if (idx >= m_data.size())
+  {
+    return false;
+  }
+  value = static_cast<double>(m_data[idx]);
+  return true;
+}
+
+template <typename T>
+bool
+OpenGymBoxContainer<T>::SetData(const std::vector<T> &data)
 {
   m_data = data;
   return true;
 }
 
 template <typename T>
-std::vector<uint32_t>
-OpenGymBoxContainer<T>::GetShape()
+bool
+OpenGymBoxContainer<T>::SetData(std::vector<T> &&data)
 {
-  return m_shape;
+  m_data = std::move(data);
+  return true;
 }
 
 template <typename T>
-std::vector<T>
-OpenGymBoxContainer<T>::GetData()
+const std::vector<T> &
+OpenGymBoxContainer<T>::GetData() const
 {
   return m_data;
 }
 
+template <typename T>
+template <typename InputIt>
+void
+OpenGymBoxContainer<T>::Assign(InputIt first, InputIt last)
+{
+  m_data.assign(first, last);
+}
+
+template <typename T>
+void
+OpenGymBoxContainer<T>::Reserve(uint32_t n)
+{
+  m_data.reserve(n);
+}
+
+template <typename T>
+void
+OpenGymBoxContainer<T>::Resize(uint32_t n)
+{
+  m_data.resize(n);
+}
+
+template <typename T>
+template <typename U>
+typename std::enable_if<!std::is_same<U, bool>::value, const U *>::type
+OpenGymBoxContainer<T>::GetDataPtr() const
+{
+  return m_data.data();
+}
+
+template <typename T>
+template <typename U>
+typename std::enable_if<!std::is_same<U, bool>::value, U *>::type
+OpenGymBoxContainer<T>::GetDataPtr()
+{
+  return m_data.data();
+}
+
+template <typename T>
+uint32_t
+OpenGymBoxContainer<T>::GetSize() const
+{
+  return m_data.size();
+}
+
+template <typename T>
+void
+OpenGymBoxContainer<T>::Clear()
+{
+  m_data.clear();
+}
+
+template <typename T>
+void
+OpenGymBoxContainer<T>::SetShape(const std::vector<uint32_t> &shape)
+{
+  m_shape = shape;
+}
+
+template <typename T>
+const std::vector<uint32_t> &
+OpenGymBoxContainer<T>::GetShape() const
+{
+  return m_shape;
+}
+
+template <typename T>
+bool
+OpenGymBoxContainer<T>::GetLinearIndex(const std::vector<uint32_t> &index, uint64_t &idx) const
+{
+  if (index.size() != m_shape.size()) {
+    return false;
+  }
+  idx = 0;
+  for (size_t d = 0; d < m_shape.size(); ++d) {
+    if (index[d] >= m_shape[d]) {
+      return false;
+    }
+    idx = idx * m_shape[d] + index[d];
+  }
+  return true;
+}
+
+template <typename T>
+std::vector<uint64_t>
+OpenGymBoxContainer<T>::GetStrides() const
+{
+  std::vector<uint64_t> strides(m_shape.size(), 1);
+  for (size_t d = m_shape.size(); d > 1; --d) {
+    strides[d - 2] = strides[d - 1] * m_shape[d - 1];
+  }
+  return strides;
+}
+
+template <typename T>
+T
+OpenGymBoxContainer<T>::GetValue(const std::vector<uint32_t> &index)
+{
+  uint64_t idx;
+  if (!GetLinearIndex(index, idx) || idx >= m_data.size()) {
+    return T();
+  }
+  return m_data[idx];
+}
+
+template <typename T>
+bool
+OpenGymBoxContainer<T>::SetValue(const std::vector<uint32_t> &index, T value)
+{
+  uint64_t idx;
+  if (!GetLinearIndex(index, idx)) {
+    return false;
+  }
+  if (idx >= m_data.size()) {
+    uint64_t size = 1;
+    for (uint32_t dim : m_shape) {
+      size *= dim;
+    }
+    m_data.resize(size);
+  }
+  m_data[idx] = value;
+  return true;
+}
+
+template <typename T>
+OpenGymBoxView<T>
+OpenGymBoxContainer<T>::GetSlice(uint32_t dim, std::vector<uint32_t> index)
+{
+  uint64_t first;
+  if (dim >= m_shape.size() || index.size() != m_shape.size()) {
+    return OpenGymBoxView<T>(m_data, 0, 1, 0);
+  }
+  index[dim] = 0;
+  if (!GetLinearIndex(index, first) || first + (m_shape[dim] - 1) * GetStrides()[dim] >= m_data.size()) {
+    return OpenGymBoxView<T>(m_data, 0, 1, 0);
+  }
+  return OpenGymBoxView<T>(m_data, first, GetStrides()[dim], m_shape[dim]);
+}
+
+template <typename T>
+OpenGymBoxView<T>
+OpenGymBoxContainer<T>::GetRow(uint32_t row)
+{
+  uint32_t rows = m_shape.empty() ? 1 : m_shape[0];
+  uint32_t columns = rows ? m_data.size() / rows : 0;
+  if (row >= rows) {
+    return OpenGymBoxView<T>(m_data, 0, 1, 0);
+  }
+  return OpenGymBoxView<T>(m_data, uint64_t(row) * columns, 1, columns);
+}
+
+template <typename T>
+OpenGymBoxView<T>
+OpenGymBoxContainer<T>::GetColumn(uint32_t column)
+{
+  uint32_t rows = m_shape.empty() ? 1 : m_shape[0];
+  uint32_t columns = rows ? m_data.size() / rows : 0;
+  if (column >= columns) {
+    return OpenGymBoxView<T>(m_data, 0, 1, 0);
+  }
+  return OpenGymBoxView<T>(m_data, column, columns, rows);
+}
+
 template <typename T>
 void
 OpenGymBoxContainer<T>::Print(std::ostream& where) const
@@ -275,6 +654,387 @@ OpenGymBoxContainer<T>::Print(std::ostream& where) const
   where << "]";
 }
 
+/**
+ * Box with mostly zero elements, kept as (row-major index, value) pairs of
+ * the nonzero elements, sorted by index, so that building and sending it
+ * is O(nnz).
+ */
+template <typename T = float>
+class OpenGymSparseBoxContainer : public OpenGymDataContainer
+{
+public:
+  OpenGymSparseBoxContainer ();
+  OpenGymSparseBoxContainer (std::vector<uint32_t> shape);
+  virtual ~OpenGymSparseBoxContainer ();
+
+  static TypeId GetTypeId ();
+
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  virtual bool GetElement(uint32_t idx, double &value);
+  virtual void Clear();
+
+  virtual void Print(std::ostream& where) const;
+  friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymSparseBoxContainer> container)
+  {
+    container->Print(os);
+    return os;
+  }
+
+  // false if idx is outside the shape; adding an index again replaces its value
+  bool AddValue(uint32_t idx, T value);
+  T GetValue(uint32_t idx);
+
+  // indices may come in any order, false if one is outside the shape or repeated
+  bool SetData(std::vector<uint32_t> indices, std::vector<T> values);
+  std::vector<uint32_t> GetIndices();
+  std::vector<T> GetValues();
+
+  // elements outside the new shape are dropped
+  void SetShape(const std::vector<uint32_t> &shape);
+  std::vector<uint32_t> GetShape();
+  // number of elements including the zeros
+  uint32_t GetSize();
+
+protected:
+  // Inherited
+  virtual void DoInitialize (void);
+  virtual void DoDispose (void);
+
+private:
+  // dense Box for peers without CAP_SPARSE_BOX
+  void FillDensePbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  template <typename W>
+  void ScatterRawData(uint8_t *out) const;
+  template <typename W>
+  void PackValues(std::string *out) const;
+  template <typename F>
+  void ScatterRepeated(google::protobuf::RepeatedField<F> *field) const;
+
+  std::vector<uint32_t> m_shape;
+  uint32_t m_size;
+  std::vector<uint32_t> m_indices;
+  std::vector<T> m_values;
+};
+
+template <typename T>
+TypeId
+OpenGymSparseBoxContainer<T>::GetTypeId (void)
+{
+  std::string name = TypeNameGet<T> ();
+  static TypeId tid = TypeId (("ns3::OpenGymSparseBoxContainer<" + name + ">").c_str ())
+    .SetParent<Object> ()
+    .SetGroupName ("OpenGym")
+    .template AddConstructor<OpenGymSparseBoxContainer<T> > ()
+    ;
+  return tid;
+}
+
+template <typename T>
+OpenGymSparseBoxContainer<T>::OpenGymSparseBoxContainer():
+  m_size(0)
+{
+}
+
+template <typename T>
+OpenGymSparseBoxContainer<T>::OpenGymSparseBoxContainer(std::vector<uint32_t> shape):
+  m_shape(shape), m_size(shape.empty() ? 0 : 1)
+{
+  for (uint32_t dim : m_shape) {
+    m_size *= dim;
+  }
+}
+
+template <typename T>
+OpenGymSparseBoxContainer<T>::~OpenGymSparseBoxContainer ()
+{
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::DoDispose (void)
+{
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::DoInitialize (void)
+{
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
+{
+  if (!format.sparseBox) {
+    FillDensePbMsg(dataContainerPbMsg, format);
+    return;
+  }
+
+  ns3opengym::SparseBoxDataContainer &sparseBoxPbMsg = *dataContainerPbMsg.mutable_sparsebox();
+  ns3opengym::Dtype dtype = OpenGymDtype<T>::value;
+  if (!format.fullDtypes || !format.rawBox) {
+    dtype = OpenGymLegacyDtype(dtype);
+  }
+  sparseBoxPbMsg.set_dtype(dtype);
+  *sparseBoxPbMsg.mutable_shape() = {m_shape.begin(), m_shape.end()};
+
+  // the host is assumed to be little-endian
+  std::string *indices = sparseBoxPbMsg.mutable_indices();
+  indices->resize(m_indices.size() * sizeof(uint32_t));
+  std::memcpy(&(*indices)[0], m_indices.data(), indices->size());
+
+  std::string *values = sparseBoxPbMsg.mutable_values();
+  switch (dtype) {
+    case ns3opengym::INT8: PackValues<int8_t>(values); break;
+    case ns3opengym::UINT8: PackValues<uint8_t>(values); break;
+    case ns3opengym::BOOL: PackValues<uint8_t>(values); break;
+    case ns3opengym::INT16: PackValues<int16_t>(values); break;
+    case ns3opengym::UINT16: PackValues<uint16_t>(values); break;
+    case ns3opengym::INT: PackValues<int32_t>(values); break;
+    case ns3opengym::UINT: PackValues<uint32_t>(values); break;
+    case ns3opengym::INT64: PackValues<int64_t>(values); break;
+    case ns3opengym::UINT64: PackValues<uint64_t>(values); break;
+    case ns3opengym::DOUBLE: PackValues<double>(values); break;
+    default: PackValues<float>(values); break;
+  }
+
+  dataContainerPbMsg.set_type(ns3opengym::Box);
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::FillDensePbMsg(ns3opengym::DataContainer &dataContainerPbMsg, const OpenGymWireFormat &format)
+{
+  // written straight into the message, the zeros are never materialized as T
+  ns3opengym::BoxDataContainer packedBox;
+  ns3opengym::BoxDataContainer &boxContainerPbMsg = format.typed ? *dataContainerPbMsg.mutable_box() : packedBox;
+  *boxContainerPbMsg.mutable_shape() = {m_shape.begin(), m_shape.end()};
+
+  ns3opengym::Dtype dtype = OpenGymDtype<T>::value;
+  if (!format.fullDtypes || !format.rawBox) {
+    dtype = OpenGymLegacyDtype(dtype);
+  }
+  boxContainerPbMsg.set_dtype(dtype);
+
+  if (format.rawBox) {
+    std::string *rawData = boxContainerPbMsg.mutable_rawdata();
+    rawData->assign(static_cast<uint64_t>(m_size) * OpenGymDtypeSize(dtype), '\0');
+    uint8_t *out = reinterpret_cast<uint8_t*>(&(*rawData)[0]);
+    switch (dtype) {
+      case ns3opengym::INT8: ScatterRawData<int8_t>(out); break;
+      case ns3opengym::UINT8: ScatterRawData<uint8_t>(out); break;
+      case ns3opengym::BOOL: ScatterRawData<uint8_t>(out); break;
+      case ns3opengym::INT16: ScatterRawData<int16_t>(out); break;
+      case ns3opengym::UINT16: ScatterRawData<uint16_t>(out); break;
+      case ns3opengym::INT: ScatterRawData<int32_t>(out); break;
+      case ns3opengym::UINT: ScatterRawData<uint32_t>(out); break;
+      case ns3opengym::INT64: ScatterRawData<int64_t>(out); break;
+      case ns3opengym::UINT64: ScatterRawData<uint64_t>(out); break;
+      case ns3opengym::DOUBLE: ScatterRawData<double>(out); break;
+      default: ScatterRawData<float>(out); break;
+    }
+
+  } else if (dtype == ns3opengym::INT) {
+    ScatterRepeated(boxContainerPbMsg.mutable_intdata());
+
+  } else if (dtype == ns3opengym::UINT) {
+    ScatterRepeated(boxContainerPbMsg.mutable_uintdata());
+
+  } else if (dtype == ns3opengym::DOUBLE) {
+    ScatterRepeated(boxContainerPbMsg.mutable_doubledata());
+
+  } else {
+    ScatterRepeated(boxContainerPbMsg.mutable_floatdata());
+  }
+
+  dataContainerPbMsg.set_type(ns3opengym::Box);
+  if (!format.typed) {
+    dataContainerPbMsg.mutable_data()->PackFrom(packedBox);
+  }
+}
+
+template <typename T>
+template <typename W>
+void
+OpenGymSparseBoxContainer<T>::ScatterRawData(uint8_t *out) const
+{
+  // element type on the wire is W; the host is assumed to be little-endian
+  for (size_t i = 0; i < m_indices.size(); ++i) {
+    W value = static_cast<W>(m_values[i]);
+    std::memcpy(out + static_cast<uint64_t>(m_indices[i]) * sizeof(W), &value, sizeof(W));
+  }
+}
+
+template <typename T>
+template <typename W>
+void
+OpenGymSparseBoxContainer<T>::PackValues(std::string *out) const
+{
+  // element type on the wire is W; the host is assumed to be little-endian
+  out->resize(m_values.size() * sizeof(W));
+  if constexpr (std::is_same<T, W>::value) {
+    std::memcpy(&(*out)[0], m_values.data(), out->size());
+  } else {
+    for (size_t i = 0; i < m_values.size(); ++i) {
+      W value = static_cast<W>(m_values[i]);
+      std::memcpy(&(*out)[i * sizeof(W)], &value, sizeof(W));
+    }
+  }
+}
+
+template <typename T>
+template <typename F>
+void
+OpenGymSparseBoxContainer<T>::ScatterRepeated(google::protobuf::RepeatedField<F> *field) const
+{
+  field->Resize(m_size, F());
+  for (size_t i = 0; i < m_indices.size(); ++i) {
+    field->Set(m_indices[i], static_cast<F>(m_values[i]));
+  }
+}
+
+template <typename T>
+bool
+OpenGymSparseBoxContainer<T>::AddValue(uint32_t idx, T value)
+{
+  if (idx >= m_size) {
+    return false;
+  }
+  // appending in index order, the usual case, never moves elements
+  auto it = std::lower_bound(m_indices.begin(), m_indices.end(), idx);
+  size_t pos = it - m_indices.begin();
+  if (it != m_indices.end() && *it == idx) {
+    m_values[pos] = value;
+    return true;
+  }
+  m_indices.insert(it, idx);
+  m_values.insert(m_values.begin() + pos, value);
+  return true;
+}
+
+template <typename T>
+T
+OpenGymSparseBoxContainer<T>::GetValue(uint32_t idx)
+{
+  auto it = std::lower_bound(m_indices.begin(), m_indices.end(), idx);
+  if (it != m_indices.end() && *it == idx) {
+    return m_values[it - m_indices.begin()];
+  }
+  return T();
+}
+
+template <typename T>
+bool
+OpenGymSparseBoxContainer<T>::GetElement(uint32_t idx, double &value)
+{
+  if (idx >= m_size)
+  {
+    return false;
+  }
+  value = static_cast<double>(GetValue(idx));
+  return true;
+}
+
+template <typename T>
+bool
+OpenGymSparseBoxContainer<T>::SetData(std::vector<uint32_t> indices, std::vector<T> values)
+{
+  if (indices.size() != values.size()) {
+    return false;
+  }
+  for (uint32_t idx : indices) {
+    if (idx >= m_size) {
+      return false;
+    }
+  }
+  if (!std::is_sorted(indices.begin(), indices.end())) {
+    std::vector<size_t> order(indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&indices] (size_t a, size_t b) { return indices[a] < indices[b]; });
+    std::vector<uint32_t> sortedIndices(indices.size());
+    std::vector<T> sortedValues(values.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      sortedIndices[i] = indices[order[i]];
+      sortedValues[i] = values[order[i]];
+    }
+    indices.swap(sortedIndices);
+    values.swap(sortedValues);
+  }
+  if (std::adjacent_find(indices.begin(), indices.end()) != indices.end()) {
+    return false;
+  }
+  m_indices = std::move(indices);
+  m_values = std::move(values);
+  return true;
+}
+
+template <typename T>
+std::vector<uint32_t>
+OpenGymSparseBoxContainer<T>::GetIndices()
+{
+  return m_indices;
+}
+
+template <typename T>
+std::vector<T>
+OpenGymSparseBoxContainer<T>::GetValues()
+{
+  return m_values;
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::Clear()
+{
+  m_indices.clear();
+  m_values.clear();
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::SetShape(const std::vector<uint32_t> &shape)
+{
+  m_shape = shape;
+  m_size = shape.empty() ? 0 : 1;
+  for (uint32_t dim : m_shape) {
+    m_size *= dim;
+  }
+  // the indices are sorted, so those outside the shape are at the end
+  size_t kept = std::lower_bound(m_indices.begin(), m_indices.end(), m_size) - m_indices.begin();
+  m_indices.resize(kept);
+  m_values.resize(kept);
+}
+
+template <typename T>
+std::vector<uint32_t>
+OpenGymSparseBoxContainer<T>::GetShape()
+{
+  return m_shape;
+}
+
+template <typename T>
+uint32_t
+OpenGymSparseBoxContainer<T>::GetSize()
+{
+  return m_size;
+}
+
+template <typename T>
+void
+OpenGymSparseBoxContainer<T>::Print(std::ostream& where) const
+{
+  where << "{";
+  for (size_t i = 0; i < m_indices.size(); ++i)
+  {
+    if (i > 0)
+      where << ", ";
+    where << m_indices[i] << ": " << std::to_string(m_values[i]);
+  }
+  where << "}";
+}
+
 
 class OpenGymTupleContainer : public OpenGymDataContainer
 {
@@ -284,7 +1044,8 @@ public:
 
   static TypeId GetTypeId ();
 
-  virtual ns3opengym::DataContainer GetDataContainerPbMsg();
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  virtual void Clear();
 
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymTupleContainer> container)
@@ -305,15 +1066,47 @@ protected:
 };
 
 
+/**
+ * Sorted key names of a Dict, the id of a key is its index. A Dict space
+ * interns its keys as they are added and shares them with its Dict
+ * containers (OpenGymDictSpace::GetKeys), which then hold their elements
+ * by id and send ids instead of names (CAP_DICT_KEY_IDS). Keys shared by
+ * several owners are never modified.
+ */
+class OpenGymDictKeys : public SimpleRefCount<OpenGymDictKeys>
+{
+public:
+  OpenGymDictKeys (bool interned = false);
+  OpenGymDictKeys (const OpenGymDictKeys &keys, bool interned);
+
+  // id of key, GetSize() if there is no such key
+  uint32_t Find(const std::string &key) const;
+  const std::string &GetName(uint32_t id) const;
+  uint32_t GetSize() const;
+  // keys of a Dict space, the ids match its space description
+  bool IsInterned() const;
+
+  // id of the new key, ids of the keys after it move up by one; only
+  // for keys nobody shares
+  uint32_t Insert(const std::string &key);
+
+private:
+  std::vector<std::string> m_names;
+  bool m_interned;
+};
+
 class OpenGymDictContainer : public OpenGymDataContainer
 {
 public:
   OpenGymDictContainer ();
+  // elements held by the ids of keys, see OpenGymDictSpace::GetKeys
+  OpenGymDictContainer (Ptr<OpenGymDictKeys> keys);
   virtual ~OpenGymDictContainer ();
 
   static TypeId GetTypeId ();
 
-  virtual ns3opengym::DataContainer GetDataContainerPbMsg();
+  virtual void FillDataContainerPbMsg(ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format);
+  virtual void Clear();
 
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< ( std::ostream& os, const Ptr<OpenGymDictContainer> container)
@@ -325,14 +1118,79 @@ public:
   bool Add(std::string key, Ptr<OpenGymDataContainer> value);
   Ptr<OpenGymDataContainer> Get(std::string key);
 
+  // constant time access by key id, false if there is no such key
+  bool Set(uint32_t id, Ptr<OpenGymDataContainer> value);
+  Ptr<OpenGymDataContainer> Get(uint32_t id);
+  // cleared containers keep their keys, so recycled ones add the same
+  // keys again without allocating
+  void SetKeys(Ptr<OpenGymDictKeys> keys);
+  Ptr<OpenGymDictKeys> GetKeys() const;
+
 protected:
   // Inherited
   virtual void DoInitialize (void);
   virtual void DoDispose (void);
 
-  std::map< std::string, Ptr<OpenGymDataContainer> > m_dict;
+  Ptr<OpenGymDictKeys> m_keys;
+  // one per key in id order, null for keys without an element
+  std::vector< Ptr<OpenGymDataContainer> > m_elements;
+};
+
+/**
+ * Containers recycled across steps. Get returns a cleared container of
+ * type C that is referenced by nothing but the pool, so a container is
+ * reused once everyone (interface, agent code, enclosing Tuple or Dict)
+ * has let go of it, and steady-state steps create no new containers.
+ * Containers are default-constructed; set the shape of reused Boxes.
+ */
+class OpenGymContainerPool
+{
+public:
+  template <typename C>
+  Ptr<C> Get();
+
+  // number of containers owned by the pool
+  uint32_t GetSize() const;
+
+private:
+  // refill the free lists with the containers nobody else holds; unused
+  // Tuples and Dicts are cleared so that their elements become unused too
+  void Reclaim();
+
+  std::vector<std::pair<TypeId, Ptr<OpenGymDataContainer> > > m_containers;
+  // unused containers per type, a sweep refills them once they run dry
+  std::map<TypeId, std::vector<Ptr<OpenGymDataContainer> > > m_free;
 };
 
+template <typename C>
+Ptr<C>
+OpenGymContainerPool::Get()
+{
+  // GetTypeId of the Box templates builds the type name on every call
+  static const TypeId tid = C::GetTypeId();
+  std::vector<Ptr<OpenGymDataContainer> > &free = m_free[tid];
+  if (free.empty()) {
+    Reclaim();
+  }
+  if (free.empty()) {
+    Ptr<C> created = CreateObject<C>();
+    m_containers.push_back(std::make_pair(tid, created));
+    return created;
+  }
+  Ptr<OpenGymDataContainer> container = free.back();
+  free.pop_back();
+  container->Clear();
+  return Ptr<C>(static_cast<C *>(PeekPointer(container)));
+}
+
+// a container recycled from pool if one is given, a new one otherwise
+template <typename C>
+Ptr<C>
+OpenGymCreateContainer(OpenGymContainerPool *pool)
+{
+  return pool ? pool->Get<C>() : CreateObject<C>();
+}
+
 } // end of namespace ns3
 
 #endif /* OPENGYM_CONTAINER_H */
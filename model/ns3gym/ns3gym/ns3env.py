@@ -2,6 +2,7 @@ import os
 import sys
 import zmq
 import time
+import struct
 
 import numpy as np
 
@@ -11,6 +12,7 @@ from gym.utils import seeding
 from enum import IntEnum
 
 from ns3gym.start_sim import start_sim_script, build_ns3_project
+from ns3gym.shm import Ns3ShmChannel
 
 import ns3gym.messages_pb2 as pb
 from google.protobuf.any_pb2 import Any
@@ -22,9 +24,411 @@ __version__ = "0.1.0"
 __email__ = "gawlowicz@tkn.tu-berlin.de"
 
 
+# 1: payloads packed into google.protobuf.Any, 2: typed oneof payloads,
+# 3: Box data as raw bytes, 4: 8/16/64 bit, bool and float16 dtypes,
+# 5: packed observations and actions in compiled space layouts,
+# 6: large Box observations streamed in chunk frames,
+# 7: raw data delta-encoded between steps, 8: sparse Boxes,
+# 9: quantized Boxes in packed observations,
+# 10: features negotiated as Capability bits
+PROTOCOL_VERSION = 10
+
+# Capability bits of peers that only announce a protocolVersion (before v10)
+_VERSION_CAPABILITIES = [
+    (2, pb.CAP_TYPED_PAYLOAD), (3, pb.CAP_RAW_BOX), (4, pb.CAP_FULL_DTYPES),
+    (5, pb.CAP_PACKED_LAYOUT), (5, pb.CAP_STATE_BATCH), (6, pb.CAP_CHUNK_STREAMING),
+    (7, pb.CAP_DELTA_ENCODING), (8, pb.CAP_SPARSE_BOX), (9, pb.CAP_QUANTIZATION),
+]
+
+
+def capabilities_of_version(version):
+    # v1 also covers agents that predate batched states, assumed from v5 on
+    capabilities = 0
+    for added, capability in _VERSION_CAPABILITIES:
+        if version >= added:
+            capabilities |= capability
+    return capabilities
+
+
+CAPABILITIES = capabilities_of_version(9) | pb.CAP_DICT_KEY_IDS
+
+
+def negotiate_capabilities(capabilities, peerVersion, peerCapabilities):
+    """Capability bits both sides use, same rules as OpenGymInterface"""
+    if peerVersion < 10:
+        peerCapabilities = capabilities_of_version(peerVersion)
+    capabilities &= peerCapabilities
+    # drop features whose prerequisites are missing
+    if not capabilities & pb.CAP_TYPED_PAYLOAD:
+        capabilities &= ~(pb.CAP_DELTA_ENCODING | pb.CAP_SPARSE_BOX)
+    if not capabilities & pb.CAP_RAW_BOX:
+        capabilities &= ~(pb.CAP_FULL_DTYPES | pb.CAP_CHUNK_STREAMING)
+    if not capabilities & pb.CAP_PACKED_LAYOUT:
+        capabilities &= ~pb.CAP_QUANTIZATION
+    return capabilities
+
+
+def capability_names(capabilities):
+    return [name for name, bit in pb.Capability.items() if bit and capabilities & bit]
+
+# numpy dtype of BoxDataContainer.rawData elements
+RAW_DTYPES = {
+    pb.INT8: np.dtype('i1'),
+    pb.UINT8: np.dtype('u1'),
+    pb.INT16: np.dtype('<i2'),
+    pb.UINT16: np.dtype('<u2'),
+    pb.INT: np.dtype('<i4'),
+    pb.UINT: np.dtype('<u4'),
+    pb.INT64: np.dtype('<i8'),
+    pb.UINT64: np.dtype('<u8'),
+    pb.BOOL: np.dtype('?'),
+    pb.FLOAT16: np.dtype('<f2'),
+    pb.FLOAT: np.dtype('<f4'),
+    pb.DOUBLE: np.dtype('<f8'),
+}
+# protocol v4 dtype of a numpy dtype
+EXACT_DTYPES = {dtype.newbyteorder('='): pbType for pbType, dtype in RAW_DTYPES.items()}
+
+
+def _payload(container, typedField, anyField, pbType):
+    """Payload of a DataContainer/SpaceDescription, typed (v2) or packed into Any (v1)"""
+    if container.WhichOneof("value") == typedField:
+        return getattr(container, typedField)
+    payload = pbType()
+    getattr(container, anyField).Unpack(payload)
+    return payload
+
+
+def _new_payload(container, typedField, pbType, typed):
+    if typed:
+        payload = getattr(container, typedField)
+        payload.SetInParent()
+        return payload
+    return pbType()
+
+
+def _space_keys(spaceDesc):
+    """Key names of the Dicts in a space description for CAP_DICT_KEY_IDS, a
+    key id is the index of the element in the DictSpace. (names, ids by name,
+    keys of the elements) for Dicts and Tuples (names None), None otherwise"""
+    if spaceDesc.type == pb.Dict:
+        elements = _payload(spaceDesc, "dictSpace", "space", pb.DictSpace).element
+        names = [element.name for element in elements]
+        return (names, {name: i for i, name in enumerate(names)}, [_space_keys(element) for element in elements])
+    if spaceDesc.type == pb.Tuple:
+        elements = _payload(spaceDesc, "tupleSpace", "space", pb.TupleSpace).element
+        return (None, None, [_space_keys(element) for element in elements])
+    return None
+
+
+def _reshape(data, shape):
+    # row-major N-dim view of flat Box data; flat if the shape does not fit
+    if len(shape) > 1 and data.size == int(np.prod(shape)):
+        return data.reshape(shape)
+    return data
+
+
+def _read_streamed(size, dtype, chunks):
+    # assemble a streamed Box (protocol v6) from the next chunk frames
+    data = np.empty(size // np.dtype(dtype).itemsize, dtype=dtype)
+    raw = data.view(np.uint8)
+    offset = 0
+    while offset < size:
+        chunk = next(chunks)
+        raw[offset:offset + len(chunk)] = np.frombuffer(chunk, dtype=np.uint8)
+        offset += len(chunk)
+    return data
+
+
+def _create_sparse(sparseBoxPb, scipySparse):
+    # protocol v8: dense numpy array, or a scipy.sparse.coo_matrix of
+    # (shape[0], remaining elements) that is built in O(nnz)
+    dtype = RAW_DTYPES.get(sparseBoxPb.dtype, RAW_DTYPES[pb.FLOAT])
+    indices = np.frombuffer(sparseBoxPb.indices, dtype="<u4")
+    values = np.frombuffer(sparseBoxPb.values, dtype=dtype)
+    size = int(np.prod(sparseBoxPb.shape)) if sparseBoxPb.shape else 0
+    if scipySparse:
+        import scipy.sparse
+        rows = sparseBoxPb.shape[0] if len(sparseBoxPb.shape) > 1 else 1
+        cols = size // rows if rows else 0
+        return scipy.sparse.coo_matrix((values, np.divmod(indices, cols)), shape=(rows, cols))
+    data = np.zeros(size, dtype=dtype)
+    data[indices] = values
+    return _reshape(data, sparseBoxPb.shape)
+
+
+class SpaceLayout(object):
+    """Flat byte layout of a space, compiled after the init handshake (protocol v5).
+
+    Leaves are laid out depth-first in the order of the space description,
+    without padding: Discrete as int32, Box as prod(shape) elements of its
+    dtype, little-endian. Must match OpenGymLayout in opengym_layout.cc.
+
+    With quantize, Boxes with a quantizedDtype are packed as those integers
+    (protocol v9) and unpacked as offset + scale * value, or as the raw
+    integers without dequantize.
+    """
+    def __init__(self, spaceDesc, quantize=False, dequantize=True):
+        self.size = 0
+        self.quantize = quantize
+        self.dequantize = dequantize
+        self.root = self._compile(spaceDesc)
+
+    @classmethod
+    def compile(cls, spaceDesc, quantize=False, dequantize=True):
+        """Layout of spaceDesc, None if the space has no fixed size"""
+        try:
+            return cls(spaceDesc, quantize, dequantize)
+        except ValueError:
+            return None
+
+    def _compile(self, spaceDesc):
+        # node: (type, offset, dtype, count, children, shape), children of a
+        # quantized Box: (scale, offset)
+        if spaceDesc.type == pb.Discrete:
+            node = (pb.Discrete, self.size, None, 1, None, None)
+            self.size += 4
+            return node
+
+        if spaceDesc.type == pb.Box:
+            boxSpacePb = _payload(spaceDesc, "boxSpace", "space", pb.BoxSpace)
+            if not boxSpacePb.shape:
+                raise ValueError("Box space without shape")
+            dtype = RAW_DTYPES.get(boxSpacePb.exactDtype or boxSpacePb.dtype, RAW_DTYPES[pb.FLOAT])
+            count = int(np.prod(boxSpacePb.shape))
+            quantization = None
+            if self.quantize and boxSpacePb.quantizedDtype:
+                if boxSpacePb.quantizedDtype not in (pb.UINT8, pb.UINT16):
+                    raise ValueError("Unsupported quantized dtype")
+                if len(boxSpacePb.scale) not in (1, count) or len(boxSpacePb.offset) not in (1, count):
+                    raise ValueError("Quantization does not match the shape")
+                dtype = RAW_DTYPES[boxSpacePb.quantizedDtype]
+                quantization = (np.array(boxSpacePb.scale, dtype=np.float32), np.array(boxSpacePb.offset, dtype=np.float32))
+            node = (pb.Box, self.size, dtype, count, quantization, tuple(boxSpacePb.shape))
+            self.size += count * dtype.itemsize
+            return node
+
+        if spaceDesc.type == pb.Tuple:
+            tupleSpacePb = _payload(spaceDesc, "tupleSpace", "space", pb.TupleSpace)
+            return (pb.Tuple, 0, None, 0, [self._compile(element) for element in tupleSpacePb.element], None)
+
+        if spaceDesc.type == pb.Dict:
+            dictSpacePb = _payload(spaceDesc, "dictSpace", "space", pb.DictSpace)
+            return (pb.Dict, 0, None, 0, [(element.name, self._compile(element)) for element in dictSpacePb.element], None)
+
+        raise ValueError("Space without layout")
+
+    def unpack(self, data):
+        """Observation in the structure of _create_data, Boxes are read-only views of data"""
+        return self._unpack(self.root, data)
+
+    def _unpack(self, node, data):
+        spaceType, offset, dtype, count, children, shape = node
+        if spaceType == pb.Box:
+            values = np.frombuffer(data, dtype, count, offset)
+            if children is not None and self.dequantize:
+                scale, zeroPoint = children
+                values = zeroPoint + scale * values
+            return _reshape(values, shape)
+        if spaceType == pb.Discrete:
+            return struct.unpack_from("<i", data, offset)[0]
+        if spaceType == pb.Tuple:
+            return tuple(self._unpack(child, data) for child in children)
+        return {name: self._unpack(child, data) for name, child in children}
+
+    def pack(self, value):
+        """value packed into the layout, ValueError if it does not fit"""
+        buf = bytearray(self.size)
+        self._pack(self.root, value, buf)
+        return bytes(buf)
+
+    def _pack(self, node, value, buf):
+        spaceType, offset, dtype, count, children, shape = node
+        if spaceType == pb.Box and children is not None:
+            # same rounding and clamping as OpenGymLayout
+            scale, zeroPoint = children
+            values = np.asarray(value, dtype=np.float32).ravel()
+            if values.size != count:
+                raise ValueError("Box of {} elements, layout has {}".format(values.size, count))
+            inverseScale = np.divide(1, scale, out=np.zeros_like(scale), where=scale != 0)
+            quantized = np.floor(np.nan_to_num((values - zeroPoint) * inverseScale + 0.5, nan=0))
+            np.frombuffer(buf, dtype, count, offset)[:] = np.clip(quantized, 0, np.iinfo(dtype).max)
+        elif spaceType == pb.Box:
+            data = np.asarray(value, dtype=dtype).ravel()
+            if data.size != count:
+                raise ValueError("Box of {} elements, layout has {}".format(data.size, count))
+            np.frombuffer(buf, dtype, count, offset)[:] = data
+        elif spaceType == pb.Discrete:
+            struct.pack_into("<i", buf, offset, int(value))
+        elif spaceType == pb.Tuple:
+            if len(value) != len(children):
+                raise ValueError("Tuple of {} elements, layout has {}".format(len(value), len(children)))
+            for child, subValue in zip(children, value):
+                self._pack(child, subValue, buf)
+        else:
+            for name, child in children:
+                if name not in value:
+                    raise ValueError("Dict without key {}".format(name))
+                self._pack(child, value[name], buf)
+
+
+def _varint_size(values):
+    return 1 + sum((values >= 1 << bits).astype(np.int64) for bits in (7, 14, 21, 28))
+
+
+class DeltaCache(object):
+    """Raw data of the previous step, for delta encoding (protocol v7).
+
+    Keeps the last rawData of every Box (depth-first order of the Boxes
+    sent with rawData) and the last packed data of one direction. A sender
+    replaces data by the runs of bytes that changed where that is smaller,
+    a receiver patches its copy and restores the full data in the message.
+    Must match OpenGymDelta in the simulation.
+    """
+    MAX_RUN_GAP = 4
+
+    def __init__(self, containerField, packedField):
+        self.containerField = containerField
+        self.packedField = packedField
+        self.boxes = []
+        self.packed = bytearray()
+
+    def encode(self, msg):
+        self._nextBox = 0
+        if msg.HasField(self.containerField):
+            self._encode_container(getattr(msg, self.containerField))
+        packed = getattr(msg, self.packedField)
+        if packed:
+            self.packed, delta = self._encode(packed, self.packed)
+            if delta is not None:
+                setattr(msg, self.packedField, delta[1])
+                getattr(msg, self.packedField + "Delta").run.extend(delta[0])
+
+    def decode(self, msg):
+        """Restore the full data in msg, ValueError if a delta does not fit"""
+        self._nextBox = 0
+        if msg.HasField(self.containerField):
+            self._decode_container(getattr(msg, self.containerField))
+        deltaField = self.packedField + "Delta"
+        if msg.HasField(deltaField):
+            setattr(msg, self.packedField, self._patch(self.packed, getattr(msg, deltaField).run, getattr(msg, self.packedField)))
+            msg.ClearField(deltaField)
+        elif getattr(msg, self.packedField):
+            self.packed = bytearray(getattr(msg, self.packedField))
+
+    def _boxes(self, dataContainerPb):
+        kind = dataContainerPb.WhichOneof("value")
+        if kind == "box":
+            yield dataContainerPb.box
+        elif kind in ("tuple", "dict"):
+            for element in getattr(dataContainerPb, kind).element:
+                for box in self._boxes(element):
+                    yield box
+
+    def _previous(self):
+        if self._nextBox == len(self.boxes):
+            self.boxes.append(bytearray())
+        self._nextBox += 1
+        return self._nextBox - 1
+
+    def _encode_container(self, dataContainerPb):
+        for box in self._boxes(dataContainerPb):
+            if not box.rawData:
+                continue
+            index = self._previous()
+            self.boxes[index], delta = self._encode(box.rawData, self.boxes[index])
+            if delta is not None:
+                box.rawData = delta[1]
+                box.rawDelta.run.extend(delta[0])
+
+    def _decode_container(self, dataContainerPb):
+        for box in self._boxes(dataContainerPb):
+            if box.HasField("rawDelta"):
+                box.rawData = self._patch(self.boxes[self._previous()], box.rawDelta.run, box.rawData)
+                box.ClearField("rawDelta")
+            elif box.rawData:
+                self.boxes[self._previous()] = bytearray(box.rawData)
+
+    @classmethod
+    def _encode(cls, data, previous):
+        # (new previous, (runs, changed bytes) or None to send data whole)
+        if len(data) != len(previous):
+            return bytearray(data), None
+        current = np.frombuffer(data, dtype=np.uint8)
+        changed = np.flatnonzero(current != np.frombuffer(previous, dtype=np.uint8))
+        if changed.size == 0:
+            return previous, ([], b"")
+        # runs end where the next changed byte is more than MAX_RUN_GAP away
+        breaks = np.flatnonzero(np.diff(changed) > cls.MAX_RUN_GAP)
+        starts = changed[np.r_[0, breaks + 1]]
+        ends = changed[np.r_[breaks, changed.size - 1]] + 1
+        skips = starts - np.r_[0, ends[:-1]]
+        lengths = ends - starts
+        if int(lengths.sum() + _varint_size(skips).sum() + _varint_size(lengths).sum()) >= len(data):
+            return bytearray(data), None
+        mask = np.zeros(len(data) + 1, dtype=np.int8)
+        mask[starts] = 1
+        mask[ends] = -1
+        runs = np.empty(2 * starts.size, dtype=np.int64)
+        runs[0::2] = skips
+        runs[1::2] = lengths
+        return bytearray(data), (runs.tolist(), current[np.cumsum(mask[:-1]) > 0].tobytes())
+
+    @staticmethod
+    def _patch(previous, runs, data):
+        if len(runs) % 2:
+            raise ValueError("Delta with an odd number of run fields")
+        offset = consumed = 0
+        for skip, length in zip(runs[0::2], runs[1::2]):
+            offset += skip
+            if offset + length > len(previous) or consumed + length > len(data):
+                raise ValueError("Delta run beyond the {} bytes of the previous data".format(len(previous)))
+            previous[offset:offset + length] = data[consumed:consumed + length]
+            offset += length
+            consumed += length
+        if consumed != len(data):
+            raise ValueError("Delta carries {} bytes for runs of {} bytes".format(len(data), consumed))
+        return bytes(previous)
+
+
+class WakeupCondition(object):
+    """Wake-up predicates evaluated by the simulation on every Notify.
+
+    The agent is only contacted when one predicate fires or maxIdleTime
+    seconds of simulation time passed since the last state; the rewards of
+    the skipped steps are added to the next state. Predicates refer to
+    elements of a Box observation (index 0 for Discrete).
+    """
+    def __init__(self, maxIdleTime=0):
+        self.maxIdleTime = maxIdleTime
+        self.predicates = []
+
+    def above(self, index, threshold):
+        self.predicates.append((pb.WakeupPredicate.Above, index, threshold))
+        return self
+
+    def below(self, index, threshold):
+        self.predicates.append((pb.WakeupPredicate.Below, index, threshold))
+        return self
+
+    def change(self, index=0):
+        self.predicates.append((pb.WakeupPredicate.Change, index, 0))
+        return self
+
+    def to_pb(self):
+        condition = pb.WakeupCondition()
+        condition.maxIdleTime = self.maxIdleTime
+        for ptype, index, threshold in self.predicates:
+            predicate = condition.predicate.add()
+            predicate.type = ptype
+            predicate.index = index
+            predicate.threshold = threshold
+        return condition
+
+
 class Ns3ZmqBridge(object):
     """docstring for Ns3ZmqBridge"""
-    def __init__(self, port=0, startSim=True, simSeed=0, simArgs={}, debug=False):
+    def __init__(self, port=0, startSim=True, simSeed=0, simArgs={}, debug=False, endpoint=None, zmqContext=None, multiplexed=False):
         super(Ns3ZmqBridge, self).__init__()
         port = int(port)
         self.port = port
@@ -35,27 +439,91 @@ class Ns3ZmqBridge(object):
         self.simPid = None
         self.wafPid = None
         self.ns3Process = None
+        self.socket = None
+        self.shm = None
+        # ROUTER serves many multiplexed interfaces, REP a single one
+        socketType = zmq.ROUTER if multiplexed else zmq.REP
+
+        # endpoint the simulation has to connect to, None means tcp://localhost:<port>
+        simEndpoint = None
+        scheme = endpoint.split("://")[0] if endpoint else "tcp"
+
+        if scheme == "shm":
+            name = endpoint[len("shm://"):]
+            if not name and self.startSim:
+                name = "ns3gym-%d" % np.random.randint(5001, 10000)
+                while os.path.exists("/dev/shm/" + name):
+                    name = "ns3gym-%d" % np.random.randint(5001, 10000)
+                print("Got new shared memory segment for ns3gm interface: ", name)
+
+            elif not name:
+                print("Cannot use endpoint %s to attach" % str(endpoint) )
+                print("Please specify shared memory segment name" )
+                sys.exit()
 
-        context = zmq.Context()
-        self.socket = context.socket(zmq.REP)
-        try:
-            if port == 0 and self.startSim:
-                port = self.socket.bind_to_random_port('tcp://*', min_port=5001, max_port=10000, max_tries=100)
-                print("Got new port for ns3gm interface: ", port)
-
-            elif port == 0 and not self.startSim:
-                print("Cannot use port %s to bind" % str(port) )
-                print("Please specify correct port" )
+            self.shm = Ns3ShmChannel(name)
+            simEndpoint = "shm://" + name
+
+        elif scheme in ["ipc", "inproc"]:
+            # inproc peers have to share the ZMQ context, e.g. via zmq.Context.shadow()
+            context = zmqContext if zmqContext else zmq.Context.instance()
+            self.socket = context.socket(socketType)
+            try:
+                self.socket.bind(endpoint)
+            except Exception as e:
+                print("Cannot bind to %s" % str(endpoint) )
                 sys.exit()
+            simEndpoint = endpoint
+
+        elif scheme == "tcp":
+            host = "*"
+            if endpoint:
+                host, port = endpoint[len("tcp://"):].rsplit(":", 1)
+                port = int(port)
+                if host not in ["*", "0.0.0.0"]:
+                    simEndpoint = endpoint
+
+            context = zmqContext if zmqContext else zmq.Context()
+            self.socket = context.socket(socketType)
+            try:
+                if port == 0 and self.startSim:
+                    port = self.socket.bind_to_random_port('tcp://%s' % host, min_port=5001, max_port=10000, max_tries=100)
+                    print("Got new port for ns3gm interface: ", port)
+                    if simEndpoint:
+                        # the simulation connects to the port actually bound
+                        simEndpoint = "tcp://%s:%d" % (host, port)
+
+                elif port == 0 and not self.startSim:
+                    print("Cannot use port %s to bind" % str(port) )
+                    print("Please specify correct port" )
+                    sys.exit()
+
+                elif simEndpoint:
+                    self.socket.bind (simEndpoint)
 
-            else:
-                self.socket.bind ("tcp://*:%s" % str(port))
+                else:
+                    self.socket.bind ("tcp://*:%s" % str(port))
 
-        except Exception as e:
-            print("Cannot bind to tcp://*:%s as port is already in use" % str(port) )
-            print("Please specify different port or use 0 to get free port" )
+            except Exception as e:
+                print("Cannot bind to tcp://*:%s as port is already in use" % str(port) )
+                print("Please specify different port or use 0 to get free port" )
+                sys.exit()
+
+        else:
+            print("Unsupported endpoint: %s" % str(endpoint) )
+            print("Please use tcp://, ipc://, inproc:// or shm://" )
             sys.exit()
 
+        self.port = port
+        self.endpoint = simEndpoint if simEndpoint else "tcp://localhost:%s" % str(port)
+        if simEndpoint or multiplexed:
+            simArgs = dict(simArgs)
+            if simEndpoint:
+                simArgs["--OpenGymInterface::Endpoint"] = simEndpoint
+            if multiplexed:
+                simArgs["--OpenGymInterface::Multiplexed"] = "true"
+            self.simArgs = simArgs
+
         if (startSim == True and simSeed == 0):
             maxSeed = np.iinfo(np.uint32).max
             simSeed = np.random.randint(0, maxSeed)
@@ -64,6 +532,9 @@ class Ns3ZmqBridge(object):
         if self.startSim:
             # run simulation script
             self.ns3Process = start_sim_script(port, simSeed, simArgs, debug)
+        elif simEndpoint:
+            print("Waiting for simulation script to connect on endpoint: {}".format(simEndpoint))
+            print('Please start proper ns-3 simulation script with --OpenGymInterface::Endpoint={}'.format(simEndpoint))
         else:
             print("Waiting for simulation script to connect on port: tcp://localhost:{}".format(port))
             print('Please start proper ns-3 simulation script using ./waf --run "..."')
@@ -76,8 +547,24 @@ class Ns3ZmqBridge(object):
         self.reward = 0
         self.gameOver = False
         self.gameOverReason = None
+        self.stepIdx = 0
         self.extraInfo = None
         self.newStateRx = False
+        self.batchSize = 1
+        self.wakeup = None
+        self.protocolVersion = 1
+        # Capability bits agreed on in the init handshake
+        self.capabilities = 0
+        # decode sparse Boxes to scipy.sparse instead of dense arrays
+        self.scipySparse = False
+        # quantized Boxes as floats instead of the raw integers
+        self.dequantize = True
+        self._obsLayout = None
+        self._actLayout = None
+        self._obsKeys = None
+        self._actKeys = None
+        self._obsDelta = None
+        self._actDelta = None
 
     def close(self):
         try:
@@ -95,37 +582,61 @@ class Ns3ZmqBridge(object):
                     self.wafPid = None
         except Exception as e:
             pass
+        if self.shm:
+            self.shm.close()
+            self.shm = None
+
+    def _send(self, msg):
+        if self.shm:
+            self.shm.send(msg)
+        else:
+            self.socket.send(msg)
+
+    def _recv(self):
+        if self.shm:
+            return self.shm.recv()
+        return self.socket.recv()
+
+    def _send_multipart(self, frames):
+        if self.shm:
+            self.shm.send_multipart(frames)
+        else:
+            self.socket.send_multipart(frames)
+
+    def _recv_multipart(self):
+        if self.shm:
+            return self.shm.recv_multipart()
+        return self.socket.recv_multipart()
 
     def _create_space(self, spaceDesc):
         space = None
         if (spaceDesc.type == pb.Discrete):
-            discreteSpacePb = pb.DiscreteSpace()
-            spaceDesc.space.Unpack(discreteSpacePb)
+            discreteSpacePb = _payload(spaceDesc, "discreteSpace", "space", pb.DiscreteSpace)
             space = spaces.Discrete(discreteSpacePb.n)
 
         elif (spaceDesc.type == pb.Box):
-            boxSpacePb = pb.BoxSpace()
-            spaceDesc.space.Unpack(boxSpacePb)
+            boxSpacePb = _payload(spaceDesc, "boxSpace", "space", pb.BoxSpace)
             low = boxSpacePb.low
             high = boxSpacePb.high
             shape = tuple(boxSpacePb.shape)
             mtype = boxSpacePb.dtype
 
-            if mtype == pb.INT:
-                mtype = np.int
+            if boxSpacePb.exactDtype in RAW_DTYPES:
+                mtype = RAW_DTYPES[boxSpacePb.exactDtype].newbyteorder('=')
+            elif mtype == pb.INT:
+                mtype = int
             elif mtype == pb.UINT:
                 mtype = np.uint
             elif mtype == pb.DOUBLE:
-                mtype = np.float
+                mtype = float
             else:
-                mtype = np.float
+                mtype = float
 
             space = spaces.Box(low=low, high=high, shape=shape, dtype=mtype)
 
         elif (spaceDesc.type == pb.Tuple):
             mySpaceList = []
-            tupleSpacePb = pb.TupleSpace()
-            spaceDesc.space.Unpack(tupleSpacePb)
+            tupleSpacePb = _payload(spaceDesc, "tupleSpace", "space", pb.TupleSpace)
 
             for pbSubSpaceDesc in tupleSpacePb.element:
                 subSpace = self._create_space(pbSubSpaceDesc)
@@ -136,8 +647,7 @@ class Ns3ZmqBridge(object):
 
         elif (spaceDesc.type == pb.Dict):
             mySpaceDict = {}
-            dictSpacePb = pb.DictSpace()
-            spaceDesc.space.Unpack(dictSpacePb)
+            dictSpacePb = _payload(spaceDesc, "dictSpace", "space", pb.DictSpace)
 
             for pbSubSpaceDesc in dictSpacePb.element:
                 subSpace = self._create_space(pbSubSpaceDesc)
@@ -147,8 +657,8 @@ class Ns3ZmqBridge(object):
 
         return space
 
-    def initialize_env(self, stepInterval):
-        request = self.socket.recv()
+    def initialize_env(self, stepInterval, wakeup=None, deltaEncoding=False):
+        request = self._recv()
         simInitMsg = pb.SimInitMsg()
         simInitMsg.ParseFromString(request)
 
@@ -156,14 +666,45 @@ class Ns3ZmqBridge(object):
         self.wafPid = int(simInitMsg.wafShellProcessId)
         self._action_space = self._create_space(simInitMsg.actSpace)
         self._observation_space = self._create_space(simInitMsg.obsSpace)
+        # simulations without a protocolVersion speak v1
+        self.protocolVersion = min(max(1, simInitMsg.protocolVersion), PROTOCOL_VERSION)
+        self.capabilities = negotiate_capabilities(CAPABILITIES, self.protocolVersion, simInitMsg.capabilities)
+        # states arrive in batches, obs/reward/info become lists and step takes one action per state
+        self.batchSize = max(1, simInitMsg.batchSize) if self._uses(pb.CAP_STATE_BATCH) else 1
+        if self._uses(pb.CAP_PACKED_LAYOUT):
+            self._obsLayout = SpaceLayout.compile(simInitMsg.obsSpace, self._uses(pb.CAP_QUANTIZATION), self.dequantize)
+            self._actLayout = SpaceLayout.compile(simInitMsg.actSpace)
+        if self._uses(pb.CAP_DICT_KEY_IDS):
+            self._obsKeys = _space_keys(simInitMsg.obsSpace)
+            self._actKeys = _space_keys(simInitMsg.actSpace)
+        if self._uses(pb.CAP_DELTA_ENCODING):
+            # observation deltas are up to the simulation (DeltaEncoding attribute)
+            self._obsDelta = DeltaCache("obsData", "packedObs")
+            if deltaEncoding:
+                self._actDelta = DeltaCache("actData", "packedAct")
 
         reply = pb.SimInitAck()
         reply.done = True
         reply.stopSimReq = False
+        reply.protocolVersion = PROTOCOL_VERSION
+        reply.capabilities = CAPABILITIES
+        if wakeup is not None:
+            reply.wakeup.CopyFrom(wakeup.to_pb())
         replyMsg = reply.SerializeToString()
-        self.socket.send(replyMsg)
+        self._send(replyMsg)
         return True
 
+    def _uses(self, capability):
+        return bool(self.capabilities & capability)
+
+    def get_protocol(self):
+        """Negotiated protocol version and names of the Capability bits in use"""
+        return self.protocolVersion, capability_names(self.capabilities)
+
+    def set_wakeup(self, wakeup):
+        # sent along with the next actions, an empty condition wakes on every step
+        self.wakeup = wakeup if wakeup is not None else WakeupCondition()
+
     def get_action_space(self):
         return self._action_space
 
@@ -177,14 +718,39 @@ class Ns3ZmqBridge(object):
         if self.newStateRx:
             return
 
-        request = self.socket.recv()
-        envStateMsg = pb.EnvStateMsg()
-        envStateMsg.ParseFromString(request)
-
-        self.obsData = self._create_data(envStateMsg.obsData)
-        self.reward = envStateMsg.reward
-        self.gameOver = envStateMsg.isGameOver
-        self.gameOverReason = envStateMsg.reason
+        chunks = None
+        if self._uses(pb.CAP_CHUNK_STREAMING):
+            # streamed Box data follows the state message in chunk frames
+            frames = self._recv_multipart()
+            request = frames[0]
+            chunks = iter(frames[1:])
+        else:
+            request = self._recv()
+        if self.batchSize > 1:
+            envStateBatchMsg = pb.EnvStateBatchMsg()
+            envStateBatchMsg.ParseFromString(request)
+            states = envStateBatchMsg.state
+        else:
+            envStateMsg = pb.EnvStateMsg()
+            envStateMsg.ParseFromString(request)
+            states = [envStateMsg]
+        if self._obsDelta:
+            for state in states:
+                self._obsDelta.decode(state)
+
+        self.obsData = [self._get_obs(state, self._obsLayout, chunks, self._obsKeys) for state in states]
+        self.reward = [state.reward for state in states]
+        self.stepIdx = [state.stepIdx for state in states]
+        self.extraInfo = [state.info if state.info else {} for state in states]
+        # game over can only be the last state of a batch
+        self.gameOver = states[-1].isGameOver
+        self.gameOverReason = states[-1].reason
+
+        if self.batchSize == 1:
+            self.obsData = self.obsData[0]
+            self.reward = self.reward[0]
+            self.stepIdx = self.stepIdx[0]
+            self.extraInfo = self.extraInfo[0]
 
         if self.gameOver:
             if self.gameOverReason == pb.EnvStateMsg.SimulationEnd:
@@ -194,57 +760,88 @@ class Ns3ZmqBridge(object):
                 self.forceEnvStop = True
                 self.send_close_command()
 
-        self.extraInfo = envStateMsg.info
-        if not self.extraInfo:
-            self.extraInfo = {}
-
         self.newStateRx = True
 
+    def _send_act_msgs(self, acts):
+        if self.batchSize > 1:
+            reply = pb.EnvActBatchMsg()
+            reply.act.extend(acts)
+        else:
+            reply = acts[0]
+        self._send(reply.SerializeToString())
+
     def send_close_command(self):
         reply = pb.EnvActMsg()
+        reply.stepIdx = self.stepIdx[-1] if self.batchSize > 1 else self.stepIdx
         reply.stopSimReq = True
 
-        replyMsg = reply.SerializeToString()
-        self.socket.send(replyMsg)
+        self._send_act_msgs([reply])
         self.newStateRx = False
         return True
 
-    def send_actions(self, actions):
-        reply = pb.EnvActMsg()
+    def send_actions(self, actions, repeat=1):
+        if self.batchSize > 1:
+            stepIdxs = self.stepIdx
+        else:
+            stepIdxs = [self.stepIdx]
+            actions = [actions]
 
-        actionMsg = self._pack_data(actions, self._action_space)
-        reply.actData.CopyFrom(actionMsg)
+        acts = []
+        for stepIdx, action in zip(stepIdxs, actions):
+            reply = pb.EnvActMsg()
+            reply.stepIdx = stepIdx
 
-        reply.stopSimReq = False
-        if self.forceEnvStop:
-            reply.stopSimReq = True
+            self._set_action(reply, action, self._action_space, self._actLayout, self._actKeys)
+            if self._actDelta:
+                self._actDelta.encode(reply)
 
-        replyMsg = reply.SerializeToString()
-        self.socket.send(replyMsg)
+            # the simulation reapplies the action for repeat steps and reports the summed reward
+            reply.repeat = repeat
+
+            reply.stopSimReq = False
+            if self.forceEnvStop:
+                reply.stopSimReq = True
+            acts.append(reply)
+
+        if self.wakeup is not None:
+            acts[-1].wakeup.CopyFrom(self.wakeup.to_pb())
+            self.wakeup = None
+
+        self._send_act_msgs(acts)
         self.newStateRx = False
         return True
 
-    def step(self, actions):
+    def step(self, actions, repeat=1):
         # exec actions for current state
-        self.send_actions(actions)
+        self.send_actions(actions, repeat)
         # get result of above actions
         self.rx_env_state()
 
     def is_game_over(self):
         return self.gameOver
 
-    def _create_data(self, dataContainerPb):
+    def _create_data(self, dataContainerPb, chunks=None, keys=None):
         if (dataContainerPb.type == pb.Discrete):
-            discreteContainerPb = pb.DiscreteDataContainer()
-            dataContainerPb.data.Unpack(discreteContainerPb)
+            discreteContainerPb = _payload(dataContainerPb, "discrete", "data", pb.DiscreteDataContainer)
             data = discreteContainerPb.data
             return data
 
         if (dataContainerPb.type == pb.Box):
-            boxContainerPb = pb.BoxDataContainer()
-            dataContainerPb.data.Unpack(boxContainerPb)
+            if dataContainerPb.WhichOneof("value") == "sparseBox":
+                return _create_sparse(dataContainerPb.sparseBox, self.scipySparse)
+
+            boxContainerPb = _payload(dataContainerPb, "box", "data", pb.BoxDataContainer)
             # print(boxContainerPb.shape, boxContainerPb.dtype, boxContainerPb.uintData)
 
+            if boxContainerPb.streamedSize:
+                dtype = RAW_DTYPES.get(boxContainerPb.dtype, RAW_DTYPES[pb.FLOAT])
+                return _reshape(_read_streamed(boxContainerPb.streamedSize, dtype, chunks), boxContainerPb.shape)
+
+            if boxContainerPb.rawData:
+                # read-only view of the message buffer, no per-element decoding
+                data = np.frombuffer(boxContainerPb.rawData, dtype=RAW_DTYPES.get(boxContainerPb.dtype, RAW_DTYPES[pb.FLOAT]))
+                return _reshape(data, boxContainerPb.shape)
+
             if boxContainerPb.dtype == pb.INT:
                 data = boxContainerPb.intData
             elif boxContainerPb.dtype == pb.UINT:
@@ -254,34 +851,55 @@ class Ns3ZmqBridge(object):
             else:
                 data = boxContainerPb.floatData
 
-            # TODO: reshape using shape info
             data = np.array(data)
-            return data
+            return _reshape(data, boxContainerPb.shape)
 
         elif (dataContainerPb.type == pb.Tuple):
-            tupleDataPb = pb.TupleDataContainer()
-            dataContainerPb.data.Unpack(tupleDataPb)
+            tupleDataPb = _payload(dataContainerPb, "tuple", "data", pb.TupleDataContainer)
 
             myDataList = []
-            for pbSubData in tupleDataPb.element:
-                subData = self._create_data(pbSubData)
+            for i, pbSubData in enumerate(tupleDataPb.element):
+                subKeys = keys[2][i] if keys is not None and i < len(keys[2]) else None
+                subData = self._create_data(pbSubData, chunks, subKeys)
                 myDataList.append(subData)
 
             data = tuple(myDataList)
             return data
 
         elif (dataContainerPb.type == pb.Dict):
-            dictDataPb = pb.DictDataContainer()
-            dataContainerPb.data.Unpack(dictDataPb)
+            dictDataPb = _payload(dataContainerPb, "dict", "data", pb.DictDataContainer)
 
             myDataDict = {}
+            names, ids, subKeys = keys if keys is not None and keys[0] is not None else (None, {}, None)
+            if names is not None and len(dictDataPb.key) == len(dictDataPb.element) > 0:
+                # CAP_DICT_KEY_IDS: names from the space description
+                for keyId, pbSubData in zip(dictDataPb.key, dictDataPb.element):
+                    myDataDict[names[keyId]] = self._create_data(pbSubData, chunks, subKeys[keyId])
+                return myDataDict
+
             for pbSubData in dictDataPb.element:
-                subData = self._create_data(pbSubData)
+                keyId = ids.get(pbSubData.name)
+                subData = self._create_data(pbSubData, chunks, subKeys[keyId] if keyId is not None else None)
                 myDataDict[pbSubData.name] = subData
 
             data = myDataDict
             return data
 
+    def _get_obs(self, envStateMsg, layout, chunks=None, keys=None):
+        if envStateMsg.packedObs and layout is not None:
+            return layout.unpack(envStateMsg.packedObs)
+        return self._create_data(envStateMsg.obsData, chunks, keys)
+
+    def _set_action(self, reply, action, space, layout, keys=None):
+        if layout is not None:
+            try:
+                reply.packedAct = layout.pack(action)
+                return
+            except (ValueError, TypeError):
+                # does not fit the space, let the simulation see it as it is
+                pass
+        reply.actData.CopyFrom(self._pack_data(action, space, keys))
+
     def get_obs(self):
         return self.obsData
 
@@ -291,97 +909,148 @@ class Ns3ZmqBridge(object):
     def get_extra_info(self):
         return self.extraInfo
 
-    # add a context for the nested action, an Optional[Space]
-    def _pack_data(self, actions, spaceDesc, context=None):
+    def _pack_data(self, actions, spaceDesc, keys=None):
         dataContainer = pb.DataContainer()
+        typed = self._uses(pb.CAP_TYPED_PAYLOAD)
 
         spaceType = spaceDesc.__class__
 
         if spaceType == spaces.Discrete:
             dataContainer.type = pb.Discrete
-            discreteContainerPb = pb.DiscreteDataContainer()
+            discreteContainerPb = _new_payload(dataContainer, "discrete", pb.DiscreteDataContainer, typed)
             discreteContainerPb.data = actions
-            dataContainer.data.Pack(discreteContainerPb)
+            if not typed:
+                dataContainer.data.Pack(discreteContainerPb)
 
         elif spaceType == spaces.Box:
             dataContainer.type = pb.Box
-            boxContainerPb = pb.BoxDataContainer()
-            shape = [len(actions)]
-            boxContainerPb.shape.extend(shape)
+            boxContainerPb = _new_payload(dataContainer, "box", pb.BoxDataContainer, typed)
+            # row-major, in the shape of the space if the number of elements fits
+            values = np.asarray(actions)
+            shape = spaceDesc.shape if values.size == int(np.prod(spaceDesc.shape)) else values.shape
+            boxContainerPb.shape.extend(shape or (values.size,))
+
+            if self._uses(pb.CAP_FULL_DTYPES) and np.dtype(spaceDesc.dtype) in EXACT_DTYPES:
+                boxContainerPb.dtype = EXACT_DTYPES[np.dtype(spaceDesc.dtype)]
+                repeatedData = None
 
-            if (spaceDesc.dtype in ['int', 'int8', 'int16', 'int32', 'int64']):
+            elif (spaceDesc.dtype in ['int', 'int8', 'int16', 'int32', 'int64']):
                 boxContainerPb.dtype = pb.INT
-                boxContainerPb.intData.extend(actions)
+                repeatedData = boxContainerPb.intData
 
             elif (spaceDesc.dtype in ['uint', 'uint8', 'uint16', 'uint32', 'uint64']):
                 boxContainerPb.dtype = pb.UINT
-                boxContainerPb.uintData.extend(actions)
+                repeatedData = boxContainerPb.uintData
 
             elif (spaceDesc.dtype in ['float', 'float32', 'float64']):
                 boxContainerPb.dtype = pb.FLOAT
-                boxContainerPb.floatData.extend(actions)
+                repeatedData = boxContainerPb.floatData
 
             elif (spaceDesc.dtype in ['double']):
                 boxContainerPb.dtype = pb.DOUBLE
-                boxContainerPb.doubleData.extend(actions)
+                repeatedData = boxContainerPb.doubleData
 
             else:
                 boxContainerPb.dtype = pb.FLOAT
-                boxContainerPb.floatData.extend(actions)
+                repeatedData = boxContainerPb.floatData
 
-            dataContainer.data.Pack(boxContainerPb)
+            if self._uses(pb.CAP_RAW_BOX):
+                boxContainerPb.rawData = values.astype(RAW_DTYPES[boxContainerPb.dtype], copy=False).tobytes()
+            else:
+                repeatedData.extend(values.ravel().tolist())
+
+            if not typed:
+                dataContainer.data.Pack(boxContainerPb)
 
         elif spaceType == spaces.Tuple:
             dataContainer.type = pb.Tuple
-            tupleDataPb = pb.TupleDataContainer()
+            tupleDataPb = _new_payload(dataContainer, "tuple", pb.TupleDataContainer, typed)
 
-            spaceList = list(self._action_space.spaces)
+            spaceList = list(spaceDesc.spaces)
+            subKeysList = keys[2] if keys is not None else [None] * len(spaceList)
             subDataList = []
-            for subAction, subActSpaceType in zip(actions, spaceList):
-                subData = self._pack_data(subAction, subActSpaceType)
+            for subAction, subActSpaceType, subKeys in zip(actions, spaceList, subKeysList):
+                subData = self._pack_data(subAction, subActSpaceType, subKeys)
                 subDataList.append(subData)
 
             tupleDataPb.element.extend(subDataList)
-            dataContainer.data.Pack(tupleDataPb)
+            if not typed:
+                dataContainer.data.Pack(tupleDataPb)
 
         elif spaceType == spaces.Dict:
             dataContainer.type = pb.Dict
-            dictDataPb = pb.DictDataContainer()
+            dictDataPb = _new_payload(dataContainer, "dict", pb.DictDataContainer, typed)
+
+            # CAP_DICT_KEY_IDS: key ids instead of names if the space has all keys
+            ids = keys[1] if keys is not None and keys[0] is not None else {}
+            keyIds = [ids.get(sName) for sName in actions.keys()]
+            if None in keyIds:
+                keyIds = None
 
             subDataList = []
-            for sName, subAction in actions.items():
-                # if there is a context, retrieve its type
-                if context is None:
-                    subActSpaceType = self._action_space.spaces[sName]
-                else:
-                    subActSpaceType = context.spaces[sName]
-                # if there there is a nested dict, create a subcontext
-                if type(subActSpaceType) == spaces.Dict and context is None:
-                    subcontext = self._action_space.spaces[sName]
-                elif type(subActSpaceType) == spaces.Dict:
-                    subcontext = context.spaces[sName]
-                else:
-                    subcontext = None
-                # create the data within the new context
-                subData = self._pack_data(subAction, subActSpaceType, context=subcontext)
+            for i, (sName, subAction) in enumerate(actions.items()):
+                subActSpaceType = spaceDesc.spaces[sName]
+                subData = self._pack_data(subAction, subActSpaceType, keys[2][keyIds[i]] if keyIds else None)
 
-                subData.name = sName
+                if keyIds is None:
+                    subData.name = sName
                 subDataList.append(subData)
 
             dictDataPb.element.extend(subDataList)
-            dataContainer.data.Pack(dictDataPb)
+            if keyIds:
+                dictDataPb.key.extend(keyIds)
+            if not typed:
+                dataContainer.data.Pack(dictDataPb)
 
         return dataContainer
 
 
+class Ns3TelemetrySubscriber(object):
+    """Consumer of the telemetry channel of OpenGymInterface (TelemetryEndpoint).
+
+    The simulation never waits for subscribers, a slow one loses messages.
+    """
+    # reuse the decoder of the bridge
+    _create_data = Ns3ZmqBridge._create_data
+
+    def __init__(self, endpoint, topics=None, zmqContext=None, scipySparse=False):
+        self.scipySparse = scipySparse
+        context = zmqContext if zmqContext else zmq.Context.instance()
+        self.socket = context.socket(zmq.SUB)
+        self.socket.connect(endpoint.replace("*", "localhost"))
+        for topic in (topics if topics else [""]):
+            self.socket.setsockopt(zmq.SUBSCRIBE, topic.encode())
+
+    def recv(self, timeout=None):
+        """Returns (name, simTime, envId, data) or None if nothing arrived within timeout seconds"""
+        if timeout is not None and not self.socket.poll(int(timeout * 1000)):
+            return None
+        topic, request = self.socket.recv_multipart()
+        telemetryMsg = pb.TelemetryMsg()
+        telemetryMsg.ParseFromString(request)
+        data = self._create_data(telemetryMsg.data)
+        return telemetryMsg.name, telemetryMsg.simTime, telemetryMsg.envId, data
+
+    def close(self):
+        self.socket.close(linger=0)
+
+
 class Ns3Env(gym.Env):
-    def __init__(self, stepTime=0, port=0, startSim=True, simSeed=0, simArgs={}, debug=False):
+    def __init__(self, stepTime=0, port=0, startSim=True, simSeed=0, simArgs={}, debug=False, endpoint=None, wakeup=None, deltaEncoding=False, scipySparse=False, dequantize=True):
         self.stepTime = stepTime
         self.port = port
         self.startSim = startSim
         self.simSeed = simSeed
         self.simArgs = simArgs
         self.debug = debug
+        self.endpoint = endpoint
+        self.wakeup = wakeup
+        # send actions as changes since the previous step (protocol v7)
+        self.deltaEncoding = deltaEncoding
+        # sparse Box observations as scipy.sparse.coo_matrix (protocol v8)
+        self.scipySparse = scipySparse
+        # quantized observations as floats, or the raw integers (protocol v9)
+        self.dequantize = dequantize
 
         # Filled in reset function
         self.ns3ZmqBridge = None
@@ -392,8 +1061,10 @@ class Ns3Env(gym.Env):
         self.state = None
         self.steps_beyond_done = None
 
-        self.ns3ZmqBridge = Ns3ZmqBridge(self.port, self.startSim, self.simSeed, self.simArgs, self.debug)
-        self.ns3ZmqBridge.initialize_env(self.stepTime)
+        self.ns3ZmqBridge = Ns3ZmqBridge(self.port, self.startSim, self.simSeed, self.simArgs, self.debug, self.endpoint)
+        self.ns3ZmqBridge.scipySparse = self.scipySparse
+        self.ns3ZmqBridge.dequantize = self.dequantize
+        self.ns3ZmqBridge.initialize_env(self.stepTime, self.wakeup, self.deltaEncoding)
         self.action_space = self.ns3ZmqBridge.get_action_space()
         self.observation_space = self.ns3ZmqBridge.get_observation_space()
         # get first observations
@@ -412,8 +1083,8 @@ class Ns3Env(gym.Env):
         extraInfo = self.ns3ZmqBridge.get_extra_info()
         return (obs, reward, done, extraInfo)
 
-    def step(self, action):
-        response = self.ns3ZmqBridge.step(action)
+    def step(self, action, repeat=1):
+        response = self.ns3ZmqBridge.step(action, repeat)
         self.envDirty = True
         return self.get_state()
 
@@ -427,8 +1098,10 @@ class Ns3Env(gym.Env):
             self.ns3ZmqBridge = None
 
         self.envDirty = False
-        self.ns3ZmqBridge = Ns3ZmqBridge(self.port, self.startSim, self.simSeed, self.simArgs, self.debug)
-        self.ns3ZmqBridge.initialize_env(self.stepTime)
+        self.ns3ZmqBridge = Ns3ZmqBridge(self.port, self.startSim, self.simSeed, self.simArgs, self.debug, self.endpoint)
+        self.ns3ZmqBridge.scipySparse = self.scipySparse
+        self.ns3ZmqBridge.dequantize = self.dequantize
+        self.ns3ZmqBridge.initialize_env(self.stepTime, self.wakeup, self.deltaEncoding)
         self.action_space = self.ns3ZmqBridge.get_action_space()
         self.observation_space = self.ns3ZmqBridge.get_observation_space()
         # get first observations
@@ -436,6 +1109,15 @@ class Ns3Env(gym.Env):
         obs = self.ns3ZmqBridge.get_obs()
         return obs
 
+    def get_protocol(self):
+        """Negotiated protocol version and Capability names, see Ns3ZmqBridge.get_protocol"""
+        return self.ns3ZmqBridge.get_protocol()
+
+    def set_wakeup(self, wakeup):
+        """Replace the wake-up predicates, see WakeupCondition; takes effect with the next step"""
+        self.wakeup = wakeup
+        self.ns3ZmqBridge.set_wakeup(wakeup)
+
     def render(self, mode='human'):
         return
 
@@ -450,3 +1132,178 @@ class Ns3Env(gym.Env):
 
         if self.viewer:
             self.viewer.close()
+
+
+# multiplexed mode: env id and MsgType in front of every message
+ENVELOPE = struct.Struct("<II")
+
+
+class Ns3MultiEnv(object):
+    """Agent side of many OpenGymInterface instances with Multiplexed=true.
+
+    All environments share one socket (ROUTER) or shared-memory channel,
+    every message is tagged with the EnvId of its interface. recv() returns
+    the next state of any environment, send() answers it.
+    """
+    # states of an environment are answered one by one, no batches
+    CAPABILITIES = CAPABILITIES & ~pb.CAP_STATE_BATCH
+
+    def __init__(self, port=0, startSim=True, simSeed=0, simArgs={}, debug=False, endpoint=None, zmqContext=None, wakeup=None, deltaEncoding=False, scipySparse=False, dequantize=True):
+        self.ns3ZmqBridge = Ns3ZmqBridge(port, startSim, simSeed, simArgs, debug, endpoint, zmqContext, multiplexed=True)
+        # sparse Box observations as scipy.sparse.coo_matrix (protocol v8)
+        self.ns3ZmqBridge.scipySparse = scipySparse
+        # quantized observations as floats, or the raw integers (protocol v9)
+        self.ns3ZmqBridge.dequantize = dequantize
+        # wake-up predicates of every environment, see WakeupCondition
+        self.wakeup = wakeup
+        # send actions as changes since the previous step (protocol v7)
+        self.deltaEncoding = deltaEncoding
+        self.port = self.ns3ZmqBridge.port
+        self.endpoint = self.ns3ZmqBridge.endpoint
+        # envId -> routing frames, spaces and step index of the last state
+        self.envs = {}
+
+    def _send_to(self, envId, msgType, msg):
+        env = self.envs[envId]
+        self.ns3ZmqBridge._send_multipart(env["peer"] + [ENVELOPE.pack(envId, msgType), msg])
+
+    def _handle_init(self, envId, peer, request):
+        simInitMsg = pb.SimInitMsg()
+        simInitMsg.ParseFromString(request)
+        # all environments of one simulation speak the same protocol
+        bridge = self.ns3ZmqBridge
+        bridge.protocolVersion = min(max(1, simInitMsg.protocolVersion), PROTOCOL_VERSION)
+        bridge.capabilities = negotiate_capabilities(self.CAPABILITIES, bridge.protocolVersion, simInitMsg.capabilities)
+        self.envs[envId] = {
+            "peer": peer,
+            "action_space": self.ns3ZmqBridge._create_space(simInitMsg.actSpace),
+            "observation_space": self.ns3ZmqBridge._create_space(simInitMsg.obsSpace),
+            "obs_layout": None,
+            "act_layout": None,
+            "obs_keys": None,
+            "act_keys": None,
+            "obs_delta": None,
+            "act_delta": None,
+            "stepIdx": 0,
+            "ended": False,
+        }
+
+        if bridge._uses(pb.CAP_PACKED_LAYOUT):
+            self.envs[envId]["obs_layout"] = SpaceLayout.compile(simInitMsg.obsSpace, bridge._uses(pb.CAP_QUANTIZATION), bridge.dequantize)
+            self.envs[envId]["act_layout"] = SpaceLayout.compile(simInitMsg.actSpace)
+        if bridge._uses(pb.CAP_DICT_KEY_IDS):
+            self.envs[envId]["obs_keys"] = _space_keys(simInitMsg.obsSpace)
+            self.envs[envId]["act_keys"] = _space_keys(simInitMsg.actSpace)
+        if bridge._uses(pb.CAP_DELTA_ENCODING):
+            self.envs[envId]["obs_delta"] = DeltaCache("obsData", "packedObs")
+            if self.deltaEncoding:
+                self.envs[envId]["act_delta"] = DeltaCache("actData", "packedAct")
+
+        reply = pb.SimInitAck()
+        reply.done = True
+        reply.stopSimReq = False
+        reply.protocolVersion = PROTOCOL_VERSION
+        reply.capabilities = self.CAPABILITIES
+        if self.wakeup is not None:
+            reply.wakeup.CopyFrom(self.wakeup.to_pb())
+        self._send_to(envId, pb.Init, reply.SerializeToString())
+
+    def get_env_ids(self):
+        return list(self.envs.keys())
+
+    def get_protocol(self):
+        """Negotiated protocol version and Capability names, shared by all environments"""
+        return self.ns3ZmqBridge.get_protocol()
+
+    def get_action_space(self, envId):
+        return self.envs[envId]["action_space"]
+
+    def get_observation_space(self, envId):
+        return self.envs[envId]["observation_space"]
+
+    def recv(self):
+        """Wait for the next state of any environment.
+
+        Returns (envId, obs, reward, done, info). Init handshakes of new
+        environments are answered on the way.
+        """
+        while True:
+            frames = self._recv_frames()
+            if frames is None:
+                continue
+            peer, envId, msgType, request, chunks = frames
+
+            if msgType == pb.Init:
+                self._handle_init(envId, peer, request)
+                continue
+            env = self.envs.get(envId)
+            if msgType != pb.Observation or env is None or env["ended"]:
+                print("Dropping unexpected message of type %d from env %d" % (msgType, envId))
+                continue
+
+            envStateMsg = pb.EnvStateMsg()
+            envStateMsg.ParseFromString(request)
+            if env["obs_delta"]:
+                env["obs_delta"].decode(envStateMsg)
+            env["peer"] = peer
+            env["stepIdx"] = envStateMsg.stepIdx
+
+            obs = self.ns3ZmqBridge._get_obs(envStateMsg, env["obs_layout"], chunks, env["obs_keys"])
+            reward = envStateMsg.reward
+            done = envStateMsg.isGameOver
+            info = envStateMsg.info if envStateMsg.info else {}
+
+            if done and envStateMsg.reason == pb.EnvStateMsg.SimulationEnd:
+                # the interface only drains replies at simulation end
+                env["ended"] = True
+                reply = pb.EnvActMsg()
+                reply.stepIdx = env["stepIdx"]
+                self._send_to(envId, pb.Action, reply.SerializeToString())
+
+            return envId, obs, reward, done, info
+
+    def _recv_frames(self):
+        frames = self.ns3ZmqBridge._recv_multipart()
+        # ROUTER prepends the identity of the DEALER, followed by the empty delimiter
+        start = 0
+        if not self.ns3ZmqBridge.shm:
+            start = next((i + 1 for i, frame in enumerate(frames) if not frame), len(frames))
+        peer = frames[:start]
+        if len(frames) < start + 2 or len(frames[start]) != ENVELOPE.size:
+            print("Dropping message without env id envelope")
+            return None
+        envId, msgType = ENVELOPE.unpack(frames[start])
+        # protocol v6: chunks of streamed Box data follow the message
+        return peer, envId, msgType, frames[start + 1], iter(frames[start + 2:])
+
+    def send(self, envId, action, stopSim=False, repeat=1, wakeup=None):
+        """Answer the last state of envId with action; stopSim ends the whole simulation"""
+        env = self.envs[envId]
+        if env["ended"]:
+            return
+
+        reply = pb.EnvActMsg()
+        reply.stepIdx = env["stepIdx"]
+        reply.stopSimReq = stopSim
+        reply.repeat = repeat
+        if wakeup is not None:
+            reply.wakeup.CopyFrom(wakeup.to_pb())
+        if action is not None:
+            self.ns3ZmqBridge._set_action(reply, action, env["action_space"], env["act_layout"], env["act_keys"])
+            if env["act_delta"]:
+                env["act_delta"].encode(reply)
+        self._send_to(envId, pb.Action, reply.SerializeToString())
+
+    def close(self):
+        bridge = self.ns3ZmqBridge
+        try:
+            if bridge.ns3Process:
+                bridge.ns3Process.kill()
+        except Exception as e:
+            pass
+        if bridge.shm:
+            bridge.shm.close()
+            bridge.shm = None
+        if bridge.socket:
+            bridge.socket.close(linger=0)
+            bridge.socket = None
@@ -0,0 +1,295 @@
+import os
+import mmap
+import time
+import ctypes
+import struct
+import platform
+
+
+__author__ = "Piotr Gawlowicz"
+__copyright__ = "Copyright (c) 2018, Technische Universität Berlin"
+__version__ = "0.1.0"
+__email__ = "gawlowicz@tkn.tu-berlin.de"
+
+
+# Segment layout, must match model/opengym_shm.h
+SHM_MAGIC = 0x4733534e
+SHM_VERSION = 1
+SHM_HEADER_SIZE = 64
+SHM_RING_CTRL_SIZE = 192
+SHM_DEFAULT_CAPACITY = 4 * 1024 * 1024
+SHM_ATTACH_TIMEOUT = 10.0
+
+SEGMENT_HEADER = struct.Struct("<IIQI")
+PID_OFF = 16
+ATTACHER_PID_OFF = 20
+
+HEAD_OFF = 0
+TAIL_OFF = 64
+DATA_SEQ_OFF = 128
+READER_WAITING_OFF = 132
+SPACE_SEQ_OFF = 136
+WRITER_WAITING_OFF = 140
+
+RECORD_HEADER = struct.Struct("<II")
+RECORD_MORE = 1
+
+FUTEX_WAIT = 0
+FUTEX_WAKE = 1
+SYS_FUTEX = {"x86_64": 202, "aarch64": 98, "armv7l": 240, "i686": 240}.get(platform.machine())
+
+_libc = None
+if SYS_FUTEX is not None:
+    try:
+        _libc = ctypes.CDLL(None, use_errno=True)
+        _libc.syscall.restype = ctypes.c_long
+    except OSError:
+        _libc = None
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+
+class _Ring(object):
+    """One single-producer/single-consumer byte ring inside the segment"""
+    def __init__(self, mm, offset, capacity):
+        self.capacity = capacity
+        self.mm = mm
+        self.dataOffset = offset + SHM_RING_CTRL_SIZE
+        self.head = ctypes.c_uint64.from_buffer(mm, offset + HEAD_OFF)
+        self.tail = ctypes.c_uint64.from_buffer(mm, offset + TAIL_OFF)
+        self.dataSeq = ctypes.c_uint32.from_buffer(mm, offset + DATA_SEQ_OFF)
+        self.readerWaiting = ctypes.c_uint32.from_buffer(mm, offset + READER_WAITING_OFF)
+        self.spaceSeq = ctypes.c_uint32.from_buffer(mm, offset + SPACE_SEQ_OFF)
+        self.writerWaiting = ctypes.c_uint32.from_buffer(mm, offset + WRITER_WAITING_OFF)
+
+    def release(self):
+        # drop exported buffer pointers, otherwise the mmap cannot be closed
+        del self.head, self.tail, self.dataSeq, self.readerWaiting, self.spaceSeq, self.writerWaiting
+
+
+def _futex_wait(word, expected, timeout=0.01):
+    if _libc is None:
+        time.sleep(timeout / 10)
+        return
+    ts = _Timespec(int(timeout), int((timeout % 1) * 1e9))
+    _libc.syscall(SYS_FUTEX, ctypes.byref(word), FUTEX_WAIT, ctypes.c_uint32(expected), ctypes.byref(ts), None, 0)
+
+
+def _futex_wake(word):
+    if _libc is None:
+        return
+    _libc.syscall(SYS_FUTEX, ctypes.byref(word), FUTEX_WAKE, 0x7fffffff, None, None, 0)
+
+
+def _wait_for_change(counter, stale, seq, waiting, peerPid, spin=2000):
+    """Wait until counter moves, raise ConnectionError once the peer process has exited"""
+    for _ in range(spin):
+        if counter.value != stale:
+            return
+    while True:
+        s = seq.value
+        waiting.value = 1
+        if counter.value != stale:
+            break
+        _futex_wait(seq, s)
+        if counter.value != stale:
+            break
+        # an exited peer never moves the counter
+        if peerPid.value != 0 and not _process_alive(peerPid.value):
+            waiting.value = 0
+            raise ConnectionError("Peer process %d of the shared memory segment has exited" % peerPid.value)
+    waiting.value = 0
+
+
+def _process_alive(pid):
+    if pid == 0:
+        return False
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
+
+
+def _unlink_if_same(path, fd):
+    # the peer may already have replaced a stale segment with a fresh one
+    try:
+        ours = os.fstat(fd)
+        current = os.stat(path)
+    except OSError:
+        return
+    if (ours.st_dev, ours.st_ino) == (current.st_dev, current.st_ino):
+        try:
+            os.unlink(path)
+        except OSError:
+            pass
+
+
+class Ns3ShmChannel(object):
+    """Agent side of the shared-memory channel of OpenGymInterface.
+
+    Ring 0 carries messages from the simulation, ring 1 messages to it.
+    """
+    def __init__(self, name, capacity=SHM_DEFAULT_CAPACITY, attachTimeout=SHM_ATTACH_TIMEOUT):
+        super(Ns3ShmChannel, self).__init__()
+        if not name.startswith("/"):
+            name = "/" + name
+        self.name = name
+        self.path = "/dev/shm" + name
+        self.owner = False
+        self.mm = None
+        # last received frame is followed by more frames of the same message
+        self.more = False
+
+        deadline = time.monotonic() + attachTimeout
+        while True:
+            # whoever comes first (simulation or agent) creates and formats the segment
+            try:
+                fd = os.open(self.path, os.O_RDWR | os.O_CREAT | os.O_EXCL, 0o600)
+            except FileExistsError:
+                pass
+            else:
+                self.owner = True
+                self.capacity = capacity
+                mapSize = SHM_HEADER_SIZE + 2 * (SHM_RING_CTRL_SIZE + capacity)
+                os.ftruncate(fd, mapSize)
+                self.mm = mmap.mmap(fd, mapSize)
+                ctypes.c_uint32.from_buffer(self.mm, PID_OFF).value = os.getpid()
+                struct.pack_into("<IQ", self.mm, 4, SHM_VERSION, capacity)
+                ctypes.c_uint32.from_buffer(self.mm, 0).value = SHM_MAGIC
+                break
+
+            try:
+                fd = os.open(self.path, os.O_RDWR)
+            except FileNotFoundError:
+                # the previous owner removed it in the meantime
+                continue
+            state, version, segmentCapacity, pid = self._wait_for_header(fd, deadline)
+            if state != "ready":
+                # an unusable segment would also block every later run
+                _unlink_if_same(self.path, fd)
+                os.close(fd)
+                if state == "stale":
+                    continue
+                raise TimeoutError("Shared memory segment %s was not formatted within %.1fs, removed it"
+                                   % (self.name, attachTimeout))
+            if version != SHM_VERSION:
+                os.close(fd)
+                raise RuntimeError("Unsupported shared memory segment version: %d" % version)
+            self.capacity = segmentCapacity
+            mapSize = SHM_HEADER_SIZE + 2 * (SHM_RING_CTRL_SIZE + segmentCapacity)
+            self.mm = mmap.mmap(fd, mapSize)
+            ctypes.c_uint32.from_buffer(self.mm, ATTACHER_PID_OFF).value = os.getpid()
+            break
+        os.close(fd)
+
+        # each side watches the pid of the other, the creator once that attaches
+        self.peerPid = ctypes.c_uint32.from_buffer(self.mm, ATTACHER_PID_OFF if self.owner else PID_OFF)
+
+        ring0 = SHM_HEADER_SIZE
+        ring1 = ring0 + SHM_RING_CTRL_SIZE + self.capacity
+        self.rxRing = _Ring(self.mm, ring0, self.capacity)
+        self.txRing = _Ring(self.mm, ring1, self.capacity)
+
+    @staticmethod
+    def _wait_for_header(fd, deadline):
+        """Wait until the creator has formatted the segment, a segment whose creator is gone is stale"""
+        while True:
+            if os.fstat(fd).st_size >= SHM_HEADER_SIZE:
+                header = mmap.mmap(fd, SHM_HEADER_SIZE, prot=mmap.PROT_READ)
+                magic, version, capacity, pid = SEGMENT_HEADER.unpack_from(header, 0)
+                header.close()
+                ready = magic == SHM_MAGIC
+                if (ready or pid != 0) and not _process_alive(pid):
+                    return "stale", version, capacity, pid
+                if ready:
+                    return "ready", version, capacity, pid
+            if time.monotonic() >= deadline:
+                return "timeout", 0, 0, 0
+            time.sleep(0.001)
+
+    def _write(self, ring, data):
+        view = memoryview(data)
+        size = len(view)
+        pos = 0
+        head = ring.head.value
+        while pos < size:
+            tail = ring.tail.value
+            space = self.capacity - (head - tail)
+            if space == 0:
+                _wait_for_change(ring.tail, tail, ring.spaceSeq, ring.writerWaiting, self.peerPid)
+                continue
+            offset = head % self.capacity
+            chunk = min(size - pos, space, self.capacity - offset)
+            start = ring.dataOffset + offset
+            self.mm[start:start + chunk] = view[pos:pos + chunk]
+            pos += chunk
+            head += chunk
+            ring.head.value = head
+            ring.dataSeq.value = (ring.dataSeq.value + 1) & 0xffffffff
+            if ring.readerWaiting.value:
+                _futex_wake(ring.dataSeq)
+
+    def _read(self, ring, size):
+        buf = bytearray(size)
+        pos = 0
+        tail = ring.tail.value
+        while pos < size:
+            head = ring.head.value
+            avail = head - tail
+            if avail == 0:
+                _wait_for_change(ring.head, head, ring.dataSeq, ring.readerWaiting, self.peerPid)
+                continue
+            offset = tail % self.capacity
+            chunk = min(size - pos, avail, self.capacity - offset)
+            start = ring.dataOffset + offset
+            buf[pos:pos + chunk] = self.mm[start:start + chunk]
+            pos += chunk
+            tail += chunk
+            ring.tail.value = tail
+            ring.spaceSeq.value = (ring.spaceSeq.value + 1) & 0xffffffff
+            if ring.writerWaiting.value:
+                _futex_wake(ring.spaceSeq)
+        return bytes(buf)
+
+    def send(self, data, more=False):
+        self._write(self.txRing, RECORD_HEADER.pack(len(data), RECORD_MORE if more else 0))
+        self._write(self.txRing, data)
+        # Python stores are not fenced, always kick a possibly sleeping reader
+        _futex_wake(self.txRing.dataSeq)
+
+    def recv(self):
+        size, flags = RECORD_HEADER.unpack(self._read(self.rxRing, RECORD_HEADER.size))
+        data = self._read(self.rxRing, size)
+        self.more = bool(flags & RECORD_MORE)
+        _futex_wake(self.rxRing.spaceSeq)
+        return data
+
+    def send_multipart(self, frames):
+        for i, frame in enumerate(frames):
+            self.send(frame, more=(i < len(frames) - 1))
+
+    def recv_multipart(self):
+        frames = [self.recv()]
+        while self.more:
+            frames.append(self.recv())
+        return frames
+
+    def close(self):
+        if self.mm is None:
+            return
+        self.rxRing.release()
+        self.txRing.release()
+        del self.peerPid
+        self.mm.close()
+        self.mm = None
+        # like the simulation side, only the creator removes the segment
+        if self.owner:
+            try:
+                os.unlink(self.path)
+            except OSError:
+                pass
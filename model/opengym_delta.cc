@@ -0,0 +1,256 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+
+#include <cstring>
+#include <google/protobuf/io/coded_stream.h>
+#include "ns3/log.h"
+#include "opengym_delta.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenGymDelta");
+
+namespace {
+
+// a few unchanged bytes inside a run are cheaper than starting a new one
+const size_t MAX_RUN_GAP = 4;
+
+} // anonymous namespace
+
+OpenGymDelta::OpenGymDelta ()
+  : m_nextBox (0)
+{
+}
+
+void
+OpenGymDelta::Encode (ns3opengym::EnvStateMsg &msg)
+{
+  NS_LOG_FUNCTION (this << msg.stepidx ());
+  m_nextBox = 0;
+  if (msg.has_obsdata ())
+    {
+      EncodeContainer (*msg.mutable_obsdata ());
+    }
+  if (!msg.packedobs ().empty ()
+      && !EncodeData (*msg.mutable_packedobs (), m_packed, *msg.mutable_packedobsdelta ()))
+    {
+      msg.clear_packedobsdelta ();
+    }
+}
+
+bool
+OpenGymDelta::Decode (ns3opengym::EnvActMsg &msg)
+{
+  NS_LOG_FUNCTION (this << msg.stepidx ());
+  m_nextBox = 0;
+  if (msg.has_actdata () && !DecodeContainer (*msg.mutable_actdata ()))
+    {
+      return false;
+    }
+  if (msg.has_packedactdelta ())
+    {
+      if (!DecodeData (*msg.mutable_packedact (), m_packed, msg.packedactdelta ()))
+        {
+          return false;
+        }
+      msg.clear_packedactdelta ();
+    }
+  else if (!msg.packedact ().empty ())
+    {
+      m_packed = msg.packedact ();
+    }
+  return true;
+}
+
+void
+OpenGymDelta::EncodeContainer (ns3opengym::DataContainer &msg)
+{
+  switch (msg.value_case ())
+    {
+    case ns3opengym::DataContainer::kBox:
+      {
+        ns3opengym::BoxDataContainer &box = *msg.mutable_box ();
+        // Boxes in repeated fields or streamed are not cached
+        if (!box.rawdata ().empty ()
+            && !EncodeData (*box.mutable_rawdata (), GetPrevious (m_nextBox++), *box.mutable_rawdelta ()))
+          {
+            box.clear_rawdelta ();
+          }
+        break;
+      }
+    case ns3opengym::DataContainer::kTuple:
+      for (ns3opengym::DataContainer &element : *msg.mutable_tuple ()->mutable_element ())
+        {
+          EncodeContainer (element);
+        }
+      break;
+    case ns3opengym::DataContainer::kDict:
+      for (ns3opengym::DataContainer &element : *msg.mutable_dict ()->mutable_element ())
+        {
+          EncodeContainer (element);
+        }
+      break;
+    default:
+      break;
+    }
+}
+
+bool
+OpenGymDelta::DecodeContainer (ns3opengym::DataContainer &msg)
+{
+  switch (msg.value_case ())
+    {
+    case ns3opengym::DataContainer::kBox:
+      {
+        ns3opengym::BoxDataContainer &box = *msg.mutable_box ();
+        if (box.has_rawdelta ())
+          {
+            if (!DecodeData (*box.mutable_rawdata (), GetPrevious (m_nextBox++), box.rawdelta ()))
+              {
+                return false;
+              }
+            box.clear_rawdelta ();
+          }
+        else if (!box.rawdata ().empty ())
+          {
+            GetPrevious (m_nextBox++) = box.rawdata ();
+          }
+        return true;
+      }
+    case ns3opengym::DataContainer::kTuple:
+      for (ns3opengym::DataContainer &element : *msg.mutable_tuple ()->mutable_element ())
+        {
+          if (!DecodeContainer (element))
+            {
+              return false;
+            }
+        }
+      return true;
+    case ns3opengym::DataContainer::kDict:
+      for (ns3opengym::DataContainer &element : *msg.mutable_dict ()->mutable_element ())
+        {
+          if (!DecodeContainer (element))
+            {
+              return false;
+            }
+        }
+      return true;
+    default:
+      return true;
+    }
+}
+
+std::string &
+OpenGymDelta::GetPrevious (uint32_t index)
+{
+  if (index >= m_boxes.size ())
+    {
+      m_boxes.resize (index + 1);
+    }
+  return m_boxes[index];
+}
+
+bool
+OpenGymDelta::EncodeData (std::string &data, std::string &previous, ns3opengym::DeltaRuns &runs)
+{
+  using google::protobuf::io::CodedOutputStream;
+  runs.Clear ();
+  if (data.size () != previous.size ())
+    {
+      previous = data;
+      return false;
+    }
+
+  const size_t size = data.size ();
+  std::string changed;
+  size_t encodedSize = 0;
+  size_t end = 0;
+  for (size_t i = 0; i < size;)
+    {
+      if (data[i] == previous[i])
+        {
+          ++i;
+          continue;
+        }
+      size_t runEnd = i + 1;
+      for (size_t j = runEnd; j < size && j - runEnd < MAX_RUN_GAP; ++j)
+        {
+          if (data[j] != previous[j])
+            {
+              runEnd = j + 1;
+            }
+        }
+      uint32_t skip = i - end;
+      uint32_t length = runEnd - i;
+      encodedSize += CodedOutputStream::VarintSize32 (skip) + CodedOutputStream::VarintSize32 (length) + length;
+      if (encodedSize >= size)
+        {
+          // changed too much, send the full data
+          runs.Clear ();
+          previous = data;
+          return false;
+        }
+      runs.add_run (skip);
+      runs.add_run (length);
+      changed.append (data, i, length);
+      end = runEnd;
+      i = runEnd;
+    }
+
+  previous.swap (data);
+  data.swap (changed);
+  return true;
+}
+
+bool
+OpenGymDelta::DecodeData (std::string &data, std::string &previous, const ns3opengym::DeltaRuns &runs)
+{
+  if (runs.run_size () % 2 != 0)
+    {
+      NS_LOG_ERROR ("Delta with an odd number of run fields");
+      return false;
+    }
+  size_t offset = 0;
+  size_t consumed = 0;
+  for (int i = 0; i < runs.run_size (); i += 2)
+    {
+      offset += runs.run (i);
+      size_t length = runs.run (i + 1);
+      if (offset + length > previous.size () || consumed + length > data.size ())
+        {
+          NS_LOG_ERROR ("Delta run beyond the " << previous.size () << " bytes of the previous data");
+          return false;
+        }
+      std::memcpy (&previous[offset], data.data () + consumed, length);
+      offset += length;
+      consumed += length;
+    }
+  if (consumed != data.size ())
+    {
+      NS_LOG_ERROR ("Delta carries " << data.size () << " bytes for runs of " << consumed << " bytes");
+      return false;
+    }
+  data = previous;
+  return true;
+}
+
+} // end of namespace ns3
@@ -0,0 +1,69 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+
+#ifndef OPENGYM_DELTA_H
+#define OPENGYM_DELTA_H
+
+#include <string>
+#include <vector>
+#include "messages.pb.h"
+
+namespace ns3 {
+
+/**
+ * Delta encoding of raw data between steps (protocol v7). Both sides keep
+ * the last raw data of every Box sent as rawData (depth-first order) and
+ * the last packed data. A sender replaces data by the runs of bytes that
+ * changed since then where that is smaller, the receiver patches its copy
+ * and restores the full data in the message. Every message has to pass
+ * through the same instance in order, also ones discarded afterwards.
+ * Must match DeltaCache in ns3gym/ns3env.py.
+ */
+class OpenGymDelta
+{
+public:
+  OpenGymDelta ();
+
+  void Encode (ns3opengym::EnvStateMsg &msg);
+  // false if a delta does not fit the data received before
+  bool Decode (ns3opengym::EnvActMsg &msg);
+
+private:
+  void EncodeContainer (ns3opengym::DataContainer &msg);
+  bool DecodeContainer (ns3opengym::DataContainer &msg);
+  std::string &GetPrevious (uint32_t index);
+
+  // replace data by its changes since previous (true) if that is smaller,
+  // previous becomes the full data either way
+  static bool EncodeData (std::string &data, std::string &previous, ns3opengym::DeltaRuns &runs);
+  // patch previous with the changes in data and copy it back to data
+  static bool DecodeData (std::string &data, std::string &previous, const ns3opengym::DeltaRuns &runs);
+
+  std::vector<std::string> m_boxes;
+  uint32_t m_nextBox;
+  std::string m_packed;
+};
+
+} // end of namespace ns3
+
+#endif /* OPENGYM_DELTA_H */
+
@@ -98,4 +98,34 @@ OpenGymEnv::NotifySimulationEnd()
   }
 }
 
-}
\ No newline at end of file
+void
+OpenGymEnv::PublishTelemetry(std::string name, Ptr<OpenGymDataContainer> data)
+{
+  NS_LOG_FUNCTION (this << name);
+  if (m_openGymInterface)
+  {
+    m_openGymInterface->PublishTelemetry(name, data);
+  }
+}
+
+void
+OpenGymEnv::PublishTelemetry(std::string name, double value)
+{
+  NS_LOG_FUNCTION (this << name << value);
+  if (m_openGymInterface)
+  {
+    m_openGymInterface->PublishTelemetry(name, value);
+  }
+}
+
+uint64_t
+OpenGymEnv::GetCapabilities()
+{
+  if (m_openGymInterface)
+  {
+    return m_openGymInterface->GetCapabilities();
+  }
+  return 0;
+}
+
+}
@@ -23,11 +23,11 @@
 #define OPENGYM_ENV_H
 
 #include "ns3/object.h"
+#include "container.h"
 
 namespace ns3 {
 
 class OpenGymSpace;
-class OpenGymDataContainer;
 class OpenGymInterface;
 
 class OpenGymEnv : public Object
@@ -51,6 +51,12 @@ public:
   void SetOpenGymInterface(Ptr<OpenGymInterface> openGymInterface);
   void Notify();
   void NotifySimulationEnd();
+  // non-blocking side channel for metrics, see OpenGymInterface::TelemetryEndpoint
+  void PublishTelemetry(std::string name, Ptr<OpenGymDataContainer> data);
+  void PublishTelemetry(std::string name, double value);
+  // ns3opengym::Capability bits agreed on with the agent, e.g. to build a
+  // sparse observation only if CAP_SPARSE_BOX is used; 0 before the first Notify
+  uint64_t GetCapabilities();
 
 
 protected:
@@ -58,8 +64,17 @@ protected:
   virtual void DoInitialize (void);
   virtual void DoDispose (void);
 
+  // container of type C from an earlier step that nobody holds any more
+  // (cleared), or a new one; avoids creating containers every step
+  template <typename C>
+  Ptr<C> CreatePooledContainer ()
+  {
+    return m_containerPool.Get<C> ();
+  }
+
   Ptr<OpenGymInterface> m_openGymInterface;
 private:
+  OpenGymContainerPool m_containerPool;
 
 };
 
@@ -21,12 +21,25 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <google/protobuf/arena.h>
 #include "ns3/log.h"
 #include "ns3/config.h"
 #include "ns3/simulator.h"
+#include "ns3/string.h"
+#include "ns3/boolean.h"
+#include "ns3/uinteger.h"
+#include "ns3/enum.h"
+#include "ns3/trace-source-accessor.h"
 #include "opengym_interface.h"
 #include "opengym_env.h"
+#include "opengym_transport.h"
 #include "container.h"
+#include "opengym_layout.h"
+#include "opengym_delta.h"
 #include "spaces.h"
 #include "messages.pb.h"
 
@@ -36,6 +49,82 @@ NS_LOG_COMPONENT_DEFINE ("OpenGymInterface");
 
 NS_OBJECT_ENSURE_REGISTERED (OpenGymInterface);
 
+// 1: payloads packed into google.protobuf.Any, 2: typed oneof payloads,
+// 3: Box data as raw bytes, 4: 8/16/64 bit, bool and float16 dtypes,
+// 5: packed observations and actions in compiled space layouts,
+// 6: large Box observations streamed in chunk frames,
+// 7: raw data delta-encoded between steps,
+// 8: sparse Boxes in coordinate format,
+// 9: quantized Boxes in packed observations,
+// 10: features negotiated as Capability bits
+static const uint32_t OPENGYM_PROTOCOL_VERSION = 10;
+
+// Capability bits of peers that only announce a protocolVersion (before v10).
+// v1 also covers agents that predate batched states, so those are only
+// assumed from v5 on.
+static uint64_t
+CapabilitiesOfVersion (uint32_t version)
+{
+  static const uint64_t added[] = {
+    0, 0, ns3opengym::CAP_TYPED_PAYLOAD, ns3opengym::CAP_RAW_BOX, ns3opengym::CAP_FULL_DTYPES,
+    ns3opengym::CAP_PACKED_LAYOUT | ns3opengym::CAP_STATE_BATCH, ns3opengym::CAP_CHUNK_STREAMING,
+    ns3opengym::CAP_DELTA_ENCODING, ns3opengym::CAP_SPARSE_BOX, ns3opengym::CAP_QUANTIZATION
+  };
+  uint64_t capabilities = 0;
+  for (uint32_t v = 2; v <= version && v < sizeof (added) / sizeof (added[0]); ++v) {
+    capabilities |= added[v];
+  }
+  return capabilities;
+}
+
+static const uint64_t OPENGYM_CAPABILITIES = CapabilitiesOfVersion(9) | ns3opengym::CAP_DICT_KEY_IDS;
+
+// drop features whose prerequisites are missing, the agent applies the same rules
+static uint64_t
+ResolveCapabilities (uint64_t capabilities)
+{
+  if (!(capabilities & ns3opengym::CAP_TYPED_PAYLOAD)) {
+    capabilities &= ~uint64_t(ns3opengym::CAP_DELTA_ENCODING | ns3opengym::CAP_SPARSE_BOX);
+  }
+  if (!(capabilities & ns3opengym::CAP_RAW_BOX)) {
+    capabilities &= ~uint64_t(ns3opengym::CAP_FULL_DTYPES | ns3opengym::CAP_CHUNK_STREAMING);
+  }
+  if (!(capabilities & ns3opengym::CAP_PACKED_LAYOUT)) {
+    capabilities &= ~uint64_t(ns3opengym::CAP_QUANTIZATION);
+  }
+  return capabilities;
+}
+
+// message type in the envelope of multiplexed interfaces, lets the agent
+// tell init handshakes from states
+static ns3opengym::MsgType
+MsgTypeOf (const google::protobuf::Message &msg)
+{
+  const google::protobuf::Descriptor *descriptor = msg.GetDescriptor();
+  if (descriptor == ns3opengym::SimInitMsg::descriptor()) {
+    return ns3opengym::Init;
+  }
+  if (descriptor == ns3opengym::EnvStateMsg::descriptor() || descriptor == ns3opengym::EnvStateBatchMsg::descriptor()) {
+    return ns3opengym::Observation;
+  }
+  return ns3opengym::Unknown;
+}
+
+struct OpenGymInterface::SendBuffer
+{
+  enum State
+  {
+    FREE,
+    IN_USE,
+    // still queued in the transport after the interface was destroyed,
+    // deleted on release
+    ORPHANED
+  };
+
+  std::vector<uint8_t> data;
+  // released by the transport, possibly from the ZMQ I/O thread
+  std::atomic<int> state {FREE};
+};
 
 TypeId
 OpenGymInterface::GetTypeId (void)
@@ -44,6 +133,91 @@ OpenGymInterface::GetTypeId (void)
     .SetParent<Object> ()
     .SetGroupName ("OpenGym")
     .AddConstructor<OpenGymInterface> ()
+    .AddAttribute ("Endpoint",
+                   "Endpoint of the agent: tcp://host:port, ipc://path, inproc://name "
+                   "or shm://segment. Empty means tcp://localhost:<port>",
+                   StringValue (""),
+                   MakeStringAccessor (&OpenGymInterface::m_endpoint),
+                   MakeStringChecker ())
+    .AddAttribute ("Pipelined",
+                   "Do not wait for the action of the current step: keep simulating "
+                   "with the last action and apply new ones as they arrive",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&OpenGymInterface::m_pipelined),
+                   MakeBooleanChecker ())
+    .AddAttribute ("MaxActionLag",
+                   "Maximum number of steps an action may lag behind in pipelined mode",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&OpenGymInterface::m_maxActionLag),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("ChunkSize",
+                   "Box observations with more raw bytes than this are streamed in chunk frames of this size after the state message; 0 disables, ignored with BatchSize > 1",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&OpenGymInterface::m_chunkSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("DeltaEncoding",
+                   "Send raw Box and packed observation data as the bytes changed since the previous step where that is smaller",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&OpenGymInterface::m_deltaEncoding),
+                   MakeBooleanChecker ())
+    .AddAttribute ("TelemetryEndpoint",
+                   "Endpoint the telemetry PUB socket binds to, e.g. tcp://*:5560; empty disables",
+                   StringValue (""),
+                   MakeStringAccessor (&OpenGymInterface::m_telemetryEndpoint),
+                   MakeStringChecker ())
+    .AddAttribute ("TelemetryHighWaterMark",
+                   "Telemetry messages queued per subscriber before further ones are dropped",
+                   UintegerValue (1000),
+                   MakeUintegerAccessor (&OpenGymInterface::m_telemetryHwm),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("ReplyTimeout",
+                   "Wall-clock time to wait for the agent's reply before applying "
+                   "the FallbackPolicy, 0 waits forever",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&OpenGymInterface::m_replyTimeout),
+                   MakeTimeChecker ())
+    .AddAttribute ("FallbackPolicy",
+                   "Action applied when the agent misses the ReplyTimeout",
+                   EnumValue (OpenGymInterface::FALLBACK_REPEAT_LAST),
+                   MakeEnumAccessor (&OpenGymInterface::m_fallbackPolicy),
+                   MakeEnumChecker (OpenGymInterface::FALLBACK_REPEAT_LAST, "RepeatLast",
+                                    OpenGymInterface::FALLBACK_DEFAULT_ACTION, "DefaultAction",
+                                    OpenGymInterface::FALLBACK_SKIP, "Skip"))
+    .AddTraceSource ("LateReplies",
+                     "Number of agent replies discarded because they missed their deadline",
+                     MakeTraceSourceAccessor (&OpenGymInterface::m_lateReplies),
+                     "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("Negotiated",
+                     "Protocol version and Capability bits agreed on in the init handshake",
+                     MakeTraceSourceAccessor (&OpenGymInterface::m_negotiatedTrace),
+                     "ns3::OpenGymInterface::NegotiatedCallback")
+    .AddAttribute ("DisabledCapabilities",
+                   "Capability bits (see messages.proto) not to announce, e.g. to compare wire modes",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&OpenGymInterface::m_disabledCapabilities),
+                   MakeUintegerChecker<uint64_t> ())
+    .AddAttribute ("BatchSize",
+                   "Number of states sent together in one EnvStateBatchMsg; "
+                   "the agent answers with one action per state",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&OpenGymInterface::m_batchSize),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("BatchWindow",
+                   "Send an incomplete batch once its first state is this old, 0 disables",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&OpenGymInterface::m_batchWindow),
+                   MakeTimeChecker ())
+    .AddAttribute ("Multiplexed",
+                   "Share one connection with all other multiplexed interfaces using "
+                   "the same endpoint, messages are tagged with EnvId",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&OpenGymInterface::m_multiplexed),
+                   MakeBooleanChecker ())
+    .AddAttribute ("EnvId",
+                   "Id of this environment on a multiplexed connection",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&OpenGymInterface::m_envId),
+                   MakeUintegerChecker<uint32_t> ())
     ;
   return tid;
 }
@@ -78,21 +252,75 @@ OpenGymInterface::Delete (void)
 }
 
 OpenGymInterface::OpenGymInterface(uint32_t port):
-  m_port(port), m_zmq_context(1), m_zmq_socket(m_zmq_context, ZMQ_REQ),
-  m_simEnd(false), m_stopEnvRequested(false), m_initSimMsgSent(false)
+  m_port(port),
+  m_wireFormat(new OpenGymWireFormat()),
+  m_chunkSize(0),
+  m_deltaEncoding(false),
+  m_disabledCapabilities(0),
+  m_protocolVersion(0),
+  m_capabilities(0),
+  m_pipelined(false),
+  m_maxActionLag(1),
+  m_stepIdx(0),
+  m_pendingActions(0),
+  m_multiplexed(false),
+  m_envId(0),
+  m_telemetryHwm(1000),
+  m_fallbackPolicy(FALLBACK_REPEAT_LAST),
+  m_staleBefore(0),
+  m_abandonedReplies(0),
+  m_lateReplies(0),
+  m_repeatSteps(0),
+  m_skippedReward(0),
+  m_actionPool(new OpenGymContainerPool()),
+  m_wakeup(new ns3opengym::WakeupCondition()),
+  m_batchSize(1),
+  m_stateBatch(0),
+  m_simEnd(false),
+  m_stopEnvRequested(false),
+  m_initSimMsgSent(false)
 {
   NS_LOG_FUNCTION (this);
+  ResetArena();
 }
 
 OpenGymInterface::~OpenGymInterface ()
 {
   NS_LOG_FUNCTION (this);
+  for (SendBuffer *buffer : m_sendBuffers) {
+    // a buffer still queued in the transport is deleted by ReleaseSendBuffer
+    int state = SendBuffer::IN_USE;
+    if (!buffer->state.compare_exchange_strong(state, SendBuffer::ORPHANED, std::memory_order_acq_rel)) {
+      delete buffer;
+    }
+  }
 }
 
 void
 OpenGymInterface::DoDispose (void)
 {
   NS_LOG_FUNCTION (this);
+  m_repeatAction = 0;
+  m_defaultAction = 0;
+  m_lastAction = 0;
+  m_actionSpace = 0;
+  m_actionPool.reset();
+  if (m_telemetry)
+  {
+    m_telemetry->Dispose();
+    m_telemetry = 0;
+  }
+  if (m_transport)
+  {
+    // a multiplexed connection is owned by all interfaces sharing it
+    if (m_multiplexed) {
+      OpenGymTransport::ReleaseShared(m_transport);
+    } else {
+      m_transport->Dispose();
+    }
+    m_transport = 0;
+  }
+  m_batchFlushEvent.Cancel();
 }
 
 void
@@ -160,19 +388,38 @@ OpenGymInterface::Init()
   }
   m_initSimMsgSent = true;
 
-  std::string connectAddr = "tcp://localhost:" + std::to_string(m_port);
-  zmq_connect ((void*)m_zmq_socket, connectAddr.c_str());
+  std::string connectAddr = m_endpoint;
+  if (connectAddr.empty()) {
+    connectAddr = "tcp://localhost:" + std::to_string(m_port);
+  }
+  if (m_multiplexed) {
+    m_transport = OpenGymTransport::GetShared(connectAddr);
+  } else {
+    m_transport = OpenGymTransport::Create(connectAddr);
+    if (m_transport && !m_transport->Connect(connectAddr)) {
+      m_transport = 0;
+    }
+  }
+  if (!m_transport) {
+    NS_FATAL_ERROR("Cannot connect OpenGym interface to: " << connectAddr);
+  }
 
   Ptr<OpenGymSpace> obsSpace = GetObservationSpace();
   Ptr<OpenGymSpace> actionSpace = GetActionSpace();
 
   NS_LOG_UNCOND("Simulation process id: " << ::getpid() << " (parent (waf shell) id: " << ::getppid() << ")");
-  NS_LOG_UNCOND("Waiting for Python process to connect on port: "<< connectAddr);
+  NS_LOG_UNCOND("Waiting for Python process to connect on endpoint: "<< connectAddr);
+  if (m_multiplexed) {
+    NS_LOG_UNCOND("Multiplexed env id: " << m_envId);
+  }
   NS_LOG_UNCOND("Please start proper Python Gym Agent");
 
   ns3opengym::SimInitMsg simInitMsg;
   simInitMsg.set_simprocessid(::getpid());
   simInitMsg.set_wafshellprocessid(::getppid());
+  simInitMsg.set_batchsize(m_batchSize);
+  simInitMsg.set_protocolversion(OPENGYM_PROTOCOL_VERSION);
+  simInitMsg.set_capabilities(OPENGYM_CAPABILITIES & ~m_disabledCapabilities);
 
   if (obsSpace) {
     ns3opengym::SpaceDescription spaceDesc;
@@ -187,19 +434,62 @@ OpenGymInterface::Init()
   }
 
   // send init msg to python
-  zmq::message_t request(simInitMsg.ByteSizeLong());;
-  simInitMsg.SerializeToArray(request.data(), simInitMsg.ByteSizeLong());
-  m_zmq_socket.send (request, zmq::send_flags::none);
+  SendMsg(simInitMsg);
 
   // receive init ack msg form python
   ns3opengym::SimInitAck simInitAck;
-  zmq::message_t reply;
-  (void) m_zmq_socket.recv (reply, zmq::recv_flags::none);
-  simInitAck.ParseFromArray(reply.data(), reply.size());
+  ReceiveMsg(simInitAck);
 
   bool done = simInitAck.done();
   NS_LOG_DEBUG("Sim Init Ack: " << done);
 
+  // agents without a protocolVersion speak v1
+  m_protocolVersion = std::max(1u, std::min(simInitAck.protocolversion(), OPENGYM_PROTOCOL_VERSION));
+  uint64_t agentCapabilities = m_protocolVersion >= 10 ? simInitAck.capabilities() : CapabilitiesOfVersion(m_protocolVersion);
+  m_capabilities = ResolveCapabilities(simInitMsg.capabilities() & agentCapabilities);
+
+  m_wireFormat->typed = HasCapabilities(ns3opengym::CAP_TYPED_PAYLOAD);
+  m_wireFormat->rawBox = HasCapabilities(ns3opengym::CAP_RAW_BOX);
+  m_wireFormat->fullDtypes = HasCapabilities(ns3opengym::CAP_FULL_DTYPES);
+  m_wireFormat->chunkSize = HasCapabilities(ns3opengym::CAP_CHUNK_STREAMING) ? m_chunkSize : 0;
+  m_wireFormat->sparseBox = HasCapabilities(ns3opengym::CAP_SPARSE_BOX);
+  m_wireFormat->dictKeyIds = HasCapabilities(ns3opengym::CAP_DICT_KEY_IDS);
+  // Dict key ids of actions refer to the action space described above
+  m_actionSpace = actionSpace;
+  if (!HasCapabilities(ns3opengym::CAP_STATE_BATCH)) {
+    m_batchSize = 1;
+  }
+  if (HasCapabilities(ns3opengym::CAP_PACKED_LAYOUT)) {
+    m_obsLayout.reset(new OpenGymLayout());
+    if (!m_obsLayout->Compile(simInitMsg.obsspace(), HasCapabilities(ns3opengym::CAP_QUANTIZATION))) {
+      m_obsLayout.reset();
+    }
+    m_actLayout.reset(new OpenGymLayout());
+    if (!m_actLayout->Compile(simInitMsg.actspace())) {
+      m_actLayout.reset();
+    }
+  }
+  if (HasCapabilities(ns3opengym::CAP_DELTA_ENCODING)) {
+    // the agent decides on its own whether to send action deltas
+    m_actDelta.reset(new OpenGymDelta());
+    if (m_deltaEncoding) {
+      m_obsDelta.reset(new OpenGymDelta());
+    }
+  }
+
+  std::string names;
+  for (uint64_t bit = 1; bit <= m_capabilities; bit <<= 1) {
+    if (m_capabilities & bit) {
+      names += " " + ns3opengym::Capability_Name(static_cast<ns3opengym::Capability>(bit));
+    }
+  }
+  NS_LOG_UNCOND("Negotiated protocol version " << m_protocolVersion << ", capabilities:" << (names.empty() ? " none" : names));
+  m_negotiatedTrace(m_protocolVersion, m_capabilities);
+
+  if (simInitAck.has_wakeup()) {
+    SetWakeupCondition(simInitAck.wakeup());
+  }
+
   bool stopSim = simInitAck.stopsimreq();
   if (stopSim) {
     NS_LOG_DEBUG("---Stop requested: " << stopSim);
@@ -223,52 +513,344 @@ OpenGymInterface::NotifyCurrentState()
     return;
   }
 
-  // collect current env state
-  Ptr<OpenGymDataContainer> obsDataContainer = GetObservation();
+  // collect current env state, repeated steps need only reward and game over
   float reward = GetReward();
   bool isGameOver = IsGameOver();
+
+  // action repeat: reapply the action and skip the exchange, rewards are summed
+  if (m_repeatSteps > 0 && !isGameOver) {
+    m_repeatSteps--;
+    m_skippedReward += reward;
+    ExecuteActions(m_repeatAction);
+    return;
+  }
+  m_repeatSteps = 0;
+  m_repeatAction = 0;
+
+  // wake-up predicates: keep the last action while nothing interesting happens
+  Ptr<OpenGymDataContainer> obsDataContainer = GetObservation();
+  if (!isGameOver && !IsWakeupDue(obsDataContainer)) {
+    m_skippedReward += reward;
+    return;
+  }
+  ResetWakeup(obsDataContainer);
   std::string extraInfo = GetExtraInfo();
+  reward += m_skippedReward;
+  m_skippedReward = 0;
 
-  ns3opengym::EnvStateMsg envStateMsg;
+  // batched states are built in place in the batch
+  ns3opengym::EnvStateMsg *envStateMsg = m_batchSize > 1 ? m_stateBatch->add_state()
+                                         : google::protobuf::Arena::CreateMessage<ns3opengym::EnvStateMsg>(m_arena.get());
   // observation
-  ns3opengym::DataContainer obsDataContainerPbMsg;
   if (obsDataContainer) {
-    obsDataContainerPbMsg = obsDataContainer->GetDataContainerPbMsg();
-    envStateMsg.mutable_obsdata()->CopyFrom(obsDataContainerPbMsg);
+    OpenGymWireFormat format = *m_wireFormat;
+    if (m_batchSize == 1) {
+      // a batch would have to keep the observations unchanged until it is sent
+      format.streamed = &m_streamed;
+    }
+    // observations larger than a chunk are streamed instead of packed,
+    // containers not matching the space layout fall back to obsData
+    bool stream = format.streamed && format.chunkSize > 0 && m_obsLayout && m_obsLayout->GetSize() > format.chunkSize;
+    if (!m_obsLayout || stream || !m_obsLayout->Pack(obsDataContainer, *envStateMsg->mutable_packedobs())) {
+      obsDataContainer->FillDataContainerPbMsg(*envStateMsg->mutable_obsdata(), format);
+    }
+    if (m_obsDelta) {
+      m_obsDelta->Encode(*envStateMsg);
+    }
   }
   // reward
-  envStateMsg.set_reward(reward);
+  envStateMsg->set_reward(reward);
   // game over
-  envStateMsg.set_isgameover(false);
+  envStateMsg->set_isgameover(false);
   if (isGameOver)
   {
-    envStateMsg.set_isgameover(true);
+    envStateMsg->set_isgameover(true);
     if (m_simEnd) {
-      envStateMsg.set_reason(ns3opengym::EnvStateMsg::SimulationEnd);
+      envStateMsg->set_reason(ns3opengym::EnvStateMsg::SimulationEnd);
     } else {
-      envStateMsg.set_reason(ns3opengym::EnvStateMsg::GameOver);
+      envStateMsg->set_reason(ns3opengym::EnvStateMsg::GameOver);
     }
   }
 
   // extra info
-  envStateMsg.set_info(extraInfo);
+  envStateMsg->set_info(extraInfo);
+
+  envStateMsg->set_stepidx(m_stepIdx++);
+
+  if (m_batchSize > 1) {
+    // keep simulating with the last actions until the batch is full
+    if (m_stateBatch->state_size() == 1 && !m_batchWindow.IsZero()) {
+      m_batchFlushEvent = Simulator::Schedule(m_batchWindow, &OpenGymInterface::FlushStateBatch, this);
+    }
+    if (m_stateBatch->state_size() >= static_cast<int>(m_batchSize) || isGameOver) {
+      FlushStateBatch();
+    }
+    return;
+  }
 
   // send env state msg to python
-  zmq::message_t request(envStateMsg.ByteSizeLong());;
-  envStateMsg.SerializeToArray(request.data(), envStateMsg.ByteSizeLong());
-  m_zmq_socket.send (request, zmq::send_flags::none);
+  SendMsg(*envStateMsg, !m_streamed.empty());
+  SendStreamedData();
+  m_pendingActions++;
+  WaitForActions();
+  ResetArena();
+}
 
-  // receive act msg form python
-  ns3opengym::EnvActMsg envActMsg;
-  zmq::message_t reply;
-  (void) m_zmq_socket.recv (reply, zmq::recv_flags::none);
-  envActMsg.ParseFromArray(reply.data(), reply.size());
+void
+OpenGymInterface::FlushStateBatch()
+{
+  NS_LOG_FUNCTION (this);
+  m_batchFlushEvent.Cancel();
+  if (m_stateBatch->state_size() == 0) {
+    return;
+  }
 
+  NS_LOG_DEBUG("Send batch of " << m_stateBatch->state_size() << " states");
+  SendMsg(*m_stateBatch);
+  m_pendingActions++;
+  WaitForActions();
+  // drops the sent states and recreates an empty m_stateBatch
+  ResetArena();
+}
+
+void
+OpenGymInterface::ResetArena()
+{
+  uint64_t used = m_arena ? m_arena->Reset() : 0;
+  if (!m_arena || used > m_arenaBlock.size()) {
+    // grow the first block until a whole step fits in it, so that
+    // steady-state steps allocate their messages without malloc
+    size_t size = std::max<size_t>(m_arenaBlock.size(), 4096);
+    while (size < used) {
+      size *= 2;
+    }
+    m_arena.reset();
+    m_arenaBlock.resize(size);
+    google::protobuf::ArenaOptions options;
+    options.initial_block = m_arenaBlock.data();
+    options.initial_block_size = m_arenaBlock.size();
+    m_arena.reset(new google::protobuf::Arena(options));
+  }
+  m_stateBatch = google::protobuf::Arena::CreateMessage<ns3opengym::EnvStateBatchMsg>(m_arena.get());
+}
+
+void
+OpenGymInterface::WaitForActions()
+{
+  NS_LOG_FUNCTION (this);
   if (m_simEnd) {
-    // if sim end only rx ms and quit
+    // if sim end only rx msgs and quit, including replies that missed their deadline
+    m_pendingActions += m_abandonedReplies;
+    m_abandonedReplies = 0;
+    while (m_pendingActions > 0) {
+      if (m_batchSize > 1) {
+        ns3opengym::EnvActBatchMsg envActBatchMsg;
+        ReceiveMsg(envActBatchMsg);
+      } else {
+        ns3opengym::EnvActMsg envActMsg;
+        ReceiveMsg(envActMsg);
+      }
+      m_pendingActions--;
+    }
+    return;
+  }
+
+  // in pipelined mode keep simulating with the last action until lag exceeds the limit
+  ReceiveActions(m_pipelined ? m_maxActionLag : 0);
+}
+
+void
+OpenGymInterface::ReceiveActions(uint32_t maxPending)
+{
+  NS_LOG_FUNCTION (this << maxPending);
+  // one deadline per step, replies discarded as stale do not extend it
+  bool bounded = m_replyTimeout.IsStrictlyPositive();
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+    + std::chrono::nanoseconds(m_replyTimeout.GetNanoSeconds());
+  while (m_pendingActions > 0)
+  {
+    // block only while too many actions are outstanding, otherwise just poll
+    bool blocking = m_pendingActions > maxPending;
+    int timeoutMs = 0;
+    if (blocking && bounded) {
+      // rounded up so that sub-millisecond timeouts still wait
+      int64_t leftNs = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+      timeoutMs = std::max<int64_t>(1, (leftNs + 999999) / 1000000);
+    } else if (blocking) {
+      timeoutMs = -1;
+    }
+
+    bool received;
+    bool stale;
+    if (m_batchSize > 1) {
+      // receive one action per state of the batch, applied in order
+      ns3opengym::EnvActBatchMsg *envActBatchMsg = google::protobuf::Arena::CreateMessage<ns3opengym::EnvActBatchMsg>(m_arena.get());
+      received = ReceiveMsg(*envActBatchMsg, timeoutMs);
+      if (received) {
+        for (ns3opengym::EnvActMsg &envActMsg : *envActBatchMsg->mutable_act()) {
+          DecodeDelta(envActMsg);
+        }
+      }
+      stale = received && envActBatchMsg->act_size() > 0 && IsStale(envActBatchMsg->act(0));
+      if (received && !stale) {
+        m_pendingActions--;
+        for (const ns3opengym::EnvActMsg &envActMsg : envActBatchMsg->act()) {
+          HandleActMsg(envActMsg);
+        }
+      }
+    } else {
+      // receive act msg form python
+      ns3opengym::EnvActMsg *envActMsg = google::protobuf::Arena::CreateMessage<ns3opengym::EnvActMsg>(m_arena.get());
+      received = ReceiveMsg(*envActMsg, timeoutMs);
+      if (received) {
+        DecodeDelta(*envActMsg);
+      }
+      stale = received && IsStale(*envActMsg);
+      if (received && !stale) {
+        m_pendingActions--;
+        HandleActMsg(*envActMsg);
+      }
+    }
+
+    if (!received) {
+      if (blocking && bounded) {
+        // deadline missed: give up on all outstanding replies
+        NS_LOG_DEBUG("No reply within " << m_replyTimeout.GetMicroSeconds() << " us");
+        m_staleBefore = m_stepIdx;
+        m_abandonedReplies += m_pendingActions;
+        m_pendingActions = 0;
+        ApplyFallback();
+      }
+      break;
+    }
+  }
+}
+
+void
+OpenGymInterface::DecodeDelta(ns3opengym::EnvActMsg &envActMsg)
+{
+  // also late replies, the agent encoded the next ones against them
+  if (m_actDelta && !m_actDelta->Decode(envActMsg)) {
+    NS_LOG_ERROR("Cannot decode the action delta of step " << envActMsg.stepidx());
+    envActMsg.clear_actdata();
+    envActMsg.clear_packedact();
+  }
+}
+
+bool
+OpenGymInterface::IsStale(const ns3opengym::EnvActMsg &envActMsg)
+{
+  if (envActMsg.stepidx() >= m_staleBefore || m_abandonedReplies == 0 || envActMsg.stopsimreq()) {
+    return false;
+  }
+  NS_LOG_DEBUG("Discard late reply for step " << envActMsg.stepidx());
+  m_abandonedReplies--;
+  ++m_lateReplies;
+  return true;
+}
+
+void
+OpenGymInterface::ApplyFallback()
+{
+  NS_LOG_FUNCTION (this << m_fallbackPolicy);
+  switch (m_fallbackPolicy) {
+    case FALLBACK_REPEAT_LAST:
+      if (m_lastAction) {
+        ExecuteActions(m_lastAction);
+      }
+      break;
+    case FALLBACK_DEFAULT_ACTION:
+      if (m_defaultAction) {
+        ExecuteActions(m_defaultAction);
+      }
+      break;
+    case FALLBACK_SKIP:
+    default:
+      break;
+  }
+}
+
+void
+OpenGymInterface::PublishTelemetry(std::string name, Ptr<OpenGymDataContainer> data)
+{
+  NS_LOG_FUNCTION (this << name);
+  if (m_telemetryEndpoint.empty()) {
     return;
   }
+  if (!m_telemetry) {
+    m_telemetry = CreateObject<OpenGymZmqPublisher>();
+    if (!m_telemetry->Bind(m_telemetryEndpoint, m_telemetryHwm)) {
+      NS_LOG_WARN("Telemetry disabled, cannot bind to: " << m_telemetryEndpoint);
+      m_telemetryEndpoint.clear();
+      m_telemetry = 0;
+      return;
+    }
+  }
 
+  ns3opengym::TelemetryMsg telemetryMsg;
+  telemetryMsg.set_name(name);
+  telemetryMsg.set_simtime(Simulator::Now().GetSeconds());
+  telemetryMsg.set_envid(m_envId);
+  if (data) {
+    // subscribers do not know the spaces, Dicts keep their key names
+    OpenGymWireFormat format = *m_wireFormat;
+    format.dictKeyIds = false;
+    data->FillDataContainerPbMsg(*telemetryMsg.mutable_data(), format);
+  }
+
+  size_t size = telemetryMsg.ByteSizeLong();
+  zmq::message_t msg(size);
+  telemetryMsg.SerializeWithCachedSizesToArray(static_cast<uint8_t *>(msg.data()));
+  m_telemetry->Publish(name, msg);
+}
+
+void
+OpenGymInterface::PublishTelemetry(std::string name, double value)
+{
+  NS_LOG_FUNCTION (this << name << value);
+  if (m_telemetryEndpoint.empty()) {
+    return;
+  }
+  Ptr<OpenGymBoxContainer<double> > box = CreateObject<OpenGymBoxContainer<double> >(std::vector<uint32_t>{1});
+  box->AddValue(value);
+  PublishTelemetry(name, box);
+}
+
+void
+OpenGymInterface::SetDefaultAction(Ptr<OpenGymDataContainer> action)
+{
+  NS_LOG_FUNCTION (this);
+  m_defaultAction = action;
+}
+
+uint32_t
+OpenGymInterface::GetLateReplies() const
+{
+  return m_lateReplies;
+}
+
+uint32_t
+OpenGymInterface::GetProtocolVersion() const
+{
+  return m_protocolVersion;
+}
+
+uint64_t
+OpenGymInterface::GetCapabilities() const
+{
+  return m_capabilities;
+}
+
+bool
+OpenGymInterface::HasCapabilities(uint64_t capabilities) const
+{
+  return (m_capabilities & capabilities) == capabilities;
+}
+
+void
+OpenGymInterface::HandleActMsg(const ns3opengym::EnvActMsg &envActMsg)
+{
+  NS_LOG_FUNCTION (this);
   bool stopSim = envActMsg.stopsimreq();
   if (stopSim) {
     NS_LOG_DEBUG("---Stop requested: " << stopSim);
@@ -278,11 +860,185 @@ OpenGymInterface::NotifyCurrentState()
     std::exit(0);
   }
 
-  // first step after reset is called without actions, just to get current state
-  ns3opengym::DataContainer actDataContainerPbMsg = envActMsg.actdata();
-  Ptr<OpenGymDataContainer> actDataContainer = OpenGymDataContainer::CreateFromDataContainerPbMsg(actDataContainerPbMsg);
+  NS_LOG_DEBUG("Action of step " << envActMsg.stepidx() << " applied at step " << m_stepIdx - 1);
+
+  // first step after reset is called without actions, just to get current state;
+  // actions are decoded into the containers of earlier ones nobody holds any more
+  Ptr<OpenGymDataContainer> actDataContainer;
+  if (m_actLayout && !envActMsg.packedact().empty()) {
+    actDataContainer = m_actLayout->Unpack(envActMsg.packedact(), m_actionPool.get());
+  } else {
+    actDataContainer = OpenGymDataContainer::CreateFromDataContainerPbMsg(envActMsg.actdata(), m_actionPool.get(), m_actionSpace);
+  }
   ExecuteActions(actDataContainer);
+  if (actDataContainer) {
+    m_lastAction = actDataContainer;
+  }
+
+  if (envActMsg.repeat() > 1) {
+    m_repeatSteps = envActMsg.repeat() - 1;
+    m_repeatAction = actDataContainer;
+  }
+
+  if (envActMsg.has_wakeup()) {
+    SetWakeupCondition(envActMsg.wakeup());
+  }
+}
+
+void
+OpenGymInterface::SetWakeupCondition(const ns3opengym::WakeupCondition &condition)
+{
+  NS_LOG_FUNCTION (this);
+  NS_LOG_DEBUG("Wake-up predicates: " << condition.predicate_size() << " max idle time: " << condition.maxidletime());
+  m_wakeup->CopyFrom(condition);
+  // compare Change predicates against the last state sent
+  m_wakeupBaseline.assign(m_wakeup->predicate_size(), std::numeric_limits<double>::quiet_NaN());
+}
+
+bool
+OpenGymInterface::IsWakeupDue(Ptr<OpenGymDataContainer> obs)
+{
+  NS_LOG_FUNCTION (this);
+  // the first state after init is always sent, the agent waits for it in reset
+  if (m_stepIdx == 0 || (m_wakeup->predicate_size() == 0 && m_wakeup->maxidletime() <= 0)) {
+    return true;
+  }
+  if (m_wakeup->maxidletime() > 0 && (Simulator::Now() - m_lastWakeup).GetSeconds() >= m_wakeup->maxidletime()) {
+    return true;
+  }
 
+  for (int i = 0; i < m_wakeup->predicate_size(); i++) {
+    const ns3opengym::WakeupPredicate &predicate = m_wakeup->predicate(i);
+    double value;
+    if (!obs || !obs->GetElement(predicate.index(), value)) {
+      continue;
+    }
+    bool fired = false;
+    switch (predicate.type()) {
+      case ns3opengym::WakeupPredicate::Above:
+        fired = value > predicate.threshold();
+        break;
+      case ns3opengym::WakeupPredicate::Below:
+        fired = value < predicate.threshold();
+        break;
+      case ns3opengym::WakeupPredicate::Change:
+        // NaN baseline (nothing sent yet) never compares equal
+        fired = !(value == m_wakeupBaseline[i]);
+        break;
+      default:
+        break;
+    }
+    if (fired) {
+      NS_LOG_DEBUG("Wake-up predicate " << i << " fired, value: " << value);
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+OpenGymInterface::ResetWakeup(Ptr<OpenGymDataContainer> obs)
+{
+  NS_LOG_FUNCTION (this);
+  m_lastWakeup = Simulator::Now();
+  for (int i = 0; i < m_wakeup->predicate_size(); i++) {
+    double value;
+    if (obs && obs->GetElement(m_wakeup->predicate(i).index(), value)) {
+      m_wakeupBaseline[i] = value;
+    }
+  }
+}
+
+void
+OpenGymInterface::SendMsg(const google::protobuf::Message &msg, bool more)
+{
+  NS_LOG_FUNCTION (this << more);
+  zmq::message_t request;
+  size_t size = msg.ByteSizeLong();
+  if (size > 0) {
+    // serialize with the sizes cached by ByteSizeLong and hand the buffer over without copying
+    SendBuffer *buffer = AcquireSendBuffer(size);
+    msg.SerializeWithCachedSizesToArray(buffer->data.data());
+    request.rebuild(buffer->data.data(), size, &OpenGymInterface::ReleaseSendBuffer, buffer);
+  }
+  bool sent = m_multiplexed ? m_transport->SendTo(m_envId, MsgTypeOf(msg), request, more)
+                            : m_transport->Send(request, more);
+  if (!sent) {
+    NS_FATAL_ERROR("Cannot send OpenGym message to: " << m_transport->GetEndpoint());
+  }
+}
+
+void
+OpenGymInterface::SendStreamedData()
+{
+  NS_LOG_FUNCTION (this << m_streamed.size());
+  for (size_t i = 0; i < m_streamed.size(); ++i) {
+    const OpenGymStreamedData &data = m_streamed[i];
+    uint64_t elements = data.size / data.elementSize;
+    uint64_t chunkElements = std::max<uint64_t>(1, m_wireFormat->chunkSize / data.elementSize);
+    for (uint64_t first = 0; first < elements; first += chunkElements) {
+      uint64_t count = std::min(chunkElements, elements - first);
+      zmq::message_t chunk(count * data.elementSize);
+      data.write(first, count, static_cast<uint8_t*>(chunk.data()));
+      bool more = first + count < elements || i + 1 < m_streamed.size();
+      if (!m_transport->Send(chunk, more)) {
+        NS_FATAL_ERROR("Cannot send streamed OpenGym data to: " << m_transport->GetEndpoint());
+      }
+    }
+  }
+  m_streamed.clear();
+}
+
+OpenGymInterface::SendBuffer *
+OpenGymInterface::AcquireSendBuffer(size_t size)
+{
+  NS_LOG_FUNCTION (this << size);
+  SendBuffer *buffer = nullptr;
+  for (SendBuffer *candidate : m_sendBuffers) {
+    if (candidate->state.load(std::memory_order_acquire) == SendBuffer::FREE) {
+      buffer = candidate;
+      break;
+    }
+  }
+  if (!buffer) {
+    // all buffers are still queued in the transport, e.g. in pipelined mode
+    buffer = new SendBuffer();
+    m_sendBuffers.push_back(buffer);
+  }
+  buffer->state.store(SendBuffer::IN_USE, std::memory_order_relaxed);
+  if (buffer->data.size() < size) {
+    buffer->data.resize(size);
+  }
+  return buffer;
+}
+
+void
+OpenGymInterface::ReleaseSendBuffer(void *data, void *hint)
+{
+  SendBuffer *buffer = static_cast<SendBuffer *>(hint);
+  if (buffer->state.exchange(SendBuffer::FREE, std::memory_order_acq_rel) == SendBuffer::ORPHANED) {
+    delete buffer;
+  }
+}
+
+bool
+OpenGymInterface::ReceiveMsg(google::protobuf::Message &msg, int timeoutMs)
+{
+  NS_LOG_FUNCTION (this << timeoutMs);
+  zmq::message_t reply;
+  bool received = m_multiplexed ? m_transport->ReceiveFrom(m_envId, reply, timeoutMs)
+                                : m_transport->Receive(reply, timeoutMs);
+  if (!received) {
+    // only a receive with a timeout may come back empty
+    if (timeoutMs < 0) {
+      NS_FATAL_ERROR("Cannot receive OpenGym message from: " << m_transport->GetEndpoint());
+    }
+    return false;
+  }
+  if (!msg.ParseFromArray(reply.data(), reply.size())) {
+    NS_FATAL_ERROR("Cannot parse " << msg.GetTypeName() << " received from: " << m_transport->GetEndpoint());
+  }
+  return true;
 }
 
 void
@@ -23,17 +23,50 @@
 #define OPENGYM_INTERFACE_H
 
 #include "ns3/object.h"
-#include <zmq.hpp>
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include "ns3/traced-value.h"
+#include "ns3/traced-callback.h"
+#include <memory>
+#include <vector>
+
+namespace google {
+namespace protobuf {
+class Arena;
+class Message;
+}
+}
+
+namespace ns3opengym {
+class EnvActMsg;
+class EnvStateBatchMsg;
+class WakeupCondition;
+}
 
 namespace ns3 {
 
 class OpenGymSpace;
 class OpenGymDataContainer;
 class OpenGymEnv;
+class OpenGymTransport;
+class OpenGymZmqPublisher;
+struct OpenGymWireFormat;
+struct OpenGymStreamedData;
+class OpenGymLayout;
+class OpenGymDelta;
+class OpenGymContainerPool;
 
 class OpenGymInterface : public Object
 {
 public:
+  // what to do when the agent misses the ReplyTimeout deadline
+  enum FallbackPolicy
+  {
+    FALLBACK_REPEAT_LAST,
+    FALLBACK_DEFAULT_ACTION,
+    FALLBACK_SKIP
+  };
+
   static Ptr<OpenGymInterface> Get (uint32_t port=5555);
 
   OpenGymInterface (uint32_t port=5555);
@@ -65,6 +98,22 @@ public:
 
   void Notify(Ptr<OpenGymEnv> entity);
 
+  // publish on the telemetry channel (TelemetryEndpoint) without waiting for anyone
+  void PublishTelemetry(std::string name, Ptr<OpenGymDataContainer> data);
+  void PublishTelemetry(std::string name, double value);
+
+  // action executed by the DefaultAction fallback policy
+  void SetDefaultAction(Ptr<OpenGymDataContainer> action);
+  // number of agent replies discarded because they missed their deadline
+  uint32_t GetLateReplies() const;
+
+  // agreed on in the init handshake, 0 before
+  uint32_t GetProtocolVersion() const;
+  // ns3opengym::Capability bits both sides support
+  uint64_t GetCapabilities() const;
+  bool HasCapabilities(uint64_t capabilities) const;
+  typedef void (* NegotiatedCallback)(uint32_t protocolVersion, uint64_t capabilities);
+
 protected:
   // Inherited
   virtual void DoInitialize (void);
@@ -74,9 +123,93 @@ private:
   static Ptr<OpenGymInterface> *DoGet (uint32_t port=5555);
   static void Delete (void);
 
+  struct SendBuffer;
+  SendBuffer *AcquireSendBuffer (size_t size);
+  static void ReleaseSendBuffer (void *data, void *hint);
+
+  void SendMsg (const google::protobuf::Message &msg, bool more = false);
+  void SendStreamedData ();
+  bool ReceiveMsg (google::protobuf::Message &msg, int timeoutMs = -1);
+  void WaitForActions ();
+  void ReceiveActions (uint32_t maxPending);
+  void HandleActMsg (const ns3opengym::EnvActMsg &envActMsg);
+  void DecodeDelta (ns3opengym::EnvActMsg &envActMsg);
+  bool IsStale (const ns3opengym::EnvActMsg &envActMsg);
+  void ApplyFallback ();
+  void FlushStateBatch ();
+  void ResetArena ();
+  void SetWakeupCondition (const ns3opengym::WakeupCondition &condition);
+  bool IsWakeupDue (Ptr<OpenGymDataContainer> obs);
+  void ResetWakeup (Ptr<OpenGymDataContainer> obs);
+
   uint32_t m_port;
-  zmq::context_t m_zmq_context;
-  zmq::socket_t m_zmq_socket;
+  std::string m_endpoint;
+  Ptr<OpenGymTransport> m_transport;
+  // data container encoding agreed on in the init handshake
+  std::unique_ptr<OpenGymWireFormat> m_wireFormat;
+  // protocol v5: observations and actions packed by the compiled space
+  // layouts, null if the space has no fixed layout
+  std::unique_ptr<OpenGymLayout> m_obsLayout;
+  std::unique_ptr<OpenGymLayout> m_actLayout;
+  // protocol v6: Box observations above m_chunkSize bytes are streamed
+  uint32_t m_chunkSize;
+  std::vector<OpenGymStreamedData> m_streamed;
+  // protocol v7: observations sent and actions received as changes since
+  // the previous step, m_obsDelta only with DeltaEncoding
+  bool m_deltaEncoding;
+  std::unique_ptr<OpenGymDelta> m_obsDelta;
+  std::unique_ptr<OpenGymDelta> m_actDelta;
+  // action space sent in the init handshake
+  Ptr<OpenGymSpace> m_actionSpace;
+  // Capability negotiation, see GetCapabilities
+  uint64_t m_disabledCapabilities;
+  uint32_t m_protocolVersion;
+  uint64_t m_capabilities;
+  TracedCallback<uint32_t, uint64_t> m_negotiatedTrace;
+  // serialization buffers handed to the transport without copying, a
+  // buffer is reused once the transport has released it
+  std::vector<SendBuffer *> m_sendBuffers;
+  // per-step messages are allocated on m_arena and released together by
+  // ResetArena once the step is answered; m_arenaBlock is its reused first block
+  std::vector<char> m_arenaBlock;
+  std::unique_ptr<google::protobuf::Arena> m_arena;
+
+  bool m_pipelined;
+  uint32_t m_maxActionLag;
+  uint64_t m_stepIdx;
+  uint32_t m_pendingActions;
+
+  bool m_multiplexed;
+  uint32_t m_envId;
+
+  std::string m_telemetryEndpoint;
+  uint32_t m_telemetryHwm;
+  Ptr<OpenGymZmqPublisher> m_telemetry;
+
+  Time m_replyTimeout;
+  FallbackPolicy m_fallbackPolicy;
+  Ptr<OpenGymDataContainer> m_defaultAction;
+  Ptr<OpenGymDataContainer> m_lastAction;
+  // replies to states older than this step missed their deadline
+  uint64_t m_staleBefore;
+  uint32_t m_abandonedReplies;
+  TracedValue<uint32_t> m_lateReplies;
+
+  uint32_t m_repeatSteps;
+  Ptr<OpenGymDataContainer> m_repeatAction;
+  // reward of steps not sent to the agent, added to the next state
+  float m_skippedReward;
+  // recycled action containers
+  std::unique_ptr<OpenGymContainerPool> m_actionPool;
+
+  std::unique_ptr<ns3opengym::WakeupCondition> m_wakeup;
+  std::vector<double> m_wakeupBaseline;
+  Time m_lastWakeup;
+
+  uint32_t m_batchSize;
+  Time m_batchWindow;
+  ns3opengym::EnvStateBatchMsg *m_stateBatch; // on m_arena
+  EventId m_batchFlushEvent;
 
   bool m_simEnd;
   bool m_stopEnvRequested;
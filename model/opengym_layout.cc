@@ -0,0 +1,381 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "ns3/log.h"
+#include "opengym_layout.h"
+#include "container.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenGymLayout");
+
+namespace {
+
+// plain loops over contiguous arrays without calls or branches, so that
+// the compiler can vectorize them
+template <typename Q>
+void
+Quantize (const float *values, const float *scale, const float *offset, uint32_t count, uint8_t *out)
+{
+  const float maxValue = std::numeric_limits<Q>::max ();
+  for (uint32_t i = 0; i < count; ++i)
+    {
+      // rounded and clamped, NaN becomes 0
+      float q = (values[i] - offset[i]) * scale[i] + 0.5f;
+      Q value = static_cast<Q> (std::min (std::max (0.0f, q), maxValue));
+      std::memcpy (out + i * sizeof (Q), &value, sizeof (Q));
+    }
+}
+
+template <typename Q>
+void
+Dequantize (const uint8_t *data, const float *scale, const float *offset, uint32_t count, float *values)
+{
+  for (uint32_t i = 0; i < count; ++i)
+    {
+      Q value;
+      std::memcpy (&value, data + i * sizeof (Q), sizeof (Q));
+      values[i] = offset[i] + scale[i] * value;
+    }
+}
+
+} // anonymous namespace
+
+OpenGymLayout::OpenGymLayout ()
+  : m_size (0),
+    m_quantize (false)
+{
+  m_root.type = ns3opengym::NoSpaceType;
+}
+
+bool
+OpenGymLayout::Compile (const ns3opengym::SpaceDescription &space, bool quantize)
+{
+  NS_LOG_FUNCTION (this << quantize);
+  m_root = Node ();
+  m_size = 0;
+  m_quantize = quantize;
+  if (!CompileNode (space, m_root))
+    {
+      NS_LOG_DEBUG ("Space has no fixed layout");
+      m_root = Node ();
+      m_root.type = ns3opengym::NoSpaceType;
+      m_size = 0;
+      return false;
+    }
+  NS_LOG_DEBUG ("Compiled layout of " << m_size << " bytes");
+  return true;
+}
+
+uint32_t
+OpenGymLayout::GetSize () const
+{
+  return m_size;
+}
+
+bool
+OpenGymLayout::CompileNode (const ns3opengym::SpaceDescription &space, Node &node)
+{
+  node.type = space.type ();
+  node.dtype = ns3opengym::NoDType;
+  node.offset = m_size;
+  node.count = 0;
+  node.name = space.name ();
+  node.quantized = false;
+
+  switch (space.type ())
+    {
+    case ns3opengym::Discrete:
+      node.dtype = ns3opengym::INT;
+      node.count = 1;
+      break;
+
+    case ns3opengym::Box:
+      {
+        ns3opengym::BoxSpace boxSpace;
+        if (space.has_boxspace ())
+          {
+            boxSpace = space.boxspace ();
+          }
+        else if (!space.space ().UnpackTo (&boxSpace))
+          {
+            return false;
+          }
+        if (boxSpace.shape_size () == 0)
+          {
+            return false;
+          }
+        node.dtype = boxSpace.exactdtype () != ns3opengym::NoDType ? boxSpace.exactdtype () : boxSpace.dtype ();
+        node.shape.assign (boxSpace.shape ().begin (), boxSpace.shape ().end ());
+        node.count = 1;
+        for (uint32_t dim : node.shape)
+          {
+            node.count *= dim;
+          }
+        if (m_quantize && boxSpace.quantizeddtype () != ns3opengym::NoDType)
+          {
+            bool scaleOk = boxSpace.scale_size () == 1 || boxSpace.scale_size () == static_cast<int> (node.count);
+            bool offsetOk = boxSpace.offset_size () == 1 || boxSpace.offset_size () == static_cast<int> (node.count);
+            bool dtypeOk = boxSpace.quantizeddtype () == ns3opengym::UINT8 || boxSpace.quantizeddtype () == ns3opengym::UINT16;
+            if (!scaleOk || !offsetOk || !dtypeOk)
+              {
+                return false;
+              }
+            // expanded to one entry per element for the conversion loops
+            node.quantized = true;
+            node.dtype = boxSpace.quantizeddtype ();
+            for (uint32_t i = 0; i < node.count; ++i)
+              {
+                float scale = boxSpace.scale (boxSpace.scale_size () == 1 ? 0 : i);
+                node.scale.push_back (scale);
+                node.inverseScale.push_back (scale != 0 ? 1 / scale : 0);
+                node.zeroPoint.push_back (boxSpace.offset (boxSpace.offset_size () == 1 ? 0 : i));
+              }
+          }
+        break;
+      }
+
+    case ns3opengym::Tuple:
+    case ns3opengym::Dict:
+      {
+        google::protobuf::RepeatedPtrField<ns3opengym::SpaceDescription> elements;
+        ns3opengym::TupleSpace tupleSpace;
+        ns3opengym::DictSpace dictSpace;
+        if (space.has_tuplespace ())
+          {
+            elements = space.tuplespace ().element ();
+          }
+        else if (space.has_dictspace ())
+          {
+            elements = space.dictspace ().element ();
+          }
+        else if (space.type () == ns3opengym::Tuple && space.space ().UnpackTo (&tupleSpace))
+          {
+            elements.Swap (tupleSpace.mutable_element ());
+          }
+        else if (space.type () == ns3opengym::Dict && space.space ().UnpackTo (&dictSpace))
+          {
+            elements.Swap (dictSpace.mutable_element ());
+          }
+        else
+          {
+            return false;
+          }
+
+        node.children.resize (elements.size ());
+        for (int i = 0; i < elements.size (); ++i)
+          {
+            if (!CompileNode (elements.Get (i), node.children[i]))
+              {
+                return false;
+              }
+          }
+        return true;
+      }
+
+    default:
+      return false;
+    }
+
+  m_size += node.count * OpenGymDtypeSize (node.dtype);
+  return true;
+}
+
+bool
+OpenGymLayout::Pack (Ptr<OpenGymDataContainer> container, std::string &out) const
+{
+  NS_LOG_FUNCTION (this);
+  out.resize (m_size);
+  uint8_t *data = reinterpret_cast<uint8_t*> (&out[0]);
+  if (m_root.type != ns3opengym::NoSpaceType && container && container->WritePacked (m_size, data))
+    {
+      return true;
+    }
+  if (m_root.type == ns3opengym::NoSpaceType || !PackNode (container, m_root, data))
+    {
+      NS_LOG_DEBUG ("Container does not fit the layout");
+      out.clear ();
+      return false;
+    }
+  return true;
+}
+
+bool
+OpenGymLayout::PackNode (Ptr<OpenGymDataContainer> container, const Node &node, uint8_t *out) const
+{
+  if (!container)
+    {
+      return false;
+    }
+
+  switch (node.type)
+    {
+    case ns3opengym::Discrete:
+      {
+        Ptr<OpenGymDiscreteContainer> discrete = DynamicCast<OpenGymDiscreteContainer> (container);
+        if (!discrete)
+          {
+            return false;
+          }
+        int32_t value = discrete->GetValue ();
+        std::memcpy (out + node.offset, &value, sizeof (value));
+        return true;
+      }
+
+    case ns3opengym::Box:
+      if (node.quantized)
+        {
+          return PackQuantized (container, node, out + node.offset);
+        }
+      return container->WriteRawData (node.dtype, node.count, out + node.offset);
+
+    case ns3opengym::Tuple:
+      {
+        Ptr<OpenGymTupleContainer> tuple = DynamicCast<OpenGymTupleContainer> (container);
+        if (!tuple)
+          {
+            return false;
+          }
+        for (uint32_t i = 0; i < node.children.size (); ++i)
+          {
+            if (!PackNode (tuple->Get (i), node.children[i], out))
+              {
+                return false;
+              }
+          }
+        return true;
+      }
+
+    case ns3opengym::Dict:
+      {
+        Ptr<OpenGymDictContainer> dict = DynamicCast<OpenGymDictContainer> (container);
+        if (!dict)
+          {
+            return false;
+          }
+        for (const Node &child : node.children)
+          {
+            if (!PackNode (dict->Get (child.name), child, out))
+              {
+                return false;
+              }
+          }
+        return true;
+      }
+
+    default:
+      return false;
+    }
+}
+
+Ptr<OpenGymDataContainer>
+OpenGymLayout::Unpack (const std::string &data, OpenGymContainerPool *pool) const
+{
+  NS_LOG_FUNCTION (this << data.size ());
+  if (m_root.type == ns3opengym::NoSpaceType || data.size () != m_size)
+    {
+      NS_LOG_ERROR ("Packed data of " << data.size () << " bytes does not match the layout of " << m_size << " bytes");
+      return 0;
+    }
+  return UnpackNode (m_root, reinterpret_cast<const uint8_t*> (data.data ()), pool);
+}
+
+bool
+OpenGymLayout::PackQuantized (Ptr<OpenGymDataContainer> container, const Node &node, uint8_t *out) const
+{
+  m_values.resize (node.count);
+  if (!container->WriteRawData (ns3opengym::FLOAT, node.count, reinterpret_cast<uint8_t*> (m_values.data ())))
+    {
+      return false;
+    }
+  if (node.dtype == ns3opengym::UINT8)
+    {
+      Quantize<uint8_t> (m_values.data (), node.inverseScale.data (), node.zeroPoint.data (), node.count, out);
+    }
+  else
+    {
+      Quantize<uint16_t> (m_values.data (), node.inverseScale.data (), node.zeroPoint.data (), node.count, out);
+    }
+  return true;
+}
+
+Ptr<OpenGymDataContainer>
+OpenGymLayout::UnpackNode (const Node &node, const uint8_t *data, OpenGymContainerPool *pool) const
+{
+  switch (node.type)
+    {
+    case ns3opengym::Discrete:
+      {
+        int32_t value;
+        std::memcpy (&value, data + node.offset, sizeof (value));
+        Ptr<OpenGymDiscreteContainer> discrete = OpenGymCreateContainer<OpenGymDiscreteContainer> (pool);
+        discrete->SetValue (value);
+        return discrete;
+      }
+
+    case ns3opengym::Box:
+      if (node.quantized)
+        {
+          Ptr<OpenGymBoxContainer<float> > box = OpenGymCreateContainer<OpenGymBoxContainer<float> > (pool);
+          box->SetShape (node.shape);
+          box->Resize (node.count);
+          if (node.dtype == ns3opengym::UINT8)
+            {
+              Dequantize<uint8_t> (data + node.offset, node.scale.data (), node.zeroPoint.data (), node.count, box->GetDataPtr ());
+            }
+          else
+            {
+              Dequantize<uint16_t> (data + node.offset, node.scale.data (), node.zeroPoint.data (), node.count, box->GetDataPtr ());
+            }
+          return box;
+        }
+      return OpenGymDataContainer::CreateFromRawData (node.dtype, node.shape, data + node.offset, node.count, pool);
+
+    case ns3opengym::Tuple:
+      {
+        Ptr<OpenGymTupleContainer> tuple = OpenGymCreateContainer<OpenGymTupleContainer> (pool);
+        for (const Node &child : node.children)
+          {
+            tuple->Add (UnpackNode (child, data, pool));
+          }
+        return tuple;
+      }
+
+    case ns3opengym::Dict:
+      {
+        Ptr<OpenGymDictContainer> dict = OpenGymCreateContainer<OpenGymDictContainer> (pool);
+        for (const Node &child : node.children)
+          {
+            dict->Add (child.name, UnpackNode (child, data, pool));
+          }
+        return dict;
+      }
+
+    default:
+      return 0;
+    }
+}
+
+} // end of namespace ns3
@@ -0,0 +1,95 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+
+#ifndef OPENGYM_LAYOUT_H
+#define OPENGYM_LAYOUT_H
+
+#include "ns3/ptr.h"
+#include <string>
+#include <vector>
+#include "messages.pb.h"
+
+namespace ns3 {
+
+class OpenGymDataContainer;
+class OpenGymContainerPool;
+
+/**
+ * Flat byte layout of a space, compiled from its description after the
+ * init handshake (protocol v5). Steps then carry only the packed values
+ * instead of a DataContainer tree with type tags, names and shapes.
+ *
+ * The leaves of the space are laid out depth-first in the order of the
+ * description, without padding: a Discrete as int32, a Box as the product
+ * of its shape elements of its dtype, all little-endian. Must match
+ * SpaceLayout in ns3gym/ns3env.py.
+ *
+ * Compiled with quantize, Boxes with a quantizedDtype in their description
+ * are packed as those integers instead (protocol v9).
+ */
+class OpenGymLayout
+{
+public:
+  OpenGymLayout ();
+
+  // false if the space has no fixed size, e.g. a Box without shape
+  bool Compile (const ns3opengym::SpaceDescription &space, bool quantize = false);
+  uint32_t GetSize () const;
+
+  // false (and out cleared) if the container does not fit the layout
+  bool Pack (Ptr<OpenGymDataContainer> container, std::string &out) const;
+  // 0 if data does not have the size of the layout; containers are taken
+  // from pool if one is given
+  Ptr<OpenGymDataContainer> Unpack (const std::string &data, OpenGymContainerPool *pool = nullptr) const;
+
+private:
+  struct Node
+  {
+    ns3opengym::SpaceType type;
+    ns3opengym::Dtype dtype;
+    uint32_t offset;
+    uint32_t count;
+    std::string name;
+    std::vector<uint32_t> shape;
+    std::vector<Node> children;
+    // quantized Box: dtype is UINT8 or UINT16, one entry per element
+    bool quantized;
+    std::vector<float> scale;
+    std::vector<float> inverseScale;
+    std::vector<float> zeroPoint; // BoxSpace.offset
+  };
+
+  bool CompileNode (const ns3opengym::SpaceDescription &space, Node &node);
+  bool PackQuantized (Ptr<OpenGymDataContainer> container, const Node &node, uint8_t *out) const;
+  bool PackNode (Ptr<OpenGymDataContainer> container, const Node &node, uint8_t *out) const;
+  Ptr<OpenGymDataContainer> UnpackNode (const Node &node, const uint8_t *data, OpenGymContainerPool *pool) const;
+
+  Node m_root;
+  uint32_t m_size;
+  bool m_quantize;
+  // float values of a quantized Box before conversion
+  mutable std::vector<float> m_values;
+};
+
+} // end of namespace ns3
+
+#endif /* OPENGYM_LAYOUT_H */
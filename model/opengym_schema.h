@@ -0,0 +1,499 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+
+#ifndef OPENGYM_SCHEMA_H
+#define OPENGYM_SCHEMA_H
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include "ns3/type-name.h"
+#include "container.h"
+#include "spaces.h"
+
+/**
+ * Observations and actions declared once as a C++ struct. The struct
+ * lists its fields in a constexpr static Fields () function:
+ *
+ *   struct MyObs
+ *   {
+ *     std::array<std::array<float, 16>, 4> spectrogram;
+ *     uint32_t channel;
+ *
+ *     static constexpr auto Fields ()
+ *     {
+ *       return std::make_tuple (OpenGymBoxField ("spectrogram", &MyObs::spectrogram, 0, 1),
+ *                               OpenGymDiscreteField ("channel", &MyObs::channel, 4));
+ *     }
+ *   };
+ *
+ * OpenGymSchema<MyObs> then creates the Dict space, OpenGymStructContainer
+ * sends a MyObs without building containers per field, and Decode reads an
+ * action into a MyObs. Box fields are arithmetic values or (nested)
+ * std::arrays of them; element types and names are checked at compile time.
+ */
+
+namespace ns3 {
+
+// element type and shape of a Box field
+template <typename F>
+struct OpenGymFieldTraits
+{
+  static_assert (std::is_arithmetic<F>::value, "Box fields are arithmetic values or nested std::arrays of them");
+  static_assert (std::is_same<F, float>::value || OpenGymDtype<F>::value != ns3opengym::FLOAT,
+                 "Box element type without a Dtype");
+  typedef F Element;
+  static const uint32_t count = 1;
+  static void AppendShape (std::vector<uint32_t> &shape) {}
+};
+
+template <typename F, size_t N>
+struct OpenGymFieldTraits<std::array<F, N> >
+{
+  typedef typename OpenGymFieldTraits<F>::Element Element;
+  static const uint32_t count = N * OpenGymFieldTraits<F>::count;
+  static void AppendShape (std::vector<uint32_t> &shape)
+  {
+    shape.push_back (N);
+    OpenGymFieldTraits<F>::AppendShape (shape);
+  }
+};
+
+template <typename S, typename F>
+struct OpenGymBoxFieldDesc
+{
+  typedef typename OpenGymFieldTraits<F>::Element Element;
+  static const uint32_t count = OpenGymFieldTraits<F>::count;
+  static const ns3opengym::Dtype dtype = OpenGymDtype<Element>::value;
+  // the field is sent and received with memcpy
+  static_assert (sizeof (F) == count * sizeof (Element), "Box field with padding");
+
+  const char *name;
+  F S::*member;
+  float low;
+  float high;
+
+  static std::vector<uint32_t> GetShape ()
+  {
+    std::vector<uint32_t> shape;
+    OpenGymFieldTraits<F>::AppendShape (shape);
+    if (shape.empty ())
+      {
+        shape.push_back (1);
+      }
+    return shape;
+  }
+
+  Ptr<OpenGymSpace> CreateSpace () const
+  {
+    return CreateObject<OpenGymBoxSpace> (low, high, GetShape (), TypeNameGet<Element> ());
+  }
+
+  uint32_t GetSize () const
+  {
+    return sizeof (F);
+  }
+
+  void Write (const S &value, uint8_t *out) const
+  {
+    std::memcpy (out, &(value.*member), sizeof (F));
+  }
+
+  void Fill (const S &value, ns3opengym::DataContainer &msg, const OpenGymWireFormat &format) const
+  {
+    const Element *first = reinterpret_cast<const Element *> (&(value.*member));
+    if (format.typed && format.rawBox && (format.fullDtypes || OpenGymLegacyDtype (dtype) == dtype))
+      {
+        ns3opengym::BoxDataContainer &box = *msg.mutable_box ();
+        std::vector<uint32_t> shape = GetShape ();
+        *box.mutable_shape () = {shape.begin (), shape.end ()};
+        box.set_dtype (dtype);
+        box.set_rawdata (reinterpret_cast<const char *> (first), sizeof (F));
+        msg.set_type (ns3opengym::Box);
+        return;
+      }
+    // older agents, through a Box container
+    Ptr<OpenGymBoxContainer<Element> > box = CreateObject<OpenGymBoxContainer<Element> > (GetShape ());
+    box->Assign (first, first + count);
+    box->FillDataContainerPbMsg (msg, format);
+  }
+
+  bool Read (Ptr<OpenGymDataContainer> container, S &value) const
+  {
+    return container && container->WriteRawData (dtype, count, reinterpret_cast<uint8_t *> (&(value.*member)));
+  }
+
+  bool GetElement (const S &value, uint32_t idx, double &element) const
+  {
+    element = static_cast<double> (reinterpret_cast<const Element *> (&(value.*member))[idx]);
+    return true;
+  }
+
+  uint32_t GetCount () const
+  {
+    return count;
+  }
+
+  void Print (const S &value, std::ostream &where) const
+  {
+    const Element *first = reinterpret_cast<const Element *> (&(value.*member));
+    where << "[";
+    for (uint32_t i = 0; i < count; ++i)
+      {
+        where << (i ? ", " : "") << std::to_string (first[i]);
+      }
+    where << "]";
+  }
+};
+
+template <typename S, typename F>
+struct OpenGymDiscreteFieldDesc
+{
+  static_assert (std::is_integral<F>::value, "Discrete fields are integers");
+
+  const char *name;
+  F S::*member;
+  uint32_t n;
+
+  Ptr<OpenGymSpace> CreateSpace () const
+  {
+    return CreateObject<OpenGymDiscreteSpace> (n);
+  }
+
+  uint32_t GetSize () const
+  {
+    return sizeof (int32_t);
+  }
+
+  void Write (const S &value, uint8_t *out) const
+  {
+    int32_t discrete = static_cast<int32_t> (value.*member);
+    std::memcpy (out, &discrete, sizeof (discrete));
+  }
+
+  void Fill (const S &value, ns3opengym::DataContainer &msg, const OpenGymWireFormat &format) const
+  {
+    ns3opengym::DiscreteDataContainer packed;
+    ns3opengym::DiscreteDataContainer &discrete = format.typed ? *msg.mutable_discrete () : packed;
+    discrete.set_data (value.*member);
+    msg.set_type (ns3opengym::Discrete);
+    if (!format.typed)
+      {
+        msg.mutable_data ()->PackFrom (packed);
+      }
+  }
+
+  bool Read (Ptr<OpenGymDataContainer> container, S &value) const
+  {
+    double discrete;
+    if (!container || !container->GetElement (0, discrete))
+      {
+        return false;
+      }
+    value.*member = static_cast<F> (discrete);
+    return true;
+  }
+
+  bool GetElement (const S &value, uint32_t idx, double &element) const
+  {
+    element = static_cast<double> (value.*member);
+    return true;
+  }
+
+  uint32_t GetCount () const
+  {
+    return 1;
+  }
+
+  void Print (const S &value, std::ostream &where) const
+  {
+    where << std::to_string (value.*member);
+  }
+};
+
+template <typename S, typename F>
+constexpr OpenGymBoxFieldDesc<S, F>
+OpenGymBoxField (const char *name, F S::*member, float low, float high)
+{
+  return {name, member, low, high};
+}
+
+template <typename S, typename F>
+constexpr OpenGymDiscreteFieldDesc<S, F>
+OpenGymDiscreteField (const char *name, F S::*member, uint32_t n)
+{
+  return {name, member, n};
+}
+
+constexpr bool
+OpenGymNamesEqual (const char *a, const char *b)
+{
+  return *a == *b && (*a == '\0' || OpenGymNamesEqual (a + 1, b + 1));
+}
+
+template <typename Fields, size_t... I>
+constexpr bool
+OpenGymUniqueNames (const Fields &fields, std::index_sequence<I...>)
+{
+  const char *names[] = {std::get<I> (fields).name...};
+  for (size_t i = 0; i < sizeof... (I); ++i)
+    {
+      for (size_t j = i + 1; j < sizeof... (I); ++j)
+        {
+          if (OpenGymNamesEqual (names[i], names[j]))
+            {
+              return false;
+            }
+        }
+    }
+  return true;
+}
+
+template <typename S>
+class OpenGymSchema
+{
+public:
+  typedef decltype (S::Fields ()) Fields;
+  static const size_t N = std::tuple_size<Fields>::value;
+
+  static Ptr<OpenGymSpace> CreateSpace ()
+  {
+    Ptr<OpenGymDictSpace> space = CreateObject<OpenGymDictSpace> ();
+    ForEach ([&space] (const auto &field) { space->Add (field.name, field.CreateSpace ()); });
+    return space;
+  }
+
+  // action (a Dict with the fields of S) into value, false if it does not fit
+  static bool Decode (Ptr<OpenGymDataContainer> action, S &value)
+  {
+    Ptr<OpenGymDictContainer> dict = DynamicCast<OpenGymDictContainer> (action);
+    bool ok = dict != 0;
+    ForEach ([&] (const auto &field) { ok = ok && field.Read (dict->Get (field.name), value); });
+    return ok;
+  }
+
+  // size of S in a packed layout (protocol v5)
+  static uint32_t GetPackedSize ()
+  {
+    uint32_t size = 0;
+    ForEach ([&size] (const auto &field) { size += field.GetSize (); });
+    return size;
+  }
+
+  static void Write (const S &value, uint8_t *out)
+  {
+    for (uint32_t i : GetOrder ())
+      {
+        Dispatch (i, [&] (const auto &field) {
+          field.Write (value, out);
+          out += field.GetSize ();
+        });
+      }
+  }
+
+  static void Fill (const S &value, ns3opengym::DataContainer &msg, const OpenGymWireFormat &format)
+  {
+    ns3opengym::DictDataContainer packed;
+    ns3opengym::DictDataContainer &dict = format.typed ? *msg.mutable_dict () : packed;
+    // the key id of a field is its position in GetOrder
+    uint32_t id = 0;
+    for (uint32_t i : GetOrder ())
+      {
+        Dispatch (i, [&] (const auto &field) {
+          ns3opengym::DataContainer *element = dict.add_element ();
+          field.Fill (value, *element, format);
+          if (format.dictKeyIds)
+            {
+              dict.add_key (id);
+            }
+          else
+            {
+              element->set_name (field.name);
+            }
+        });
+        ++id;
+      }
+    msg.set_type (ns3opengym::Dict);
+    if (!format.typed)
+      {
+        msg.mutable_data ()->PackFrom (packed);
+      }
+  }
+
+  static bool GetElement (const S &value, uint32_t idx, double &element)
+  {
+    for (uint32_t i : GetOrder ())
+      {
+        bool found = false;
+        Dispatch (i, [&] (const auto &field) {
+          if (idx < field.GetCount ())
+            {
+              found = field.GetElement (value, idx, element);
+            }
+          else
+            {
+              idx -= field.GetCount ();
+            }
+        });
+        if (found)
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+
+  static void Print (const S &value, std::ostream &where)
+  {
+    where << "{";
+    for (uint32_t i : GetOrder ())
+      {
+        Dispatch (i, [&] (const auto &field) {
+          where << (i == GetOrder ().front () ? "" : ", ") << field.name << ": ";
+          field.Print (value, where);
+        });
+      }
+    where << "}";
+  }
+
+private:
+  static_assert (N > 0, "Schema without fields");
+  static_assert (OpenGymUniqueNames (S::Fields (), std::make_index_sequence<N> ()), "Schema with duplicate field names");
+
+  template <typename Fn, size_t... I>
+  static void ForEach (Fn &&fn, std::index_sequence<I...>)
+  {
+    static constexpr Fields fields = S::Fields ();
+    (fn (std::get<I> (fields)), ...);
+  }
+
+  template <typename Fn>
+  static void ForEach (Fn &&fn)
+  {
+    ForEach (fn, std::make_index_sequence<N> ());
+  }
+
+  // call fn with field i only
+  template <typename Fn, size_t... I>
+  static void Dispatch (uint32_t i, Fn &&fn, std::index_sequence<I...>)
+  {
+    static constexpr Fields fields = S::Fields ();
+    ((i == I ? fn (std::get<I> (fields)) : void ()), ...);
+  }
+
+  template <typename Fn>
+  static void Dispatch (uint32_t i, Fn &&fn)
+  {
+    Dispatch (i, fn, std::make_index_sequence<N> ());
+  }
+
+  // field indices by name, the order of Dict spaces and containers
+  static const std::vector<uint32_t> &GetOrder ()
+  {
+    static const std::vector<uint32_t> order = [] () {
+      std::vector<std::string> names;
+      ForEach ([&names] (const auto &field) { names.push_back (field.name); });
+      std::vector<uint32_t> indices (N);
+      for (uint32_t i = 0; i < N; ++i)
+        {
+          indices[i] = i;
+        }
+      std::sort (indices.begin (), indices.end (), [&names] (uint32_t a, uint32_t b) { return names[a] < names[b]; });
+      return indices;
+    } ();
+    return order;
+  }
+};
+
+/**
+ * Data container holding a struct S with an OpenGymSchema; sent as the
+ * Dict of its fields straight from the struct.
+ */
+template <typename S>
+class OpenGymStructContainer : public OpenGymDataContainer
+{
+public:
+  OpenGymStructContainer () : m_value () {}
+  OpenGymStructContainer (const S &value) : m_value (value) {}
+
+  static TypeId GetTypeId ()
+  {
+    static TypeId tid = TypeId (("ns3::OpenGymStructContainer<" + std::string (typeid (S).name ()) + ">").c_str ())
+      .SetParent<OpenGymDataContainer> ()
+      .SetGroupName ("OpenGym")
+      .template AddConstructor<OpenGymStructContainer<S> > ()
+      ;
+    return tid;
+  }
+
+  virtual void FillDataContainerPbMsg (ns3opengym::DataContainer &dataContainer, const OpenGymWireFormat &format)
+  {
+    OpenGymSchema<S>::Fill (m_value, dataContainer, format);
+  }
+
+  virtual bool WritePacked (uint32_t size, uint8_t *out)
+  {
+    if (size != OpenGymSchema<S>::GetPackedSize ())
+      {
+        return false;
+      }
+    OpenGymSchema<S>::Write (m_value, out);
+    return true;
+  }
+
+  virtual bool GetElement (uint32_t idx, double &value)
+  {
+    return OpenGymSchema<S>::GetElement (m_value, idx, value);
+  }
+
+  virtual void Clear ()
+  {
+    m_value = S ();
+  }
+
+  virtual void Print (std::ostream &where) const
+  {
+    OpenGymSchema<S>::Print (m_value, where);
+  }
+
+  S &Get ()
+  {
+    return m_value;
+  }
+
+  void Set (const S &value)
+  {
+    m_value = value;
+  }
+
+private:
+  S m_value;
+};
+
+} // end of namespace ns3
+
+#endif /* OPENGYM_SCHEMA_H */
@@ -0,0 +1,583 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "ns3/log.h"
+#include "ns3/nstime.h"
+#include "ns3/uinteger.h"
+#include "opengym_shm.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenGymShmTransport");
+
+NS_OBJECT_ENSURE_REGISTERED (OpenGymShmTransport);
+
+namespace {
+
+const uint32_t SHM_MAGIC = 0x4733534e; // "NS3G"
+const uint32_t SHM_VERSION = 1;
+const uint64_t SHM_HEADER_SIZE = 64;
+const uint64_t SHM_RING_CTRL_SIZE = 192;
+const uint32_t SHM_SPIN_COUNT = 2000;
+const int SHM_WAIT_SLICE_MS = 10;
+const uint32_t SHM_RECORD_MORE = 1;
+
+struct SegmentHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint32_t pid;           //!< creator, stored before the segment is formatted
+  uint32_t attacherPid;   //!< process that attached last, 0 before
+};
+
+enum HeaderState
+{
+  HEADER_READY,
+  HEADER_STALE,
+  HEADER_TIMEOUT
+};
+
+bool
+ProcessAlive (uint32_t pid)
+{
+  return pid != 0 && (kill (pid, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * Unlink the segment only if its name still refers to the one behind fd,
+ * the peer may already have replaced a stale segment with a fresh one.
+ */
+void
+UnlinkIfSame (const std::string &name, int fd)
+{
+  struct stat ours;
+  struct stat current;
+  int other = shm_open (name.c_str (), O_RDONLY, 0600);
+  if (other < 0)
+    {
+      return;
+    }
+  if (fstat (fd, &ours) == 0 && fstat (other, &current) == 0
+      && ours.st_dev == current.st_dev && ours.st_ino == current.st_ino)
+    {
+      shm_unlink (name.c_str ());
+    }
+  close (other);
+}
+
+/*
+ * Wait until the creator has sized and formatted the segment. A segment
+ * whose creator is gone is stale: left over by a crashed run, or never
+ * finished formatting.
+ */
+HeaderState
+WaitForHeader (int fd, std::chrono::steady_clock::time_point deadline, SegmentHeader *header)
+{
+  while (true)
+    {
+      struct stat st;
+      if (fstat (fd, &st) == 0 && (uint64_t)st.st_size >= SHM_HEADER_SIZE)
+        {
+          void *addr = mmap (nullptr, SHM_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+          if (addr != MAP_FAILED)
+            {
+              const SegmentHeader *mapped = static_cast<const SegmentHeader*> (addr);
+              bool ready = __atomic_load_n (&mapped->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC;
+              *header = *mapped;
+              munmap (addr, SHM_HEADER_SIZE);
+              if ((ready || header->pid != 0) && !ProcessAlive (header->pid))
+                {
+                  return HEADER_STALE;
+                }
+              if (ready)
+                {
+                  return HEADER_READY;
+                }
+            }
+        }
+      if (std::chrono::steady_clock::now () >= deadline)
+        {
+          return HEADER_TIMEOUT;
+        }
+      usleep (1000);
+    }
+}
+
+void
+FutexWait (uint32_t *addr, uint32_t expected, int timeoutMs)
+{
+#ifdef __linux__
+  struct timespec ts;
+  ts.tv_sec = timeoutMs / 1000;
+  ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+  syscall (SYS_futex, addr, FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+  usleep (timeoutMs * 100);
+#endif
+}
+
+void
+FutexWake (uint32_t *addr)
+{
+#ifdef __linux__
+  syscall (SYS_futex, addr, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+/*
+ * Block until *counter differs from stale, or timeoutMs (if >= 0) expires,
+ * or the process *peerPid (if known) has exited. The peer bumps *seq and
+ * wakes us whenever it moves the counter and sees *waiting set.
+ */
+bool
+WaitForChange (uint64_t *counter, uint64_t stale, uint32_t *seq, uint32_t *waiting, const uint32_t *peerPid,
+               int timeoutMs = -1)
+{
+  for (uint32_t i = 0; i < SHM_SPIN_COUNT; ++i)
+    {
+      if (__atomic_load_n (counter, __ATOMIC_ACQUIRE) != stale)
+        {
+          return true;
+        }
+    }
+
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now ()
+    + std::chrono::milliseconds (timeoutMs);
+  bool changed = false;
+  while (true)
+    {
+      uint32_t s = __atomic_load_n (seq, __ATOMIC_SEQ_CST);
+      __atomic_store_n (waiting, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n (counter, __ATOMIC_SEQ_CST) != stale)
+        {
+          changed = true;
+          break;
+        }
+
+      // the slice guards against a peer that does not fence its stores or
+      // that exits while we wait
+      int slice = SHM_WAIT_SLICE_MS;
+      if (timeoutMs >= 0)
+        {
+          int64_t left = std::chrono::duration_cast<std::chrono::milliseconds> (deadline - std::chrono::steady_clock::now ()).count ();
+          if (left <= 0)
+            {
+              break;
+            }
+          slice = std::min<int64_t> (slice, left);
+        }
+      FutexWait (seq, s, slice);
+      if (__atomic_load_n (counter, __ATOMIC_SEQ_CST) != stale)
+        {
+          changed = true;
+          break;
+        }
+      // an exited peer never moves the counter
+      uint32_t peer = peerPid ? __atomic_load_n (peerPid, __ATOMIC_RELAXED) : 0;
+      if (peer != 0 && !ProcessAlive (peer))
+        {
+          break;
+        }
+    }
+  __atomic_store_n (waiting, 0, __ATOMIC_SEQ_CST);
+  return changed;
+}
+
+void
+Signal (uint32_t *seq, uint32_t *waiting)
+{
+  __atomic_add_fetch (seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (waiting, __ATOMIC_SEQ_CST))
+    {
+      FutexWake (seq);
+    }
+}
+
+} // anonymous namespace
+
+struct OpenGymShmTransport::RingCtrl
+{
+  uint64_t head;          //!< bytes written so far, owned by the writer
+  uint8_t pad0[56];
+  uint64_t tail;          //!< bytes read so far, owned by the reader
+  uint8_t pad1[56];
+  uint32_t dataSeq;       //!< futex word bumped by the writer
+  uint32_t readerWaiting;
+  uint32_t spaceSeq;      //!< futex word bumped by the reader
+  uint32_t writerWaiting;
+  uint8_t pad2[48];
+};
+
+static_assert (sizeof (SegmentHeader) <= SHM_HEADER_SIZE, "shm header does not fit");
+
+TypeId
+OpenGymShmTransport::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::OpenGymShmTransport")
+    .SetParent<OpenGymTransport> ()
+    .SetGroupName ("OpenGym")
+    .AddConstructor<OpenGymShmTransport> ()
+    .AddAttribute ("RingCapacity",
+                   "Capacity in bytes of each ring, used when this side creates the segment",
+                   UintegerValue (4 * 1024 * 1024),
+                   MakeUintegerAccessor (&OpenGymShmTransport::m_ringCapacity),
+                   MakeUintegerChecker<uint64_t> (4096))
+    .AddAttribute ("AttachTimeout",
+                   "How long to wait for the peer to format an existing segment",
+                   TimeValue (Seconds (10)),
+                   MakeTimeAccessor (&OpenGymShmTransport::m_attachTimeout),
+                   MakeTimeChecker ())
+    ;
+  return tid;
+}
+
+OpenGymShmTransport::OpenGymShmTransport ()
+  : m_ringCapacity (4 * 1024 * 1024),
+    m_attachTimeout (Seconds (10)),
+    m_fd (-1),
+    m_owner (false),
+    m_base (nullptr),
+    m_mapSize (0),
+    m_capacity (0),
+    m_txRing (nullptr),
+    m_txData (nullptr),
+    m_rxRing (nullptr),
+    m_rxData (nullptr),
+    m_peerPid (nullptr),
+    m_peerExited (false)
+{
+  NS_LOG_FUNCTION (this);
+  static_assert (sizeof (RingCtrl) == SHM_RING_CTRL_SIZE, "unexpected ring control block size");
+}
+
+OpenGymShmTransport::~OpenGymShmTransport ()
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+}
+
+void
+OpenGymShmTransport::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+  OpenGymTransport::DoDispose ();
+}
+
+bool
+OpenGymShmTransport::Connect (std::string endpoint)
+{
+  NS_LOG_FUNCTION (this << endpoint);
+  m_endpoint = endpoint;
+  std::string name = endpoint;
+  std::string::size_type pos = endpoint.find ("://");
+  if (pos != std::string::npos)
+    {
+      name = endpoint.substr (pos + 3);
+    }
+  return Open (name, m_ringCapacity);
+}
+
+bool
+OpenGymShmTransport::Open (std::string name, uint64_t ringCapacity)
+{
+  NS_LOG_FUNCTION (this << name << ringCapacity);
+  if (name.empty () || name[0] != '/')
+    {
+      name = "/" + name;
+    }
+  m_name = name;
+
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now ()
+    + std::chrono::milliseconds (m_attachTimeout.GetMilliSeconds ());
+  while (true)
+    {
+      // whoever comes first (simulation or agent) creates and formats the segment
+      m_fd = shm_open (m_name.c_str (), O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (m_fd >= 0)
+        {
+          m_owner = true;
+          m_capacity = ringCapacity;
+          m_mapSize = SHM_HEADER_SIZE + 2 * (SHM_RING_CTRL_SIZE + m_capacity);
+          if (ftruncate (m_fd, m_mapSize) != 0)
+            {
+              NS_LOG_ERROR ("Cannot resize shared memory segment " << m_name << ": " << std::strerror (errno));
+              Close ();
+              return false;
+            }
+          m_base = static_cast<uint8_t*> (mmap (nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+          if (m_base == MAP_FAILED)
+            {
+              m_base = nullptr;
+              Close ();
+              return false;
+            }
+          SegmentHeader *header = reinterpret_cast<SegmentHeader*> (m_base);
+          __atomic_store_n (&header->pid, (uint32_t)getpid (), __ATOMIC_RELEASE);
+          std::memset (m_base + SHM_HEADER_SIZE, 0, SHM_RING_CTRL_SIZE);
+          std::memset (m_base + SHM_HEADER_SIZE + SHM_RING_CTRL_SIZE + m_capacity, 0, SHM_RING_CTRL_SIZE);
+          header->version = SHM_VERSION;
+          header->capacity = m_capacity;
+          __atomic_store_n (&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+          break;
+        }
+      if (errno != EEXIST)
+        {
+          NS_LOG_ERROR ("Cannot create shared memory segment " << m_name << ": " << std::strerror (errno));
+          return false;
+        }
+
+      m_fd = shm_open (m_name.c_str (), O_RDWR, 0600);
+      if (m_fd < 0)
+        {
+          if (errno == ENOENT)
+            {
+              // the previous owner removed it in the meantime
+              continue;
+            }
+          NS_LOG_ERROR ("Cannot open shared memory segment " << m_name << ": " << std::strerror (errno));
+          return false;
+        }
+
+      SegmentHeader header;
+      HeaderState state = WaitForHeader (m_fd, deadline, &header);
+      if (state != HEADER_READY)
+        {
+          // an unusable segment would also block every later run
+          UnlinkIfSame (m_name, m_fd);
+          close (m_fd);
+          m_fd = -1;
+          if (state == HEADER_STALE)
+            {
+              NS_LOG_WARN ("Removed stale shared memory segment " << m_name << " of process " << header.pid);
+              continue;
+            }
+          NS_LOG_ERROR ("Shared memory segment " << m_name << " was not formatted within "
+                        << m_attachTimeout.GetSeconds () << "s, removed it");
+          return false;
+        }
+
+      if (header.version != SHM_VERSION)
+        {
+          NS_LOG_ERROR ("Shared memory segment " << m_name << " has unsupported version " << header.version);
+          Close ();
+          return false;
+        }
+      m_capacity = header.capacity;
+      m_mapSize = SHM_HEADER_SIZE + 2 * (SHM_RING_CTRL_SIZE + m_capacity);
+      m_base = static_cast<uint8_t*> (mmap (nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+      if (m_base == MAP_FAILED)
+        {
+          m_base = nullptr;
+          Close ();
+          return false;
+        }
+      break;
+    }
+
+  // each side watches the pid of the other, the creator once that attaches
+  SegmentHeader *header = reinterpret_cast<SegmentHeader*> (m_base);
+  if (!m_owner)
+    {
+      __atomic_store_n (&header->attacherPid, (uint32_t)getpid (), __ATOMIC_RELEASE);
+    }
+  m_peerPid = m_owner ? &header->attacherPid : &header->pid;
+  m_peerExited = false;
+
+  // ring 0 carries sim -> agent messages, ring 1 agent -> sim
+  uint8_t *ring0 = m_base + SHM_HEADER_SIZE;
+  uint8_t *ring1 = ring0 + SHM_RING_CTRL_SIZE + m_capacity;
+  m_txRing = reinterpret_cast<RingCtrl*> (ring0);
+  m_txData = ring0 + SHM_RING_CTRL_SIZE;
+  m_rxRing = reinterpret_cast<RingCtrl*> (ring1);
+  m_rxData = ring1 + SHM_RING_CTRL_SIZE;
+
+  NS_LOG_DEBUG ("Opened shared memory segment " << m_name << " ring capacity: " << m_capacity
+                << " owner: " << m_owner);
+  return true;
+}
+
+void
+OpenGymShmTransport::Close ()
+{
+  NS_LOG_FUNCTION (this);
+  if (m_base)
+    {
+      munmap (m_base, m_mapSize);
+      m_base = nullptr;
+    }
+  if (m_fd >= 0)
+    {
+      close (m_fd);
+      m_fd = -1;
+      if (m_owner)
+        {
+          shm_unlink (m_name.c_str ());
+        }
+    }
+  m_txRing = nullptr;
+  m_rxRing = nullptr;
+  m_peerPid = nullptr;
+}
+
+bool
+OpenGymShmTransport::PeerExited ()
+{
+  if (!m_peerExited && m_peerPid)
+    {
+      uint32_t pid = __atomic_load_n (m_peerPid, __ATOMIC_RELAXED);
+      if (pid != 0 && !ProcessAlive (pid))
+        {
+          NS_LOG_ERROR ("Peer process " << pid << " of shared memory segment " << m_name << " has exited");
+          m_peerExited = true;
+        }
+    }
+  return m_peerExited;
+}
+
+bool
+OpenGymShmTransport::Write (RingCtrl *ring, uint8_t *data, const uint8_t *src, uint64_t size)
+{
+  // single writer: the head is only ever modified by us
+  uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+  while (size > 0)
+    {
+      uint64_t tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+      uint64_t space = m_capacity - (head - tail);
+      if (space == 0)
+        {
+          if (!WaitForChange (&ring->tail, tail, &ring->spaceSeq, &ring->writerWaiting, m_peerPid))
+            {
+              // unbounded waits only fail once the peer has exited
+              PeerExited ();
+              return false;
+            }
+          continue;
+        }
+
+      uint64_t offset = head % m_capacity;
+      uint64_t chunk = std::min (std::min (size, space), m_capacity - offset);
+      std::memcpy (data + offset, src, chunk);
+      src += chunk;
+      size -= chunk;
+      head += chunk;
+
+      __atomic_store_n (&ring->head, head, __ATOMIC_SEQ_CST);
+      Signal (&ring->dataSeq, &ring->readerWaiting);
+    }
+  return true;
+}
+
+bool
+OpenGymShmTransport::Read (RingCtrl *ring, uint8_t *data, uint8_t *dst, uint64_t size)
+{
+  // single reader: the tail is only ever modified by us
+  uint64_t tail = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+  while (size > 0)
+    {
+      uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      uint64_t avail = head - tail;
+      if (avail == 0)
+        {
+          if (!WaitForChange (&ring->head, head, &ring->dataSeq, &ring->readerWaiting, m_peerPid))
+            {
+              // unbounded waits only fail once the peer has exited
+              PeerExited ();
+              return false;
+            }
+          continue;
+        }
+
+      uint64_t offset = tail % m_capacity;
+      uint64_t chunk = std::min (std::min (size, avail), m_capacity - offset);
+      std::memcpy (dst, data + offset, chunk);
+      dst += chunk;
+      size -= chunk;
+      tail += chunk;
+
+      __atomic_store_n (&ring->tail, tail, __ATOMIC_SEQ_CST);
+      Signal (&ring->spaceSeq, &ring->writerWaiting);
+    }
+  return true;
+}
+
+bool
+OpenGymShmTransport::Send (zmq::message_t &msg, bool more)
+{
+  NS_LOG_FUNCTION (this << msg.size () << more);
+  if (!m_txRing || m_peerExited)
+    {
+      return false;
+    }
+  uint32_t header[2] = {static_cast<uint32_t> (msg.size ()), more ? SHM_RECORD_MORE : 0};
+  return Write (m_txRing, m_txData, reinterpret_cast<const uint8_t*> (header), sizeof (header))
+         && Write (m_txRing, m_txData, static_cast<const uint8_t*> (msg.data ()), msg.size ());
+}
+
+bool
+OpenGymShmTransport::Receive (zmq::message_t &msg, int timeoutMs)
+{
+  NS_LOG_FUNCTION (this << timeoutMs);
+  if (!m_rxRing)
+    {
+      return false;
+    }
+  if (timeoutMs >= 0 && !m_rxMore)
+    {
+      uint64_t head = __atomic_load_n (&m_rxRing->head, __ATOMIC_ACQUIRE);
+      if (head == __atomic_load_n (&m_rxRing->tail, __ATOMIC_RELAXED)
+          && (timeoutMs == 0 || !WaitForChange (&m_rxRing->head, head, &m_rxRing->dataSeq,
+                                                &m_rxRing->readerWaiting, m_peerPid, timeoutMs)))
+        {
+          // the next Send fails if the peer is gone
+          PeerExited ();
+          return false;
+        }
+    }
+  uint32_t header[2];
+  if (!Read (m_rxRing, m_rxData, reinterpret_cast<uint8_t*> (header), sizeof (header)))
+    {
+      return false;
+    }
+  msg.rebuild (header[0]);
+  if (!Read (m_rxRing, m_rxData, static_cast<uint8_t*> (msg.data ()), header[0]))
+    {
+      return false;
+    }
+  m_rxMore = (header[1] & SHM_RECORD_MORE) != 0;
+  return true;
+}
+
+}
@@ -0,0 +1,105 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+#ifndef OPENGYM_SHM_H
+#define OPENGYM_SHM_H
+
+#include "ns3/nstime.h"
+#include "opengym_transport.h"
+
+namespace ns3 {
+
+/**
+ * Shared-memory transport between the simulation and the Python agent,
+ * selected with a shm://<segment name> endpoint.
+ *
+ * The segment holds two single-producer/single-consumer byte rings, one
+ * for messages sent by the simulation (SimInitMsg, EnvStateMsg) and one
+ * for messages sent by the agent (SimInitAck, EnvActMsg). Each message is
+ * framed by an 8 byte record header (uint32 size, uint32 flags) and is
+ * streamed through the ring, so messages larger than the ring are fine.
+ * Flag bit 0 (MORE) marks a frame followed by further frames of the same
+ * message.
+ * Readers block on a futex word that the writer bumps after publishing.
+ *
+ * Segment layout (all integers little-endian, must match ns3gym/shm.py):
+ *   0    uint32 magic, uint32 version, uint64 ring capacity,
+ *        uint32 creator pid, uint32 attacher pid             (64 bytes)
+ *   64   ring 0 control block (sim -> agent)                 (192 bytes)
+ *   256  ring 0 data
+ *   ...  ring 1 control block (agent -> sim), ring 1 data
+ * Control block: uint64 head @0, uint64 tail @64, uint32 dataSeq @128,
+ * uint32 readerWaiting @132, uint32 spaceSeq @136, uint32 writerWaiting @140.
+ *
+ * The creator stores its pid first and the magic last. A segment whose
+ * creator has exited is stale and is removed and recreated by the next
+ * process; the owner unlinks the segment on Close. Blocked reads and
+ * writes poll the other pid every few milliseconds and fail once that
+ * process has exited.
+ */
+class OpenGymShmTransport : public OpenGymTransport
+{
+public:
+  OpenGymShmTransport ();
+  virtual ~OpenGymShmTransport ();
+
+  static TypeId GetTypeId ();
+
+  virtual bool Connect (std::string endpoint);
+  virtual void Close ();
+
+  virtual bool Send (zmq::message_t &msg, bool more = false);
+  virtual bool Receive (zmq::message_t &msg, int timeoutMs = -1);
+
+  bool Open (std::string name, uint64_t ringCapacity);
+
+protected:
+  // Inherited
+  virtual void DoDispose (void);
+
+private:
+  struct RingCtrl;
+
+  bool Write (RingCtrl *ring, uint8_t *data, const uint8_t *src, uint64_t size);
+  bool Read (RingCtrl *ring, uint8_t *data, uint8_t *dst, uint64_t size);
+  // whether the peer process has exited, remembered once seen
+  bool PeerExited ();
+
+  std::string m_name;
+  uint64_t m_ringCapacity;
+  Time m_attachTimeout;
+  int m_fd;
+  bool m_owner;
+  uint8_t *m_base;
+  uint64_t m_mapSize;
+  uint64_t m_capacity;
+
+  RingCtrl *m_txRing;
+  uint8_t *m_txData;
+  RingCtrl *m_rxRing;
+  uint8_t *m_rxData;
+  uint32_t *m_peerPid;
+  bool m_peerExited;
+};
+
+} // end of namespace ns3
+
+#endif /* OPENGYM_SHM_H */
@@ -0,0 +1,437 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include "ns3/log.h"
+#include "opengym_transport.h"
+#include "opengym_shm.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("OpenGymTransport");
+
+NS_OBJECT_ENSURE_REGISTERED (OpenGymTransport);
+NS_OBJECT_ENSURE_REGISTERED (OpenGymZmqTransport);
+NS_OBJECT_ENSURE_REGISTERED (OpenGymZmqPublisher);
+
+namespace {
+
+struct SharedTransport
+{
+  Ptr<OpenGymTransport> transport;
+  uint32_t users;
+};
+
+// multiplexed transports by endpoint
+std::map<std::string, SharedTransport> &
+SharedTransports ()
+{
+  static std::map<std::string, SharedTransport> transports;
+  return transports;
+}
+
+} // anonymous namespace
+
+
+TypeId
+OpenGymTransport::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::OpenGymTransport")
+    .SetParent<Object> ()
+    .SetGroupName ("OpenGym")
+    ;
+  return tid;
+}
+
+OpenGymTransport::OpenGymTransport ()
+  : m_rxMore (false)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+OpenGymTransport::~OpenGymTransport ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+OpenGymTransport::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+void
+OpenGymTransport::DoInitialize (void)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+Ptr<OpenGymTransport>
+OpenGymTransport::Create (std::string endpoint)
+{
+  NS_LOG_FUNCTION (endpoint);
+  Ptr<OpenGymTransport> transport;
+
+  std::string scheme = endpoint.substr (0, endpoint.find ("://"));
+  if (scheme == "shm")
+    {
+      transport = CreateObject<OpenGymShmTransport> ();
+    }
+  else if (scheme == "tcp" || scheme == "ipc" || scheme == "inproc")
+    {
+      transport = CreateObject<OpenGymZmqTransport> ();
+    }
+  else
+    {
+      NS_LOG_ERROR ("Unsupported OpenGym endpoint: " << endpoint);
+    }
+  return transport;
+}
+
+Ptr<OpenGymTransport>
+OpenGymTransport::GetShared (std::string endpoint)
+{
+  NS_LOG_FUNCTION (endpoint);
+  std::map<std::string, SharedTransport> &transports = SharedTransports ();
+
+  std::map<std::string, SharedTransport>::iterator it = transports.find (endpoint);
+  if (it == transports.end ())
+    {
+      Ptr<OpenGymTransport> created = Create (endpoint);
+      if (!created || !created->Connect (endpoint))
+        {
+          return 0;
+        }
+      it = transports.insert (std::make_pair (endpoint, SharedTransport {created, 0})).first;
+    }
+  it->second.users++;
+  return it->second.transport;
+}
+
+void
+OpenGymTransport::ReleaseShared (Ptr<OpenGymTransport> transport)
+{
+  NS_LOG_FUNCTION (transport);
+  std::map<std::string, SharedTransport> &transports = SharedTransports ();
+
+  std::map<std::string, SharedTransport>::iterator it = transports.find (transport->GetEndpoint ());
+  if (it == transports.end () || it->second.transport != transport)
+    {
+      return;
+    }
+  if (--it->second.users == 0)
+    {
+      transports.erase (it);
+      transport->Dispose ();
+    }
+}
+
+std::string
+OpenGymTransport::GetEndpoint ()
+{
+  return m_endpoint;
+}
+
+bool
+OpenGymTransport::More () const
+{
+  return m_rxMore;
+}
+
+bool
+OpenGymTransport::SendTo (uint32_t envId, uint32_t msgType, zmq::message_t &msg, bool more)
+{
+  NS_LOG_FUNCTION (this << envId << msgType << msg.size () << more);
+  uint8_t envelope[8] = {static_cast<uint8_t> (envId), static_cast<uint8_t> (envId >> 8),
+                         static_cast<uint8_t> (envId >> 16), static_cast<uint8_t> (envId >> 24),
+                         static_cast<uint8_t> (msgType), static_cast<uint8_t> (msgType >> 8),
+                         static_cast<uint8_t> (msgType >> 16), static_cast<uint8_t> (msgType >> 24)};
+  zmq::message_t envelopeFrame (envelope, sizeof (envelope));
+  return Send (envelopeFrame, true) && Send (msg, more);
+}
+
+bool
+OpenGymTransport::ReceiveEnvelope (zmq::message_t &msg, uint32_t &envId, int timeoutMs)
+{
+  zmq::message_t idFrame;
+  if (!Receive (idFrame, timeoutMs))
+    {
+      return false;
+    }
+  if (idFrame.size () != 8 || !More ())
+    {
+      NS_LOG_ERROR ("Dropping message without env id envelope");
+      while (More ())
+        {
+          Receive (idFrame);
+        }
+      return false;
+    }
+  const uint8_t *id = static_cast<const uint8_t*> (idFrame.data ());
+  envId = id[0] | (id[1] << 8) | (id[2] << 16) | (static_cast<uint32_t> (id[3]) << 24);
+  return Receive (msg);
+}
+
+bool
+OpenGymTransport::ReceiveFrom (uint32_t envId, zmq::message_t &msg, int timeoutMs)
+{
+  NS_LOG_FUNCTION (this << envId << timeoutMs);
+  std::deque<zmq::message_t> &queue = m_envQueues[envId];
+  if (!queue.empty ())
+    {
+      msg = std::move (queue.front ());
+      queue.pop_front ();
+      return true;
+    }
+
+  auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeoutMs);
+  int remaining = timeoutMs;
+  while (true)
+    {
+      zmq::message_t rx;
+      uint32_t rxEnvId;
+      if (ReceiveEnvelope (rx, rxEnvId, remaining))
+        {
+          if (rxEnvId == envId)
+            {
+              msg = std::move (rx);
+              return true;
+            }
+          NS_LOG_DEBUG ("Queue message for env " << rxEnvId);
+          m_envQueues[rxEnvId].push_back (std::move (rx));
+        }
+      else if (remaining == 0)
+        {
+          return false;
+        }
+
+      if (timeoutMs > 0)
+        {
+          auto left = std::chrono::duration_cast<std::chrono::milliseconds> (deadline - std::chrono::steady_clock::now ());
+          remaining = std::max<int> (0, left.count ());
+        }
+    }
+}
+
+
+TypeId
+OpenGymZmqTransport::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::OpenGymZmqTransport")
+    .SetParent<OpenGymTransport> ()
+    .SetGroupName ("OpenGym")
+    .AddConstructor<OpenGymZmqTransport> ()
+    ;
+  return tid;
+}
+
+std::shared_ptr<zmq::context_t>
+OpenGymZmqTransport::GetContext ()
+{
+  // held by the sockets using it, so it is terminated after the last one
+  // is closed and never from a static destructor
+  static std::weak_ptr<zmq::context_t> shared;
+  std::shared_ptr<zmq::context_t> context = shared.lock ();
+  if (!context)
+    {
+      context = std::make_shared<zmq::context_t> (1);
+      shared = context;
+    }
+  return context;
+}
+
+OpenGymZmqTransport::OpenGymZmqTransport ()
+  : m_context (GetContext ()),
+    m_zmq_socket (*m_context, ZMQ_DEALER),
+    m_connected (false),
+    m_txMore (false)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+OpenGymZmqTransport::~OpenGymZmqTransport ()
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+}
+
+void
+OpenGymZmqTransport::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+  OpenGymTransport::DoDispose ();
+}
+
+bool
+OpenGymZmqTransport::Connect (std::string endpoint)
+{
+  NS_LOG_FUNCTION (this << endpoint);
+  m_endpoint = endpoint;
+  if (zmq_connect ((void*)m_zmq_socket, endpoint.c_str ()) != 0)
+    {
+      NS_LOG_ERROR ("Cannot connect to " << endpoint << ": " << zmq_strerror (zmq_errno ()));
+      return false;
+    }
+  m_connected = true;
+  return true;
+}
+
+void
+OpenGymZmqTransport::Close ()
+{
+  NS_LOG_FUNCTION (this);
+  if (m_connected)
+    {
+      int linger = 0;
+      zmq_setsockopt ((void*)m_zmq_socket, ZMQ_LINGER, &linger, sizeof (linger));
+      m_zmq_socket.close ();
+      m_connected = false;
+    }
+}
+
+bool
+OpenGymZmqTransport::Send (zmq::message_t &msg, bool more)
+{
+  NS_LOG_FUNCTION (this << msg.size () << more);
+  if (!m_txMore)
+    {
+      zmq::message_t delimiter;
+      m_zmq_socket.send (delimiter, zmq::send_flags::sndmore);
+    }
+  m_txMore = more;
+  return m_zmq_socket.send (msg, more ? zmq::send_flags::sndmore : zmq::send_flags::none).has_value ();
+}
+
+bool
+OpenGymZmqTransport::Receive (zmq::message_t &msg, int timeoutMs)
+{
+  NS_LOG_FUNCTION (this << timeoutMs);
+  if (m_rxMore)
+    {
+      // rest of a multipart message, already queued by ZMQ
+      m_zmq_socket.recv (msg, zmq::recv_flags::none);
+      m_rxMore = msg.more ();
+      return true;
+    }
+  if (timeoutMs >= 0)
+    {
+      zmq_pollitem_t item = {(void*)m_zmq_socket, 0, ZMQ_POLLIN, 0};
+      if (zmq_poll (&item, 1, timeoutMs) <= 0)
+        {
+          return false;
+        }
+    }
+
+  // skip the empty delimiter frame in front of the payload
+  do
+    {
+      if (!m_zmq_socket.recv (msg, zmq::recv_flags::none).has_value ())
+        {
+          return false;
+        }
+    }
+  while (msg.size () == 0 && msg.more ());
+  m_rxMore = msg.more ();
+  return true;
+}
+
+
+
+TypeId
+OpenGymZmqPublisher::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::OpenGymZmqPublisher")
+    .SetParent<Object> ()
+    .SetGroupName ("OpenGym")
+    .AddConstructor<OpenGymZmqPublisher> ()
+    ;
+  return tid;
+}
+
+OpenGymZmqPublisher::OpenGymZmqPublisher ()
+  : m_context (OpenGymZmqTransport::GetContext ()),
+    m_zmq_socket (*m_context, ZMQ_PUB),
+    m_bound (false)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+OpenGymZmqPublisher::~OpenGymZmqPublisher ()
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+}
+
+void
+OpenGymZmqPublisher::DoDispose (void)
+{
+  NS_LOG_FUNCTION (this);
+  Close ();
+  Object::DoDispose ();
+}
+
+bool
+OpenGymZmqPublisher::Bind (std::string endpoint, int highWaterMark)
+{
+  NS_LOG_FUNCTION (this << endpoint << highWaterMark);
+  zmq_setsockopt ((void*)m_zmq_socket, ZMQ_SNDHWM, &highWaterMark, sizeof (highWaterMark));
+  if (zmq_bind ((void*)m_zmq_socket, endpoint.c_str ()) != 0)
+    {
+      NS_LOG_ERROR ("Cannot bind telemetry to " << endpoint << ": " << zmq_strerror (zmq_errno ()));
+      return false;
+    }
+  m_bound = true;
+  return true;
+}
+
+void
+OpenGymZmqPublisher::Close ()
+{
+  NS_LOG_FUNCTION (this);
+  if (m_bound)
+    {
+      int linger = 0;
+      zmq_setsockopt ((void*)m_zmq_socket, ZMQ_LINGER, &linger, sizeof (linger));
+      m_zmq_socket.close ();
+      m_bound = false;
+    }
+}
+
+bool
+OpenGymZmqPublisher::Publish (const std::string &topic, zmq::message_t &msg)
+{
+  NS_LOG_FUNCTION (this << topic << msg.size ());
+  if (!m_bound)
+    {
+      return false;
+    }
+  zmq::message_t topicFrame (topic.data (), topic.size ());
+  if (!m_zmq_socket.send (topicFrame, zmq::send_flags::sndmore | zmq::send_flags::dontwait).has_value ())
+    {
+      return false;
+    }
+  return m_zmq_socket.send (msg, zmq::send_flags::dontwait).has_value ();
+}
+
+}
@@ -0,0 +1,173 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2018 Piotr Gawlowicz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Piotr Gawlowicz <gawlowicz.p@gmail.com>
+ *
+ */
+
+#ifndef OPENGYM_TRANSPORT_H
+#define OPENGYM_TRANSPORT_H
+
+#include "ns3/object.h"
+#include <deque>
+#include <map>
+#include <memory>
+#include <zmq.hpp>
+
+namespace ns3 {
+
+/**
+ * Message transport between OpenGymInterface and the Python agent.
+ *
+ * The transport is picked from the scheme of the endpoint string:
+ * tcp://, ipc:// and inproc:// use a ZMQ socket, shm:// uses a
+ * shared-memory ring (see OpenGymShmTransport).
+ */
+class OpenGymTransport : public Object
+{
+public:
+  OpenGymTransport ();
+  virtual ~OpenGymTransport ();
+
+  static TypeId GetTypeId ();
+
+  static Ptr<OpenGymTransport> Create (std::string endpoint);
+  /**
+   * Connected transport shared by all multiplexed interfaces using the
+   * same endpoint, created on first use. Every call has to be matched by
+   * a ReleaseShared, the last one closes the transport.
+   */
+  static Ptr<OpenGymTransport> GetShared (std::string endpoint);
+  static void ReleaseShared (Ptr<OpenGymTransport> transport);
+
+  virtual bool Connect (std::string endpoint) = 0;
+  virtual void Close () = 0;
+
+  /**
+   * Send one frame. With more set, the next frame belongs to the same
+   * message and is delivered together with this one.
+   */
+  virtual bool Send (zmq::message_t &msg, bool more = false) = 0;
+  /**
+   * Receive the next frame. With timeoutMs >= 0 give up after that many
+   * milliseconds (0 only polls) and return false; -1 blocks. The timeout
+   * applies to the first frame of a message only.
+   */
+  virtual bool Receive (zmq::message_t &msg, int timeoutMs = -1) = 0;
+  /**
+   * \return true if the last received frame is followed by more frames of
+   * the same message
+   */
+  bool More () const;
+
+  /**
+   * Send msg behind an envelope frame holding the env id and the
+   * ns3opengym::MsgType of the message (uint32 each, little-endian), used
+   * when several environments share the transport. With more set, further
+   * frames of the message follow with Send.
+   */
+  bool SendTo (uint32_t envId, uint32_t msgType, zmq::message_t &msg, bool more = false);
+  /**
+   * Receive the next message addressed to envId. Messages for other
+   * environments are queued until they ask for them.
+   */
+  bool ReceiveFrom (uint32_t envId, zmq::message_t &msg, int timeoutMs = -1);
+
+  std::string GetEndpoint ();
+
+protected:
+  // Inherited
+  virtual void DoInitialize (void);
+  virtual void DoDispose (void);
+
+  std::string m_endpoint;
+  bool m_rxMore;
+
+private:
+  bool ReceiveEnvelope (zmq::message_t &msg, uint32_t &envId, int timeoutMs);
+
+  std::map<uint32_t, std::deque<zmq::message_t> > m_envQueues;
+};
+
+
+class OpenGymZmqTransport : public OpenGymTransport
+{
+public:
+  OpenGymZmqTransport ();
+  virtual ~OpenGymZmqTransport ();
+
+  static TypeId GetTypeId ();
+
+  /**
+   * Process-wide ZMQ context. An agent living in the same process has to
+   * bind its socket on this context to be reachable over inproc://. The
+   * context is terminated once the last holder drops it.
+   */
+  static std::shared_ptr<zmq::context_t> GetContext ();
+
+  virtual bool Connect (std::string endpoint);
+  virtual void Close ();
+
+  virtual bool Send (zmq::message_t &msg, bool more = false);
+  virtual bool Receive (zmq::message_t &msg, int timeoutMs = -1);
+
+protected:
+  // Inherited
+  virtual void DoDispose (void);
+
+private:
+  // DEALER with an empty delimiter frame talks to the agent's REP or
+  // ROUTER socket without enforcing strict send/receive alternation
+  std::shared_ptr<zmq::context_t> m_context;
+  zmq::socket_t m_zmq_socket;
+  bool m_connected;
+  bool m_txMore;
+};
+
+
+/**
+ * ZMQ PUB socket for the telemetry side channel. Sending never blocks:
+ * once a subscriber has HighWaterMark messages queued, further messages
+ * for it are dropped.
+ */
+class OpenGymZmqPublisher : public Object
+{
+public:
+  OpenGymZmqPublisher ();
+  virtual ~OpenGymZmqPublisher ();
+
+  static TypeId GetTypeId ();
+
+  bool Bind (std::string endpoint, int highWaterMark);
+  void Close ();
+
+  // send msg with a topic frame in front for subscription filtering
+  bool Publish (const std::string &topic, zmq::message_t &msg);
+
+protected:
+  // Inherited
+  virtual void DoDispose (void);
+
+private:
+  std::shared_ptr<zmq::context_t> m_context;
+  zmq::socket_t m_zmq_socket;
+  bool m_bound;
+};
+
+} // end of namespace ns3
+
+#endif /* OPENGYM_TRANSPORT_H */
@@ -22,6 +22,7 @@
 #include "ns3/object.h"
 #include "ns3/log.h"
 #include "spaces.h"
+#include "container.h"
 
 namespace ns3 {
 
@@ -138,20 +139,22 @@ OpenGymBoxSpace::GetTypeId (void)
   return tid;
 }
 
-OpenGymBoxSpace::OpenGymBoxSpace ()
+OpenGymBoxSpace::OpenGymBoxSpace ():
+  m_quantizedDtype(ns3opengym::NoDType)
 {
   NS_LOG_FUNCTION (this);
 }
 
 OpenGymBoxSpace::OpenGymBoxSpace (float low, float high, std::vector<uint32_t> shape, std::string dtype):
-  m_low(low), m_high(high), m_shape(shape), m_dtypeName(dtype)
+  m_low(low), m_high(high), m_shape(shape), m_dtypeName(dtype), m_quantizedDtype(ns3opengym::NoDType)
 {
   NS_LOG_FUNCTION (this);
   SetDtype ();
 }
 
 OpenGymBoxSpace::OpenGymBoxSpace (std::vector<float> low, std::vector<float> high, std::vector<uint32_t> shape, std::string dtype):
-  m_low(0), m_high(0), m_shape(shape), m_dtypeName(dtype), m_lowVec(low), m_highVec(high)
+  m_low(0), m_high(0), m_shape(shape), m_dtypeName(dtype), m_lowVec(low), m_highVec(high),
+  m_quantizedDtype(ns3opengym::NoDType)
 
 {
   NS_LOG_FUNCTION (this);
@@ -179,10 +182,26 @@ void
 OpenGymBoxSpace::SetDtype ()
 {
   std::string name = m_dtypeName;
-  if (name == "int8_t" || name == "int16_t" || name == "int32_t" || name == "int64_t")
+  if (name == "int8_t")
+    m_dtype = ns3opengym::INT8;
+  else if (name == "int16_t")
+    m_dtype = ns3opengym::INT16;
+  else if (name == "int32_t")
     m_dtype = ns3opengym::INT;
-  else if (name == "uint8_t" || name == "uint16_t" || name == "uint32_t" || name == "uint64_t")
+  else if (name == "int64_t")
+    m_dtype = ns3opengym::INT64;
+  else if (name == "uint8_t")
+    m_dtype = ns3opengym::UINT8;
+  else if (name == "uint16_t")
+    m_dtype = ns3opengym::UINT16;
+  else if (name == "uint32_t")
     m_dtype = ns3opengym::UINT;
+  else if (name == "uint64_t")
+    m_dtype = ns3opengym::UINT64;
+  else if (name == "bool")
+    m_dtype = ns3opengym::BOOL;
+  else if (name == "float16")
+    m_dtype = ns3opengym::FLOAT16;
   else if (name == "float")
     m_dtype = ns3opengym::FLOAT;
   else if (name == "double")
@@ -212,6 +231,43 @@ OpenGymBoxSpace::GetShape()
   return m_shape;
 }
 
+bool
+OpenGymBoxSpace::SetQuantization(std::string dtype, std::vector<float> scale, std::vector<float> offset)
+{
+  NS_LOG_FUNCTION (this << dtype);
+  uint32_t count = 1;
+  for (uint32_t dim : m_shape) {
+    count *= dim;
+  }
+  bool sizesOk = (scale.size() == 1 || scale.size() == count) && (offset.size() == 1 || offset.size() == count);
+  if (!sizesOk || (dtype != "uint8" && dtype != "uint16")) {
+    NS_LOG_WARN("Unsupported quantization " << dtype << " with " << scale.size() << " scales, "
+                << offset.size() << " offsets for " << count << " elements");
+    return false;
+  }
+  m_quantizedDtype = dtype == "uint8" ? ns3opengym::UINT8 : ns3opengym::UINT16;
+  m_scale = scale;
+  m_offset = offset;
+  return true;
+}
+
+bool
+OpenGymBoxSpace::SetQuantization(std::string dtype)
+{
+  NS_LOG_FUNCTION (this << dtype);
+  float steps = dtype == "uint8" ? 255 : 65535;
+  std::vector<float> low = m_lowVec.empty() ? std::vector<float> {m_low} : m_lowVec;
+  std::vector<float> high = m_highVec.empty() ? std::vector<float> {m_high} : m_highVec;
+  if (low.size() != high.size()) {
+    return false;
+  }
+  std::vector<float> scale;
+  for (size_t i = 0; i < low.size(); ++i) {
+    scale.push_back((high[i] - low[i]) / steps);
+  }
+  return SetQuantization(dtype, scale, low);
+}
+
 ns3opengym::SpaceDescription
 OpenGymBoxSpace::GetSpaceDescription()
 {
@@ -229,7 +285,14 @@ OpenGymBoxSpace::GetSpaceDescription()
     boxSpacePb.add_shape(*i);
   }
 
-  boxSpacePb.set_dtype(m_dtype);
+  // agents before protocol v4 only read dtype
+  boxSpacePb.set_dtype(OpenGymLegacyDtype(m_dtype));
+  boxSpacePb.set_exactdtype(m_dtype);
+  if (m_quantizedDtype != ns3opengym::NoDType) {
+    boxSpacePb.set_quantizeddtype(m_quantizedDtype);
+    *boxSpacePb.mutable_scale() = {m_scale.begin(), m_scale.end()};
+    *boxSpacePb.mutable_offset() = {m_offset.begin(), m_offset.end()};
+  }
   desc.mutable_space()->PackFrom(boxSpacePb);
   return desc;
 }
@@ -348,6 +411,7 @@ OpenGymDictSpace::GetTypeId (void)
 }
 
 OpenGymDictSpace::OpenGymDictSpace ()
+  : m_keys (Create<OpenGymDictKeys> (true))
 {
   NS_LOG_FUNCTION (this);
 }
@@ -373,7 +437,15 @@ bool
 OpenGymDictSpace::Add(std::string key, Ptr<OpenGymSpace> space)
 {
   NS_LOG_FUNCTION (this);
-  m_dict.insert(std::pair<std::string, Ptr<OpenGymSpace> > (key, space));
+  if (m_keys->Find(key) != m_keys->GetSize()) {
+    return true;
+  }
+  // containers keep the keys they were given
+  if (m_keys->GetReferenceCount() > 1) {
+    m_keys = Create<OpenGymDictKeys> (*m_keys, true);
+  }
+  uint32_t id = m_keys->Insert(key);
+  m_dict.insert(m_dict.begin() + id, space);
   return true;
 }
 
@@ -381,15 +453,25 @@ Ptr<OpenGymSpace>
 OpenGymDictSpace::Get(std::string key)
 {
   NS_LOG_FUNCTION (this);
+  return Get(m_keys->Find(key));
+}
+
+Ptr<OpenGymSpace>
+OpenGymDictSpace::Get(uint32_t id)
+{
   Ptr<OpenGymSpace> space;
-  std::map< std::string, Ptr<OpenGymSpace> >::iterator it = m_dict.find(key);
-  if ( it != m_dict.end() ) {
-    space = it->second;
+  if (id < m_dict.size()) {
+    space = m_dict[id];
   }
-
   return space;
 }
 
+Ptr<OpenGymDictKeys>
+OpenGymDictSpace::GetKeys()
+{
+  return m_keys;
+}
+
 ns3opengym::SpaceDescription
 OpenGymDictSpace::GetSpaceDescription()
 {
@@ -399,11 +481,11 @@ OpenGymDictSpace::GetSpaceDescription()
 
   ns3opengym::DictSpace dictSpacePb;
 
-  std::map< std::string, Ptr<OpenGymSpace> >::iterator it;
-  for (it=m_dict.begin(); it!=m_dict.end(); ++it)
+  // in key id order, the ids of CAP_DICT_KEY_IDS
+  for (uint32_t id = 0; id < m_dict.size(); ++id)
   {
-    std::string name = it->first;
-    Ptr<OpenGymSpace> subSpace = it->second;
+    std::string name = m_keys->GetName(id);
+    Ptr<OpenGymSpace> subSpace = m_dict[id];
 
     ns3opengym::SpaceDescription subDesc = subSpace->GetSpaceDescription();
     subDesc.set_name(name);
@@ -420,12 +502,10 @@ OpenGymDictSpace::Print(std::ostream& where) const
 {
   where << " DictSpace: " << std::endl;
 
-  std::map< std::string, Ptr<OpenGymSpace> > myMap = m_dict;
-  std::map< std::string, Ptr<OpenGymSpace> >::iterator it;
-  for (it=myMap.begin(); it!=myMap.end(); ++it)
+  for (uint32_t id = 0; id < m_dict.size(); ++id)
   {
-    where << "---" << it->first << ":";
-    it->second->Print(where);
+    where << "---" << m_keys->GetName(id) << ":";
+    m_dict[id]->Print(where);
     where << std::endl;
   }
 }
@@ -27,6 +27,8 @@
 
 namespace ns3 {
 
+class OpenGymDictKeys;
+
 class OpenGymSpace : public Object
 {
 public:
@@ -76,6 +78,9 @@ class OpenGymBoxSpace : public OpenGymSpace
 {
 public:
   OpenGymBoxSpace ();
+  // dtype is the TypeNameGet of the element type, sent as exactDtype;
+  // "float16" is receive-only: actions arrive as float16 and are decoded
+  // to float, observations are sent as the dtype of their container
   OpenGymBoxSpace (float low, float high, std::vector<uint32_t> shape, std::string dtype);
   OpenGymBoxSpace (std::vector<float> low, std::vector<float> high, std::vector<uint32_t> shape, std::string dtype);
   virtual ~OpenGymBoxSpace ();
@@ -88,6 +93,13 @@ public:
   float GetHigh();
   std::vector<uint32_t> GetShape();
 
+  // send packed observations (protocol v9) as "uint8" or "uint16" values
+  // q ~ (value - offset) / scale, one scale/offset for all elements or one
+  // per element; false for other dtypes or sizes
+  bool SetQuantization(std::string dtype, std::vector<float> scale, std::vector<float> offset);
+  // scale and offset spanning low to high
+  bool SetQuantization(std::string dtype);
+
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymBoxSpace> space)
   {
@@ -111,6 +123,9 @@ private:
   std::vector<float> m_highVec;
 
   ns3opengym::Dtype m_dtype;
+  ns3opengym::Dtype m_quantizedDtype;
+  std::vector<float> m_scale;
+  std::vector<float> m_offset;
 };
 
 
@@ -156,6 +171,10 @@ public:
 
   bool Add(std::string key, Ptr<OpenGymSpace> value);
   Ptr<OpenGymSpace> Get(std::string key);
+  Ptr<OpenGymSpace> Get(uint32_t id);
+  // keys interned by Add, to be shared with the Dict containers of this
+  // space once all keys are added
+  Ptr<OpenGymDictKeys> GetKeys();
 
   virtual void Print(std::ostream& where) const;
   friend std::ostream& operator<< (std::ostream& os, const Ptr<OpenGymDictSpace> space)
@@ -170,7 +189,9 @@ protected:
   virtual void DoDispose (void);
 
 private:
-  std::map< std::string, Ptr<OpenGymSpace> > m_dict;
+  Ptr<OpenGymDictKeys> m_keys;
+  // one per key in id order
+  std::vector< Ptr<OpenGymSpace> > m_dict;
 };
 
 } // end of namespace ns3
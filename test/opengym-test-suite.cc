@@ -1,55 +1,2079 @@
 /* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
 
-// Include a header file from your module to test.
-//#include "ns3/opengym-module.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 
-// An essential include is test.h
 #include "ns3/test.h"
+#include "ns3/opengym_shm.h"
+#include "ns3/opengym_interface.h"
+#include "ns3/container.h"
+#include "ns3/spaces.h"
+#include "ns3/string.h"
+#include "ns3/boolean.h"
+#include "ns3/uinteger.h"
+#include "ns3/enum.h"
+#include "ns3/nstime.h"
+#include "ns3/opengym_transport.h"
+#include "ns3/opengym_layout.h"
+#include "ns3/opengym_delta.h"
+#include "ns3/opengym_schema.h"
 
 // Do not put your test classes in namespace ns3.  You may find it useful
 // to use the using directive to access the ns3 namespace directly
 using namespace ns3;
 
-// This is an example TestCase.
-class OpengymTestCase1 : public TestCase
+/**
+ * Agent end of a shared-memory segment, written against the layout
+ * documented in opengym_shm.h (the one ns3gym/shm.py implements). It never
+ * blocks: Read fails if the bytes are not in the ring yet.
+ */
+class ShmAgentEnd
 {
 public:
-  OpengymTestCase1 ();
-  virtual ~OpengymTestCase1 ();
+  ShmAgentEnd ();
+  ~ShmAgentEnd ();
+
+  bool Map (std::string name);
+  void SendFrame (const std::string &data, bool more);
+  bool ReceiveFrame (std::string &data, bool &more);
+
+private:
+  static const uint64_t HEADER_SIZE = 64;
+  static const uint64_t RING_CTRL_SIZE = 192;
+
+  void Write (const uint8_t *src, uint64_t size);
+  bool Read (uint8_t *dst, uint64_t size);
+
+  uint8_t *m_base;
+  uint64_t m_mapSize;
+  uint64_t m_capacity;
+  uint8_t *m_rxRing;  // ring 0, sim -> agent
+  uint8_t *m_txRing;  // ring 1, agent -> sim
+};
+
+ShmAgentEnd::ShmAgentEnd ()
+  : m_base (nullptr),
+    m_mapSize (0),
+    m_capacity (0),
+    m_rxRing (nullptr),
+    m_txRing (nullptr)
+{
+}
+
+ShmAgentEnd::~ShmAgentEnd ()
+{
+  if (m_base)
+    {
+      munmap (m_base, m_mapSize);
+    }
+}
+
+bool
+ShmAgentEnd::Map (std::string name)
+{
+  int fd = shm_open (name.c_str (), O_RDWR, 0600);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  fstat (fd, &st);
+  m_mapSize = st.st_size;
+  void *addr = mmap (nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (addr == MAP_FAILED)
+    {
+      return false;
+    }
+  m_base = static_cast<uint8_t*> (addr);
+  std::memcpy (&m_capacity, m_base + 8, sizeof (m_capacity));
+  m_rxRing = m_base + HEADER_SIZE;
+  m_txRing = m_rxRing + RING_CTRL_SIZE + m_capacity;
+  return true;
+}
+
+void
+ShmAgentEnd::Write (const uint8_t *src, uint64_t size)
+{
+  uint64_t *head = reinterpret_cast<uint64_t*> (m_txRing);
+  uint8_t *data = m_txRing + RING_CTRL_SIZE;
+  uint64_t pos = __atomic_load_n (head, __ATOMIC_RELAXED);
+  for (uint64_t i = 0; i < size; ++i)
+    {
+      data[(pos + i) % m_capacity] = src[i];
+    }
+  __atomic_store_n (head, pos + size, __ATOMIC_RELEASE);
+}
+
+bool
+ShmAgentEnd::Read (uint8_t *dst, uint64_t size)
+{
+  uint64_t *head = reinterpret_cast<uint64_t*> (m_rxRing);
+  uint64_t *tail = reinterpret_cast<uint64_t*> (m_rxRing + 64);
+  uint8_t *data = m_rxRing + RING_CTRL_SIZE;
+  uint64_t pos = __atomic_load_n (tail, __ATOMIC_RELAXED);
+  if (__atomic_load_n (head, __ATOMIC_ACQUIRE) - pos < size)
+    {
+      return false;
+    }
+  for (uint64_t i = 0; i < size; ++i)
+    {
+      dst[i] = data[(pos + i) % m_capacity];
+    }
+  __atomic_store_n (tail, pos + size, __ATOMIC_RELEASE);
+  return true;
+}
+
+void
+ShmAgentEnd::SendFrame (const std::string &data, bool more)
+{
+  uint32_t header[2] = {static_cast<uint32_t> (data.size ()), more ? 1u : 0u};
+  Write (reinterpret_cast<const uint8_t*> (header), sizeof (header));
+  Write (reinterpret_cast<const uint8_t*> (data.data ()), data.size ());
+}
+
+bool
+ShmAgentEnd::ReceiveFrame (std::string &data, bool &more)
+{
+  uint32_t header[2];
+  if (!Read (reinterpret_cast<uint8_t*> (header), sizeof (header)))
+    {
+      return false;
+    }
+  data.resize (header[0]);
+  more = header[1] & 1;
+  return data.empty () || Read (reinterpret_cast<uint8_t*> (&data[0]), data.size ());
+}
+
+/**
+ * Frames sent through OpenGymShmTransport wrap around the end of a small
+ * ring in both directions, and the MORE flag groups them into messages.
+ */
+class OpenGymShmRingTestCase : public TestCase
+{
+public:
+  OpenGymShmRingTestCase ();
+  virtual ~OpenGymShmRingTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymShmRingTestCase::OpenGymShmRingTestCase ()
+  : TestCase ("Shared-memory ring wrap-around and multipart frames")
+{
+}
+
+OpenGymShmRingTestCase::~OpenGymShmRingTestCase ()
+{
+}
+
+void
+OpenGymShmRingTestCase::DoRun (void)
+{
+  std::string name = "/opengym-test-" + std::to_string (getpid ());
+  Ptr<OpenGymShmTransport> transport = CreateObject<OpenGymShmTransport> ();
+  NS_TEST_ASSERT_MSG_EQ (transport->Open (name, 4096), true, "cannot create " << name);
+
+  ShmAgentEnd agent;
+  NS_TEST_ASSERT_MSG_EQ (agent.Map (name), true, "cannot map " << name);
+
+  // 1000 byte frames do not divide the ring, so records straddle its end
+  for (uint32_t i = 0; i < 20; ++i)
+    {
+      std::string payload (1000, static_cast<char> ('a' + i));
+      zmq::message_t tx (payload.data (), payload.size ());
+      NS_TEST_ASSERT_MSG_EQ (transport->Send (tx), true, "send " << i);
+      std::string rx;
+      bool more;
+      NS_TEST_ASSERT_MSG_EQ (agent.ReceiveFrame (rx, more), true, "agent receive " << i);
+      NS_TEST_ASSERT_MSG_EQ (rx == payload, true, "frame " << i << " corrupted");
+      NS_TEST_ASSERT_MSG_EQ (more, false, "frame " << i << " not the last of its message");
+
+      agent.SendFrame (payload, false);
+      zmq::message_t reply;
+      NS_TEST_ASSERT_MSG_EQ (transport->Receive (reply, 0), true, "receive " << i);
+      NS_TEST_ASSERT_MSG_EQ (reply.to_string () == payload, true, "reply " << i << " corrupted");
+    }
+
+  // a message of three frames, the last one empty
+  const char *parts[] = {"head", "middle", ""};
+  for (uint32_t i = 0; i < 3; ++i)
+    {
+      zmq::message_t tx (parts[i], std::strlen (parts[i]));
+      NS_TEST_ASSERT_MSG_EQ (transport->Send (tx, i < 2), true, "send part " << i);
+    }
+  for (uint32_t i = 0; i < 3; ++i)
+    {
+      std::string rx;
+      bool more;
+      NS_TEST_ASSERT_MSG_EQ (agent.ReceiveFrame (rx, more), true, "agent receive part " << i);
+      NS_TEST_ASSERT_MSG_EQ (rx, parts[i], "part " << i);
+      NS_TEST_ASSERT_MSG_EQ (more, i < 2, "MORE flag of part " << i);
+    }
+
+  agent.SendFrame ("state", true);
+  agent.SendFrame ("chunk", false);
+  zmq::message_t rx;
+  NS_TEST_ASSERT_MSG_EQ (transport->Receive (rx, 0), true, "receive first part");
+  NS_TEST_ASSERT_MSG_EQ (transport->More (), true, "first part not followed by more");
+  NS_TEST_ASSERT_MSG_EQ (transport->Receive (rx, 0), true, "receive second part");
+  NS_TEST_ASSERT_MSG_EQ (rx.to_string (), "chunk", "second part");
+  NS_TEST_ASSERT_MSG_EQ (transport->More (), false, "second part followed by more");
+  NS_TEST_ASSERT_MSG_EQ (transport->Receive (rx, 0), false, "ring not empty");
+
+  transport->Close ();
+  NS_TEST_ASSERT_MSG_EQ (shm_open (name.c_str (), O_RDONLY, 0600), -1, "owner did not unlink " << name);
+}
+
+/**
+ * A segment left behind by a process that has exited is replaced by a
+ * fresh one instead of being attached to.
+ */
+class OpenGymShmStaleTestCase : public TestCase
+{
+public:
+  OpenGymShmStaleTestCase ();
+  virtual ~OpenGymShmStaleTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymShmStaleTestCase::OpenGymShmStaleTestCase ()
+  : TestCase ("Stale shared-memory segment is recreated")
+{
+}
+
+OpenGymShmStaleTestCase::~OpenGymShmStaleTestCase ()
+{
+}
+
+void
+OpenGymShmStaleTestCase::DoRun (void)
+{
+  pid_t dead = fork ();
+  if (dead == 0)
+    {
+      _exit (0);
+    }
+  waitpid (dead, nullptr, 0);
+
+  // formatted segment (magic, version 1, capacity, creator pid) of the exited process
+  std::string name = "/opengym-test-stale-" + std::to_string (getpid ());
+  int fd = shm_open (name.c_str (), O_RDWR | O_CREAT | O_EXCL, 0600);
+  NS_TEST_ASSERT_MSG_NE (fd, -1, "cannot create " << name);
+  uint64_t capacity = 8192;
+  NS_TEST_ASSERT_MSG_EQ (ftruncate (fd, 64 + 2 * (192 + capacity)), 0, "cannot resize " << name);
+  uint32_t header[5] = {0x4733534e /* "NS3G" */, 1, static_cast<uint32_t> (capacity), 0, static_cast<uint32_t> (dead)};
+  NS_TEST_ASSERT_MSG_EQ (pwrite (fd, header, sizeof (header), 0), (ssize_t)sizeof (header), "cannot write header");
+  close (fd);
+
+  Ptr<OpenGymShmTransport> transport = CreateObject<OpenGymShmTransport> ();
+  NS_TEST_ASSERT_MSG_EQ (transport->Open (name, 4096), true, "cannot open " << name);
+
+  ShmAgentEnd agent;
+  NS_TEST_ASSERT_MSG_EQ (agent.Map (name), true, "cannot map " << name);
+  fd = shm_open (name.c_str (), O_RDONLY, 0600);
+  NS_TEST_ASSERT_MSG_EQ (pread (fd, header, sizeof (header), 0), (ssize_t)sizeof (header), "cannot read header");
+  close (fd);
+  NS_TEST_ASSERT_MSG_EQ (header[2], 4096, "stale segment was attached to");
+  NS_TEST_ASSERT_MSG_EQ (header[4], (uint32_t)getpid (), "segment not recreated by this process");
+
+  transport->Close ();
+}
+
+/**
+ * Reads and writes on a segment whose peer process has exited fail instead
+ * of blocking forever.
+ */
+class OpenGymShmPeerExitTestCase : public TestCase
+{
+public:
+  OpenGymShmPeerExitTestCase ();
+  virtual ~OpenGymShmPeerExitTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymShmPeerExitTestCase::OpenGymShmPeerExitTestCase ()
+  : TestCase ("Shared-memory peer exit")
+{
+}
+
+OpenGymShmPeerExitTestCase::~OpenGymShmPeerExitTestCase ()
+{
+}
+
+void
+OpenGymShmPeerExitTestCase::DoRun (void)
+{
+  std::string name = "/opengym-test-peer-" + std::to_string (getpid ());
+  Ptr<OpenGymShmTransport> transport = CreateObject<OpenGymShmTransport> ();
+  NS_TEST_ASSERT_MSG_EQ (transport->Open (name, 4096), true, "cannot open " << name);
+
+  // a peer that attaches and exits without sending anything
+  pid_t peer = fork ();
+  if (peer == 0)
+    {
+      Ptr<OpenGymShmTransport> attached = CreateObject<OpenGymShmTransport> ();
+      _exit (attached->Connect ("shm://" + name) ? 0 : 1);
+    }
+  int status = -1;
+  waitpid (peer, &status, 0);
+  NS_TEST_ASSERT_MSG_EQ (status, 0, "peer cannot attach");
+
+  zmq::message_t rx;
+  NS_TEST_ASSERT_MSG_EQ (transport->Receive (rx), false, "blocking receive from an exited peer");
+  NS_TEST_ASSERT_MSG_EQ (transport->Receive (rx, 100), false, "bounded receive from an exited peer");
+  zmq::message_t tx (4);
+  NS_TEST_ASSERT_MSG_EQ (transport->Send (tx), false, "send to an exited peer");
+
+  transport->Close ();
+}
+
+/**
+ * Base of the test cases that drive an OpenGymInterface over a shm://
+ * segment. The replies of the agent are queued in the ring before the
+ * interface waits for them. Observations are a one-element float Box
+ * holding m_value, every step earns a reward of 1, and the values of the
+ * Discrete actions executed are recorded in m_actions.
+ */
+class OpenGymInterfaceTestCase : public TestCase
+{
+public:
+  OpenGymInterfaceTestCase (std::string name);
+  virtual ~OpenGymInterfaceTestCase ();
+
+protected:
+  // interface attached to a fresh segment, to be configured before Start
+  Ptr<OpenGymInterface> CreateInterface (std::string tag);
+  // run the init handshake with ack as the agent's reply
+  void Start (const ns3opengym::SimInitAck &ack, ns3opengym::SimInitMsg *init = nullptr);
+  // queue a message of the agent
+  void Reply (const google::protobuf::Message &msg);
+  void ReplyAction (uint64_t stepIdx, uint32_t action);
+  // next message of the simulation, false if there is none
+  bool Receive (google::protobuf::Message &msg);
+  void Disconnect ();
+
+  Ptr<OpenGymSpace> GetObservationSpace ();
+  Ptr<OpenGymSpace> GetActionSpace ();
+  Ptr<OpenGymDataContainer> GetObservation ();
+  float GetReward ();
+  bool ExecuteActions (Ptr<OpenGymDataContainer> action);
+
+  float m_value;
+  uint32_t m_observations;
+  std::vector<uint32_t> m_actions;
+  Ptr<OpenGymInterface> m_interface;
+  std::unique_ptr<ShmAgentEnd> m_agent;
+
+private:
+  virtual void DoTeardown (void);
+
+  Ptr<OpenGymShmTransport> m_segment; // creates and finally unlinks the segment
+};
+
+OpenGymInterfaceTestCase::OpenGymInterfaceTestCase (std::string name)
+  : TestCase (name),
+    m_value (0),
+    m_observations (0)
+{
+}
+
+OpenGymInterfaceTestCase::~OpenGymInterfaceTestCase ()
+{
+}
+
+Ptr<OpenGymInterface>
+OpenGymInterfaceTestCase::CreateInterface (std::string tag)
+{
+  Disconnect ();
+  std::string name = "/opengym-test-" + tag + "-" + std::to_string (getpid ());
+  m_segment = CreateObject<OpenGymShmTransport> ();
+  if (!m_segment->Open (name, 1 << 16))
+    {
+      return 0;
+    }
+  m_agent.reset (new ShmAgentEnd ());
+  m_agent->Map (name);
+
+  m_value = 0;
+  m_observations = 0;
+  m_actions.clear ();
+  m_interface = CreateObject<OpenGymInterface> ();
+  m_interface->SetAttribute ("Endpoint", StringValue ("shm://" + name));
+  m_interface->SetGetObservationSpaceCb (MakeCallback (&OpenGymInterfaceTestCase::GetObservationSpace, this));
+  m_interface->SetGetActionSpaceCb (MakeCallback (&OpenGymInterfaceTestCase::GetActionSpace, this));
+  m_interface->SetGetObservationCb (MakeCallback (&OpenGymInterfaceTestCase::GetObservation, this));
+  m_interface->SetGetRewardCb (MakeCallback (&OpenGymInterfaceTestCase::GetReward, this));
+  m_interface->SetExecuteActionsCb (MakeCallback (&OpenGymInterfaceTestCase::ExecuteActions, this));
+  return m_interface;
+}
+
+void
+OpenGymInterfaceTestCase::Start (const ns3opengym::SimInitAck &ack, ns3opengym::SimInitMsg *init)
+{
+  Reply (ack);
+  m_interface->Init ();
+  ns3opengym::SimInitMsg initMsg;
+  Receive (init ? *init : initMsg);
+}
+
+void
+OpenGymInterfaceTestCase::Reply (const google::protobuf::Message &msg)
+{
+  m_agent->SendFrame (msg.SerializeAsString (), false);
+}
+
+void
+OpenGymInterfaceTestCase::ReplyAction (uint64_t stepIdx, uint32_t action)
+{
+  Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer> (100);
+  discrete->SetValue (action);
+  ns3opengym::EnvActMsg actMsg;
+  actMsg.set_stepidx (stepIdx);
+  *actMsg.mutable_actdata () = discrete->GetDataContainerPbMsg ();
+  Reply (actMsg);
+}
+
+bool
+OpenGymInterfaceTestCase::Receive (google::protobuf::Message &msg)
+{
+  std::string data;
+  bool more;
+  return m_agent->ReceiveFrame (data, more) && msg.ParseFromString (data);
+}
+
+void
+OpenGymInterfaceTestCase::Disconnect ()
+{
+  if (m_interface)
+    {
+      m_interface->Dispose ();
+      m_interface = 0;
+    }
+  m_agent.reset ();
+  if (m_segment)
+    {
+      m_segment->Close ();
+      m_segment = 0;
+    }
+}
+
+void
+OpenGymInterfaceTestCase::DoTeardown (void)
+{
+  Disconnect ();
+}
+
+Ptr<OpenGymSpace>
+OpenGymInterfaceTestCase::GetObservationSpace ()
+{
+  std::vector<uint32_t> shape = {1};
+  return CreateObject<OpenGymBoxSpace> (-100, 100, shape, TypeNameGet<float> ());
+}
+
+Ptr<OpenGymSpace>
+OpenGymInterfaceTestCase::GetActionSpace ()
+{
+  return CreateObject<OpenGymDiscreteSpace> (100);
+}
+
+Ptr<OpenGymDataContainer>
+OpenGymInterfaceTestCase::GetObservation ()
+{
+  m_observations++;
+  std::vector<uint32_t> shape = {1};
+  Ptr<OpenGymBoxContainer<float> > box = CreateObject<OpenGymBoxContainer<float> > (shape);
+  box->AddValue (m_value);
+  return box;
+}
+
+float
+OpenGymInterfaceTestCase::GetReward ()
+{
+  return 1;
+}
+
+bool
+OpenGymInterfaceTestCase::ExecuteActions (Ptr<OpenGymDataContainer> action)
+{
+  Ptr<OpenGymDiscreteContainer> discrete = DynamicCast<OpenGymDiscreteContainer> (action);
+  if (discrete)
+    {
+      m_actions.push_back (discrete->GetValue ());
+    }
+  return true;
+}
+
+/**
+ * In pipelined mode a step only waits for an action once more than
+ * MaxActionLag of them are outstanding, and applies late ones in order.
+ */
+class OpenGymPipelinedTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymPipelinedTestCase ();
+  virtual ~OpenGymPipelinedTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymPipelinedTestCase::OpenGymPipelinedTestCase ()
+  : OpenGymInterfaceTestCase ("Pipelined stepping with bounded action lag")
+{
+}
+
+OpenGymPipelinedTestCase::~OpenGymPipelinedTestCase ()
+{
+}
+
+void
+OpenGymPipelinedTestCase::DoRun (void)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface ("pipelined");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  interface->SetAttribute ("Pipelined", BooleanValue (true));
+  interface->SetAttribute ("MaxActionLag", UintegerValue (2));
+  Start (ns3opengym::SimInitAck ());
+
+  // two steps ahead of the agent without waiting
+  interface->NotifyCurrentState ();
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ (m_actions.size (), 0, "action executed before the agent replied");
+  for (uint64_t step = 0; step < 2; ++step)
+    {
+      ns3opengym::EnvStateMsg state;
+      NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "state " << step << " not sent");
+      NS_TEST_ASSERT_MSG_EQ (state.stepidx (), step, "step index");
+    }
+
+  // the third outstanding step waits for the action of the first one, the
+  // action of the second one is applied as soon as it is there
+  ReplyAction (0, 10);
+  ReplyAction (1, 11);
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {10, 11}), true, "late actions not applied in order");
+
+  ReplyAction (2, 12);
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {10, 11, 12}), true, "action of step 2");
+}
+
+/**
+ * Multiplexed messages carry an envelope frame with the env id and message
+ * type; replies for other environments are queued until they ask for them.
+ */
+class OpenGymEnvelopeTestCase : public TestCase
+{
+public:
+  OpenGymEnvelopeTestCase ();
+  virtual ~OpenGymEnvelopeTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymEnvelopeTestCase::OpenGymEnvelopeTestCase ()
+  : TestCase ("Multiplexed envelope and per-env queues")
+{
+}
+
+OpenGymEnvelopeTestCase::~OpenGymEnvelopeTestCase ()
+{
+}
+
+void
+OpenGymEnvelopeTestCase::DoRun (void)
+{
+  std::string name = "/opengym-test-envelope-" + std::to_string (getpid ());
+  Ptr<OpenGymShmTransport> transport = CreateObject<OpenGymShmTransport> ();
+  NS_TEST_ASSERT_MSG_EQ (transport->Open (name, 4096), true, "cannot create " << name);
+  ShmAgentEnd agent;
+  NS_TEST_ASSERT_MSG_EQ (agent.Map (name), true, "cannot map " << name);
+
+  zmq::message_t state ("state", 5);
+  NS_TEST_ASSERT_MSG_EQ (transport->SendTo (0x01020304, ns3opengym::Observation, state), true, "send");
+  std::string envelope;
+  std::string payload;
+  bool more;
+  NS_TEST_ASSERT_MSG_EQ (agent.ReceiveFrame (envelope, more), true, "no envelope");
+  NS_TEST_ASSERT_MSG_EQ (more, true, "envelope not followed by the message");
+  NS_TEST_ASSERT_MSG_EQ (envelope.size (), 8, "envelope size");
+  uint32_t fields[2];
+  std::memcpy (fields, envelope.data (), sizeof (fields));
+  NS_TEST_ASSERT_MSG_EQ (fields[0], 0x01020304, "env id");
+  NS_TEST_ASSERT_MSG_EQ (fields[1], ns3opengym::Observation, "message type");
+  NS_TEST_ASSERT_MSG_EQ (agent.ReceiveFrame (payload, more), true, "no message");
+  NS_TEST_ASSERT_MSG_EQ (payload, "state", "message");
+  NS_TEST_ASSERT_MSG_EQ (more, false, "message not complete");
+
+  // replies for envs 3, 7 and 3
+  for (uint32_t envId : {3, 7, 3})
+    {
+      uint32_t header[2] = {envId, ns3opengym::Action};
+      agent.SendFrame (std::string (reinterpret_cast<const char*> (header), sizeof (header)), true);
+      agent.SendFrame ("act" + std::to_string (envId), false);
+    }
+  zmq::message_t rx;
+  NS_TEST_ASSERT_MSG_EQ (transport->ReceiveFrom (7, rx, 0), true, "reply for env 7");
+  NS_TEST_ASSERT_MSG_EQ (rx.to_string (), "act7", "reply for env 7");
+  NS_TEST_ASSERT_MSG_EQ (transport->ReceiveFrom (7, rx, 0), false, "second reply for env 7");
+  for (uint32_t i = 0; i < 2; ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ (transport->ReceiveFrom (3, rx, 0), true, "queued reply " << i << " for env 3");
+      NS_TEST_ASSERT_MSG_EQ (rx.to_string (), "act3", "queued reply " << i << " for env 3");
+    }
+  NS_TEST_ASSERT_MSG_EQ (transport->ReceiveFrom (3, rx, 0), false, "third reply for env 3");
+
+  // a message without envelope is dropped
+  agent.SendFrame ("stray", false);
+  uint32_t header[2] = {3, ns3opengym::Action};
+  agent.SendFrame (std::string (reinterpret_cast<const char*> (header), sizeof (header)), true);
+  agent.SendFrame ("act3", false);
+  NS_TEST_ASSERT_MSG_EQ (transport->ReceiveFrom (3, rx, 100), true, "reply after a message without envelope");
+  NS_TEST_ASSERT_MSG_EQ (rx.to_string (), "act3", "reply after a message without envelope");
+
+  transport->Close ();
+}
+
+/**
+ * With BatchSize 3 the states of three steps go out in one batch, answered
+ * by one action per state.
+ */
+class OpenGymStateBatchTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymStateBatchTestCase ();
+  virtual ~OpenGymStateBatchTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymStateBatchTestCase::OpenGymStateBatchTestCase ()
+  : OpenGymInterfaceTestCase ("Batched states")
+{
+}
+
+OpenGymStateBatchTestCase::~OpenGymStateBatchTestCase ()
+{
+}
+
+void
+OpenGymStateBatchTestCase::DoRun (void)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface ("batch");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  interface->SetAttribute ("BatchSize", UintegerValue (3));
+  ns3opengym::SimInitAck ack;
+  ack.set_protocolversion (10);
+  ack.set_capabilities (ns3opengym::CAP_STATE_BATCH);
+  ns3opengym::SimInitMsg init;
+  Start (ack, &init);
+  NS_TEST_ASSERT_MSG_EQ (init.batchsize (), 3, "batch size announced");
+
+  for (uint32_t round = 0; round < 2; ++round)
+    {
+      for (uint32_t i = 0; i < 2; ++i)
+        {
+          m_value = 3 * round + i;
+          interface->NotifyCurrentState ();
+        }
+      ns3opengym::EnvStateBatchMsg batch;
+      NS_TEST_ASSERT_MSG_EQ (Receive (batch), false, "incomplete batch sent");
+
+      ns3opengym::EnvActBatchMsg actions;
+      for (uint32_t i = 0; i < 3; ++i)
+        {
+          Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer> (100);
+          discrete->SetValue (10 * round + i);
+          ns3opengym::EnvActMsg *act = actions.add_act ();
+          act->set_stepidx (3 * round + i);
+          *act->mutable_actdata () = discrete->GetDataContainerPbMsg ();
+        }
+      Reply (actions);
+      m_value = 3 * round + 2;
+      interface->NotifyCurrentState ();
+
+      NS_TEST_ASSERT_MSG_EQ (Receive (batch), true, "batch " << round << " not sent");
+      NS_TEST_ASSERT_MSG_EQ (batch.state_size (), 3, "states in batch " << round);
+      for (uint32_t i = 0; i < 3; ++i)
+        {
+          ns3opengym::DataContainer obsData = batch.state (i).obsdata ();
+          Ptr<OpenGymBoxContainer<float> > obs = DynamicCast<OpenGymBoxContainer<float> > (OpenGymDataContainer::CreateFromDataContainerPbMsg (obsData));
+          NS_TEST_ASSERT_MSG_NE (obs, nullptr, "observation " << i << " of batch " << round);
+          NS_TEST_ASSERT_MSG_EQ (obs->GetValue (0), 3 * round + i, "observation " << i << " of batch " << round);
+          NS_TEST_ASSERT_MSG_EQ (batch.state (i).stepidx (), 3 * round + i, "step index " << i << " of batch " << round);
+        }
+      NS_TEST_ASSERT_MSG_EQ (m_actions.size (), 3 * (round + 1), "actions of batch " << round);
+      for (uint32_t i = 0; i < 3; ++i)
+        {
+          NS_TEST_ASSERT_MSG_EQ (m_actions[3 * round + i], 10 * round + i, "action " << i << " of batch " << round);
+        }
+    }
+}
+
+/**
+ * An action sent with repeat k is reapplied on the next k-1 steps without
+ * collecting observations, and the rewards of all k steps are summed up.
+ */
+class OpenGymActionRepeatTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymActionRepeatTestCase ();
+  virtual ~OpenGymActionRepeatTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymActionRepeatTestCase::OpenGymActionRepeatTestCase ()
+  : OpenGymInterfaceTestCase ("Action repeat")
+{
+}
+
+OpenGymActionRepeatTestCase::~OpenGymActionRepeatTestCase ()
+{
+}
+
+void
+OpenGymActionRepeatTestCase::DoRun (void)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface ("repeat");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  Start (ns3opengym::SimInitAck ());
+
+  Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer> (100);
+  discrete->SetValue (5);
+  ns3opengym::EnvActMsg actMsg;
+  actMsg.set_stepidx (0);
+  actMsg.set_repeat (3);
+  *actMsg.mutable_actdata () = discrete->GetDataContainerPbMsg ();
+  Reply (actMsg);
+  for (uint32_t i = 0; i < 3; ++i)
+    {
+      interface->NotifyCurrentState ();
+    }
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {5, 5, 5}), true, "action not repeated");
+  NS_TEST_ASSERT_MSG_EQ (m_observations, 1, "observations collected on repeated steps");
+
+  ReplyAction (1, 6);
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {5, 5, 5, 6}), true, "action after the repeat");
+  NS_TEST_ASSERT_MSG_EQ (m_observations, 2, "observations");
+  ns3opengym::EnvStateMsg state;
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "no state of step 0");
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "no state of step 1");
+  NS_TEST_ASSERT_MSG_EQ (state.stepidx (), 1, "states sent on repeated steps");
+  NS_TEST_ASSERT_MSG_EQ (state.reward (), 3, "rewards of the repeated steps");
+}
+
+/**
+ * Steps on which no wake-up predicate fires are not sent to the agent; the
+ * next state sent carries their rewards.
+ */
+class OpenGymWakeupTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymWakeupTestCase ();
+  virtual ~OpenGymWakeupTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymWakeupTestCase::OpenGymWakeupTestCase ()
+  : OpenGymInterfaceTestCase ("Wake-up predicates")
+{
+}
+
+OpenGymWakeupTestCase::~OpenGymWakeupTestCase ()
+{
+}
+
+void
+OpenGymWakeupTestCase::DoRun (void)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface ("wakeup");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  // wake up when the observation changes
+  ns3opengym::SimInitAck ack;
+  ns3opengym::WakeupPredicate *change = ack.mutable_wakeup ()->add_predicate ();
+  change->set_type (ns3opengym::WakeupPredicate::Change);
+  Start (ack);
+
+  // the first state is always sent
+  ReplyAction (0, 1);
+  interface->NotifyCurrentState ();
+  ns3opengym::EnvStateMsg state;
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "first state not sent");
+
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), false, "state sent although the observation did not change");
+
+  // the action replaces the condition by a threshold
+  ns3opengym::EnvActMsg act;
+  act.set_stepidx (1);
+  ns3opengym::WakeupPredicate *above = act.mutable_wakeup ()->add_predicate ();
+  above->set_type (ns3opengym::WakeupPredicate::Above);
+  above->set_threshold (5);
+  Reply (act);
+  m_value = 3;
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "state not sent after a change");
+  NS_TEST_ASSERT_MSG_EQ (state.stepidx (), 1, "step index");
+  NS_TEST_ASSERT_MSG_EQ (state.reward (), 2, "reward of the skipped step");
+
+  m_value = 4;
+  interface->NotifyCurrentState ();
+  m_value = 5;
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), false, "state sent below the threshold");
+  ReplyAction (2, 2);
+  m_value = 6;
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ (Receive (state), true, "state not sent above the threshold");
+  NS_TEST_ASSERT_MSG_EQ (state.reward (), 3, "rewards of the skipped steps");
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {1, 2}), true, "actions");
+}
+
+/**
+ * A step whose reply misses the ReplyTimeout gets the fallback action, and
+ * the late reply is discarded when it arrives. Timeouts below 1 ms still
+ * wait, and discarding a late reply does not restart the wait.
+ */
+class OpenGymReplyTimeoutTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymReplyTimeoutTestCase ();
+  virtual ~OpenGymReplyTimeoutTestCase ();
+
+private:
+  virtual void DoRun (void);
+  // started interface falling back to the action 42 after timeout
+  Ptr<OpenGymInterface> Create (std::string tag, Time timeout);
+};
+
+OpenGymReplyTimeoutTestCase::OpenGymReplyTimeoutTestCase ()
+  : OpenGymInterfaceTestCase ("Reply timeout and fallback action")
+{
+}
+
+OpenGymReplyTimeoutTestCase::~OpenGymReplyTimeoutTestCase ()
+{
+}
+
+Ptr<OpenGymInterface>
+OpenGymReplyTimeoutTestCase::Create (std::string tag, Time timeout)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface (tag);
+  if (!interface)
+    {
+      return 0;
+    }
+  interface->SetAttribute ("ReplyTimeout", TimeValue (timeout));
+  interface->SetAttribute ("FallbackPolicy", EnumValue (OpenGymInterface::FALLBACK_DEFAULT_ACTION));
+  Ptr<OpenGymDiscreteContainer> defaultAction = CreateObject<OpenGymDiscreteContainer> (100);
+  defaultAction->SetValue (42);
+  interface->SetDefaultAction (defaultAction);
+  Start (ns3opengym::SimInitAck ());
+  return interface;
+}
+
+void
+OpenGymReplyTimeoutTestCase::DoRun (void)
+{
+  Ptr<OpenGymInterface> interface = Create ("timeout", MilliSeconds (20));
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  ReplyAction (0, 1);
+  interface->NotifyCurrentState ();
+  // no reply for step 1
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {1, 42}), true, "default action not applied");
+  NS_TEST_ASSERT_MSG_EQ (interface->GetLateReplies (), 0, "late replies before any arrived");
+
+  ReplyAction (1, 2);
+  ReplyAction (2, 3);
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {1, 42, 3}), true, "late reply not discarded");
+  NS_TEST_ASSERT_MSG_EQ (interface->GetLateReplies (), 1, "late replies");
+
+  interface = Create ("timeout-us", MicroSeconds (500));
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  ReplyAction (0, 1);
+  interface->NotifyCurrentState ();
+  interface->NotifyCurrentState ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {1, 42}), true, "default action not applied after 500 us");
+
+  // the late reply of step 1 arrives 300 ms into the 400 ms wait of step 2
+  interface = Create ("timeout-stale", MilliSeconds (400));
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  ReplyAction (0, 1);
+  interface->NotifyCurrentState ();
+  interface->NotifyCurrentState ();
+  Ptr<OpenGymDiscreteContainer> late = CreateObject<OpenGymDiscreteContainer> (100);
+  late->SetValue (2);
+  ns3opengym::EnvActMsg lateMsg;
+  lateMsg.set_stepidx (1);
+  *lateMsg.mutable_actdata () = late->GetDataContainerPbMsg ();
+  std::string lateData = lateMsg.SerializeAsString ();
+  std::thread agent ([this, &lateData] () {
+    std::this_thread::sleep_for (std::chrono::milliseconds (300));
+    m_agent->SendFrame (lateData, false);
+  });
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  interface->NotifyCurrentState ();
+  int64_t waitedMs = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - start).count ();
+  agent.join ();
+  NS_TEST_ASSERT_MSG_EQ ((m_actions == std::vector<uint32_t> {1, 42, 42}), true, "default action not applied");
+  NS_TEST_ASSERT_MSG_EQ (interface->GetLateReplies (), 1, "late replies");
+  NS_TEST_ASSERT_MSG_LT (waitedMs, 600, "wait restarted by the late reply");
+}
+
+/**
+ * PublishTelemetry reaches a subscriber on the telemetry endpoint without
+ * an agent being connected.
+ */
+class OpenGymTelemetryTestCase : public TestCase
+{
+public:
+  OpenGymTelemetryTestCase ();
+  virtual ~OpenGymTelemetryTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymTelemetryTestCase::OpenGymTelemetryTestCase ()
+  : TestCase ("Telemetry side channel")
+{
+}
+
+OpenGymTelemetryTestCase::~OpenGymTelemetryTestCase ()
+{
+}
+
+void
+OpenGymTelemetryTestCase::DoRun (void)
+{
+  std::string endpoint = "inproc://opengym-test-telemetry";
+  Ptr<OpenGymInterface> interface = CreateObject<OpenGymInterface> ();
+  interface->SetAttribute ("TelemetryEndpoint", StringValue (endpoint));
+  // binds the publisher
+  interface->PublishTelemetry ("rtt", 0.0);
+
+  std::shared_ptr<zmq::context_t> context = OpenGymZmqTransport::GetContext ();
+  zmq::socket_t subscriber (*context, ZMQ_SUB);
+  NS_TEST_ASSERT_MSG_EQ (zmq_connect ((void*)subscriber, endpoint.c_str ()), 0, "cannot connect to " << endpoint);
+  zmq_setsockopt ((void*)subscriber, ZMQ_SUBSCRIBE, "rtt", 3);
+
+  // messages published before the subscription is through are dropped
+  zmq::message_t topic;
+  bool received = false;
+  for (uint32_t i = 0; i < 100 && !received; ++i)
+    {
+      interface->PublishTelemetry ("cwnd", 10.0);
+      interface->PublishTelemetry ("rtt", 0.25);
+      zmq::pollitem_t item = {(void*)subscriber, 0, ZMQ_POLLIN, 0};
+      received = zmq::poll (&item, 1, 10) > 0;
+    }
+  NS_TEST_ASSERT_MSG_EQ (received, true, "nothing published");
+  NS_TEST_ASSERT_MSG_EQ (subscriber.recv (topic).has_value (), true, "no topic frame");
+  NS_TEST_ASSERT_MSG_EQ (topic.to_string (), "rtt", "topic not filtered");
+  NS_TEST_ASSERT_MSG_EQ (topic.more (), true, "topic without message");
+  zmq::message_t msg;
+  NS_TEST_ASSERT_MSG_EQ (subscriber.recv (msg).has_value (), true, "no message frame");
+  ns3opengym::TelemetryMsg telemetry;
+  NS_TEST_ASSERT_MSG_EQ (telemetry.ParseFromArray (msg.data (), msg.size ()), true, "cannot parse TelemetryMsg");
+  NS_TEST_ASSERT_MSG_EQ (telemetry.name (), "rtt", "name");
+  Ptr<OpenGymBoxContainer<double> > value = DynamicCast<OpenGymBoxContainer<double> > (OpenGymDataContainer::CreateFromDataContainerPbMsg (*telemetry.mutable_data ()));
+  NS_TEST_ASSERT_MSG_NE (value, nullptr, "value no double Box");
+  NS_TEST_ASSERT_MSG_EQ (value->GetValue (0), 0.25, "value");
+
+  interface->Dispose ();
+}
+
+/**
+ * Nested containers fill the typed oneof payloads in place, without
+ * google.protobuf.Any, and decode from both encodings alike.
+ */
+class OpenGymTypedPayloadTestCase : public TestCase
+{
+public:
+  OpenGymTypedPayloadTestCase ();
+  virtual ~OpenGymTypedPayloadTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymTypedPayloadTestCase::OpenGymTypedPayloadTestCase ()
+  : TestCase ("Typed oneof payloads")
+{
+}
+
+OpenGymTypedPayloadTestCase::~OpenGymTypedPayloadTestCase ()
+{
+}
+
+void
+OpenGymTypedPayloadTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {2};
+  Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer> (5);
+  discrete->SetValue (3);
+  Ptr<OpenGymBoxContainer<int32_t> > box = CreateObject<OpenGymBoxContainer<int32_t> > (shape);
+  box->AddValue (-5);
+  box->AddValue (7);
+  Ptr<OpenGymDictContainer> dict = CreateObject<OpenGymDictContainer> ();
+  dict->Add ("box", box);
+  Ptr<OpenGymTupleContainer> tuple = CreateObject<OpenGymTupleContainer> ();
+  tuple->Add (discrete);
+  tuple->Add (dict);
+
+  OpenGymWireFormat typed;
+  typed.typed = true;
+  ns3opengym::DataContainer msg;
+  tuple->FillDataContainerPbMsg (msg, typed);
+  NS_TEST_ASSERT_MSG_EQ (msg.has_data (), false, "typed Tuple packed into Any");
+  NS_TEST_ASSERT_MSG_EQ (msg.type (), ns3opengym::Tuple, "type");
+  NS_TEST_ASSERT_MSG_EQ (msg.tuple ().element_size (), 2, "Tuple elements");
+  NS_TEST_ASSERT_MSG_EQ (msg.tuple ().element (0).discrete ().data (), 3, "Discrete");
+  const ns3opengym::DataContainer &element = msg.tuple ().element (1).dict ().element (0);
+  NS_TEST_ASSERT_MSG_EQ (element.name (), "box", "Dict key");
+  NS_TEST_ASSERT_MSG_EQ (element.has_data (), false, "nested Box packed into Any");
+  NS_TEST_ASSERT_MSG_EQ (element.box ().intdata_size (), 2, "Box elements");
+  NS_TEST_ASSERT_MSG_EQ (element.box ().intdata (0), -5, "first Box element");
+
+  ns3opengym::DataContainer v1 = tuple->GetDataContainerPbMsg ();
+  NS_TEST_ASSERT_MSG_EQ (v1.has_data (), true, "v1 Tuple not packed into Any");
+  NS_TEST_ASSERT_MSG_EQ (v1.value_case (), ns3opengym::DataContainer::VALUE_NOT_SET, "v1 Tuple with a typed payload");
+
+  for (const ns3opengym::DataContainer &encoded : {msg, v1})
+    {
+      Ptr<OpenGymTupleContainer> decoded = DynamicCast<OpenGymTupleContainer> (OpenGymDataContainer::CreateFromDataContainerPbMsg (encoded));
+      NS_TEST_ASSERT_MSG_NE (decoded, nullptr, "decoded no Tuple");
+      Ptr<OpenGymDiscreteContainer> discrete2 = DynamicCast<OpenGymDiscreteContainer> (decoded->Get (0));
+      NS_TEST_ASSERT_MSG_NE (discrete2, nullptr, "decoded no Discrete");
+      NS_TEST_ASSERT_MSG_EQ (discrete2->GetValue (), 3, "Discrete");
+      Ptr<OpenGymDictContainer> dict2 = DynamicCast<OpenGymDictContainer> (decoded->Get (1));
+      NS_TEST_ASSERT_MSG_NE (dict2, nullptr, "decoded no Dict");
+      Ptr<OpenGymBoxContainer<int32_t> > box2 = DynamicCast<OpenGymBoxContainer<int32_t> > (dict2->Get ("box"));
+      NS_TEST_ASSERT_MSG_NE (box2, nullptr, "decoded no int32 Box");
+      NS_TEST_ASSERT_MSG_EQ (box2->GetData () == box->GetData (), true, "Box elements");
+    }
+}
+
+/**
+ * Box data sent as raw little-endian bytes instead of repeated fields, and
+ * decoded back.
+ */
+class OpenGymRawBoxTestCase : public TestCase
+{
+public:
+  OpenGymRawBoxTestCase ();
+  virtual ~OpenGymRawBoxTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymRawBoxTestCase::OpenGymRawBoxTestCase ()
+  : TestCase ("Raw Box data")
+{
+}
+
+OpenGymRawBoxTestCase::~OpenGymRawBoxTestCase ()
+{
+}
+
+void
+OpenGymRawBoxTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {2, 2};
+  std::vector<double> values = {-1.5, 0.0, 2.25, 1e10};
+  Ptr<OpenGymBoxContainer<double> > box = CreateObject<OpenGymBoxContainer<double> > (shape);
+  box->SetData (values);
+
+  OpenGymWireFormat format;
+  format.typed = true;
+  format.rawBox = true;
+  ns3opengym::DataContainer msg;
+  box->FillDataContainerPbMsg (msg, format);
+  NS_TEST_ASSERT_MSG_EQ (msg.box ().doubledata_size (), 0, "repeated field filled");
+  NS_TEST_ASSERT_MSG_EQ (msg.box ().rawdata ().size (), 4 * sizeof (double), "raw data size");
+  NS_TEST_ASSERT_MSG_EQ (std::memcmp (msg.box ().rawdata ().data (), values.data (), 4 * sizeof (double)), 0, "raw data");
+  NS_TEST_ASSERT_MSG_EQ (msg.box ().shape_size (), 2, "shape");
+
+  Ptr<OpenGymBoxContainer<double> > decoded = DynamicCast<OpenGymBoxContainer<double> > (OpenGymDataContainer::CreateFromDataContainerPbMsg (msg));
+  NS_TEST_ASSERT_MSG_NE (decoded, nullptr, "decoded no double Box");
+  NS_TEST_ASSERT_MSG_EQ (decoded->GetData () == values, true, "decoded values");
+  NS_TEST_ASSERT_MSG_EQ (decoded->GetShape () == shape, true, "decoded shape");
+
+  format.rawBox = false;
+  ns3opengym::DataContainer repeated;
+  box->FillDataContainerPbMsg (repeated, format);
+  NS_TEST_ASSERT_MSG_EQ (repeated.box ().doubledata_size (), 4, "repeated field without rawBox");
+  NS_TEST_ASSERT_MSG_EQ (repeated.box ().rawdata ().empty (), true, "raw data without rawBox");
+}
+
+/**
+ * Tuple(Box float [2,3], Dict {id: Discrete, rate: Box uint16 [4]}) packed
+ * by OpenGymLayout and unpacked again.
+ */
+class OpenGymLayoutTestCase : public TestCase
+{
+public:
+  OpenGymLayoutTestCase ();
+  virtual ~OpenGymLayoutTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymLayoutTestCase::OpenGymLayoutTestCase ()
+  : TestCase ("Packed layout round trip")
+{
+}
+
+OpenGymLayoutTestCase::~OpenGymLayoutTestCase ()
+{
+}
+
+void
+OpenGymLayoutTestCase::DoRun (void)
+{
+  std::vector<uint32_t> matrixShape = {2, 3};
+  std::vector<uint32_t> rateShape = {4};
+  Ptr<OpenGymDictSpace> dictSpace = CreateObject<OpenGymDictSpace> ();
+  dictSpace->Add ("id", CreateObject<OpenGymDiscreteSpace> (10));
+  dictSpace->Add ("rate", CreateObject<OpenGymBoxSpace> (0, 1000, rateShape, TypeNameGet<uint16_t> ()));
+  Ptr<OpenGymTupleSpace> space = CreateObject<OpenGymTupleSpace> ();
+  space->Add (CreateObject<OpenGymBoxSpace> (-1, 1, matrixShape, TypeNameGet<float> ()));
+  space->Add (dictSpace);
+
+  OpenGymLayout layout;
+  NS_TEST_ASSERT_MSG_EQ (layout.Compile (space->GetSpaceDescription ()), true, "space has no layout");
+  NS_TEST_ASSERT_MSG_EQ (layout.GetSize (), 6 * 4 + 4 + 4 * 2, "layout size");
+
+  Ptr<OpenGymBoxContainer<float> > matrix = CreateObject<OpenGymBoxContainer<float> > (matrixShape);
+  for (uint32_t i = 0; i < 6; ++i)
+    {
+      matrix->AddValue (-0.5f + 0.25f * i);
+    }
+  Ptr<OpenGymDiscreteContainer> id = CreateObject<OpenGymDiscreteContainer> (10);
+  id->SetValue (7);
+  Ptr<OpenGymBoxContainer<uint16_t> > rate = CreateObject<OpenGymBoxContainer<uint16_t> > (rateShape);
+  rate->SetData (std::vector<uint16_t> {0, 1, 999, 1000});
+  Ptr<OpenGymDictContainer> dict = CreateObject<OpenGymDictContainer> ();
+  dict->Add ("rate", rate);
+  dict->Add ("id", id);
+  Ptr<OpenGymTupleContainer> tuple = CreateObject<OpenGymTupleContainer> ();
+  tuple->Add (matrix);
+  tuple->Add (dict);
+
+  std::string packed;
+  NS_TEST_ASSERT_MSG_EQ (layout.Pack (tuple, packed), true, "container does not fit the layout");
+  NS_TEST_ASSERT_MSG_EQ (packed.size (), layout.GetSize (), "packed size");
+  // leaves in description order, Dict keys sorted
+  int32_t packedId;
+  std::memcpy (&packedId, packed.data () + 24, sizeof (packedId));
+  NS_TEST_ASSERT_MSG_EQ (packedId, 7, "Discrete after the matrix");
+  uint16_t packedRate;
+  std::memcpy (&packedRate, packed.data () + 28 + 2 * 2, sizeof (packedRate));
+  NS_TEST_ASSERT_MSG_EQ (packedRate, 999, "third rate");
+
+  Ptr<OpenGymTupleContainer> unpacked = DynamicCast<OpenGymTupleContainer> (layout.Unpack (packed));
+  NS_TEST_ASSERT_MSG_NE (unpacked, nullptr, "unpacked no Tuple");
+  Ptr<OpenGymBoxContainer<float> > matrix2 = DynamicCast<OpenGymBoxContainer<float> > (unpacked->Get (0));
+  NS_TEST_ASSERT_MSG_NE (matrix2, nullptr, "unpacked no float Box");
+  NS_TEST_ASSERT_MSG_EQ (matrix2->GetShape () == matrixShape, true, "matrix shape");
+  NS_TEST_ASSERT_MSG_EQ (matrix2->GetData () == matrix->GetData (), true, "matrix values");
+  Ptr<OpenGymDictContainer> dict2 = DynamicCast<OpenGymDictContainer> (unpacked->Get (1));
+  NS_TEST_ASSERT_MSG_NE (dict2, nullptr, "unpacked no Dict");
+  Ptr<OpenGymDiscreteContainer> id2 = DynamicCast<OpenGymDiscreteContainer> (dict2->Get ("id"));
+  NS_TEST_ASSERT_MSG_NE (id2, nullptr, "unpacked no Discrete");
+  NS_TEST_ASSERT_MSG_EQ (id2->GetValue (), 7, "id");
+  Ptr<OpenGymBoxContainer<uint16_t> > rate2 = DynamicCast<OpenGymBoxContainer<uint16_t> > (dict2->Get ("rate"));
+  NS_TEST_ASSERT_MSG_NE (rate2, nullptr, "unpacked no uint16 Box");
+  NS_TEST_ASSERT_MSG_EQ (rate2->GetData () == rate->GetData (), true, "rate values");
+
+  packed.pop_back ();
+  NS_TEST_ASSERT_MSG_EQ (layout.Unpack (packed), nullptr, "unpacked data of the wrong size");
+  matrix->SetData (std::vector<float> ());
+  NS_TEST_ASSERT_MSG_EQ (layout.Pack (tuple, packed), false, "packed a Box of the wrong size");
+}
+
+/**
+ * Batches larger than the first block of the per-step arena grow it; the
+ * states of every batch survive the arena resets in between.
+ */
+class OpenGymArenaTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymArenaTestCase ();
+  virtual ~OpenGymArenaTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymArenaTestCase::OpenGymArenaTestCase ()
+  : OpenGymInterfaceTestCase ("Per-step arena reuse")
+{
+}
+
+OpenGymArenaTestCase::~OpenGymArenaTestCase ()
+{
+}
+
+void
+OpenGymArenaTestCase::DoRun (void)
+{
+  const uint32_t batchSize = 100;
+  Ptr<OpenGymInterface> interface = CreateInterface ("arena");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  interface->SetAttribute ("BatchSize", UintegerValue (batchSize));
+  ns3opengym::SimInitAck ack;
+  ack.set_protocolversion (10);
+  ack.set_capabilities (ns3opengym::CAP_STATE_BATCH);
+  Start (ack);
+
+  uint64_t step = 0;
+  for (uint32_t round = 0; round < 3; ++round)
+    {
+      ns3opengym::EnvActBatchMsg actions;
+      for (uint32_t i = 0; i < batchSize; ++i)
+        {
+          Ptr<OpenGymDiscreteContainer> discrete = CreateObject<OpenGymDiscreteContainer> (100);
+          discrete->SetValue (round);
+          ns3opengym::EnvActMsg *act = actions.add_act ();
+          act->set_stepidx (step + i);
+          *act->mutable_actdata () = discrete->GetDataContainerPbMsg ();
+        }
+      Reply (actions);
+      for (uint32_t i = 0; i < batchSize; ++i)
+        {
+          m_value = step + i;
+          interface->NotifyCurrentState ();
+        }
+
+      ns3opengym::EnvStateBatchMsg batch;
+      NS_TEST_ASSERT_MSG_EQ (Receive (batch), true, "batch " << round << " not sent");
+      NS_TEST_ASSERT_MSG_EQ (batch.state_size (), batchSize, "states in batch " << round);
+      for (uint32_t i = 0; i < batchSize; ++i, ++step)
+        {
+          ns3opengym::DataContainer obsData = batch.state (i).obsdata ();
+          Ptr<OpenGymBoxContainer<float> > obs = DynamicCast<OpenGymBoxContainer<float> > (OpenGymDataContainer::CreateFromDataContainerPbMsg (obsData));
+          NS_TEST_ASSERT_MSG_NE (obs, nullptr, "observation of step " << step);
+          NS_TEST_ASSERT_MSG_EQ (obs->GetValue (0), step, "observation of step " << step);
+          NS_TEST_ASSERT_MSG_EQ (batch.state (i).stepidx (), step, "step index of step " << step);
+        }
+      NS_TEST_ASSERT_MSG_EQ (m_actions.size (), batchSize * (round + 1), "actions of batch " << round);
+      NS_TEST_ASSERT_MSG_EQ (m_actions.back (), round, "last action of batch " << round);
+    }
+}
+
+/**
+ * Raw Box data above the chunk size is left out of the message and written
+ * in chunks by the streamed data callback; smaller Boxes stay inline.
+ */
+class OpenGymStreamedBoxTestCase : public TestCase
+{
+public:
+  OpenGymStreamedBoxTestCase ();
+  virtual ~OpenGymStreamedBoxTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymStreamedBoxTestCase::OpenGymStreamedBoxTestCase ()
+  : TestCase ("Streamed Box data")
+{
+}
+
+OpenGymStreamedBoxTestCase::~OpenGymStreamedBoxTestCase ()
+{
+}
+
+void
+OpenGymStreamedBoxTestCase::DoRun (void)
+{
+  std::vector<uint32_t> largeShape = {1000};
+  Ptr<OpenGymBoxContainer<uint32_t> > large = CreateObject<OpenGymBoxContainer<uint32_t> > (largeShape);
+  for (uint32_t i = 0; i < 1000; ++i)
+    {
+      large->AddValue (i);
+    }
+  std::vector<uint32_t> smallShape = {4};
+  Ptr<OpenGymBoxContainer<uint32_t> > small = CreateObject<OpenGymBoxContainer<uint32_t> > (smallShape);
+  small->SetData (std::vector<uint32_t> {1, 2, 3, 4});
+  Ptr<OpenGymTupleContainer> tuple = CreateObject<OpenGymTupleContainer> ();
+  tuple->Add (small);
+  tuple->Add (large);
+
+  std::vector<OpenGymStreamedData> streamed;
+  OpenGymWireFormat format;
+  format.typed = true;
+  format.rawBox = true;
+  format.chunkSize = 1024;
+  format.streamed = &streamed;
+  ns3opengym::DataContainer msg;
+  tuple->FillDataContainerPbMsg (msg, format);
+
+  const ns3opengym::BoxDataContainer &smallMsg = msg.tuple ().element (0).box ();
+  NS_TEST_ASSERT_MSG_EQ (smallMsg.rawdata ().size (), 4 * sizeof (uint32_t), "small Box not inline");
+  NS_TEST_ASSERT_MSG_EQ (smallMsg.streamedsize (), 0, "small Box streamed");
+  const ns3opengym::BoxDataContainer &largeMsg = msg.tuple ().element (1).box ();
+  NS_TEST_ASSERT_MSG_EQ (largeMsg.rawdata ().empty (), true, "large Box inline");
+  NS_TEST_ASSERT_MSG_EQ (largeMsg.streamedsize (), 1000 * sizeof (uint32_t), "streamed size");
+  NS_TEST_ASSERT_MSG_EQ (streamed.size (), 1, "streamed Boxes");
+  NS_TEST_ASSERT_MSG_EQ (streamed[0].size, 1000 * sizeof (uint32_t), "streamed data size");
+  NS_TEST_ASSERT_MSG_EQ (streamed[0].elementSize, sizeof (uint32_t), "streamed element size");
+
+  // a chunk from the middle
+  uint32_t chunk[5];
+  streamed[0].write (500, 5, reinterpret_cast<uint8_t*> (chunk));
+  for (uint32_t i = 0; i < 5; ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ (chunk[i], 500 + i, "element " << i << " of the chunk");
+    }
+
+  // without a list of streamed data everything stays inline
+  format.streamed = 0;
+  ns3opengym::DataContainer inlineMsg;
+  tuple->FillDataContainerPbMsg (inlineMsg, format);
+  NS_TEST_ASSERT_MSG_EQ (inlineMsg.tuple ().element (1).box ().rawdata ().size (), 1000 * sizeof (uint32_t), "Box streamed without a list");
+}
+
+/**
+ * Raw Box data and packed observations delta encoded by one OpenGymDelta
+ * and restored by another over a few steps.
+ */
+class OpenGymDeltaTestCase : public TestCase
+{
+public:
+  OpenGymDeltaTestCase ();
+  virtual ~OpenGymDeltaTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymDeltaTestCase::OpenGymDeltaTestCase ()
+  : TestCase ("Delta encoding round trip")
+{
+}
+
+OpenGymDeltaTestCase::~OpenGymDeltaTestCase ()
+{
+}
+
+void
+OpenGymDeltaTestCase::DoRun (void)
+{
+  OpenGymDelta encoder;
+  OpenGymDelta decoder;
+  std::string first (256, 'a');
+  std::string second (256, 'b');
+  std::string packed (64, 'p');
+
+  for (uint32_t step = 0; step < 4; ++step)
+    {
+      if (step == 1)
+        {
+          // a few scattered changes
+          first[3] = 'x';
+          first[200] = 'y';
+          packed[10] = 'q';
+        }
+      else if (step == 2)
+        {
+          // changed everywhere
+          std::fill (first.begin (), first.end (), 'z');
+        }
+
+      ns3opengym::EnvStateMsg state;
+      state.set_stepidx (step);
+      ns3opengym::TupleDataContainer *tuple = state.mutable_obsdata ()->mutable_tuple ();
+      tuple->add_element ()->mutable_box ()->set_rawdata (first);
+      tuple->add_element ()->mutable_box ()->set_rawdata (second);
+      state.set_packedobs (packed);
+      encoder.Encode (state);
+
+      const ns3opengym::BoxDataContainer &box = state.obsdata ().tuple ().element (0).box ();
+      NS_TEST_ASSERT_MSG_EQ (box.has_rawdelta (), step == 1 || step == 3, "delta of the first Box at step " << step);
+      NS_TEST_ASSERT_MSG_EQ (box.rawdata ().size () < first.size (), step == 1 || step == 3, "first Box size at step " << step);
+      NS_TEST_ASSERT_MSG_EQ (state.has_packedobsdelta (), step > 0, "packed delta at step " << step);
+
+      // the agent sends it back unchanged as an action
+      ns3opengym::EnvActMsg act;
+      act.set_stepidx (step);
+      *act.mutable_actdata () = state.obsdata ();
+      act.set_packedact (state.packedobs ());
+      if (state.has_packedobsdelta ())
+        {
+          *act.mutable_packedactdelta () = state.packedobsdelta ();
+        }
+      NS_TEST_ASSERT_MSG_EQ (decoder.Decode (act), true, "decode step " << step);
+      NS_TEST_ASSERT_MSG_EQ (act.actdata ().tuple ().element (0).box ().rawdata () == first, true, "first Box at step " << step);
+      NS_TEST_ASSERT_MSG_EQ (act.actdata ().tuple ().element (1).box ().rawdata () == second, true, "second Box at step " << step);
+      NS_TEST_ASSERT_MSG_EQ (act.actdata ().tuple ().element (0).box ().has_rawdelta (), false, "delta left at step " << step);
+      NS_TEST_ASSERT_MSG_EQ (act.packedact () == packed, true, "packed data at step " << step);
+    }
+
+  // runs beyond data the decoder has never seen
+  ns3opengym::EnvActMsg act;
+  act.set_packedact ("x");
+  act.mutable_packedactdelta ()->add_run (100);
+  act.mutable_packedactdelta ()->add_run (1);
+  OpenGymDelta fresh;
+  NS_TEST_ASSERT_MSG_EQ (fresh.Decode (act), false, "decoded a delta without previous data");
+}
+
+/**
+ * OpenGymSparseBoxContainer keeps its indices sorted and unique, sends them
+ * as SparseBoxDataContainer and falls back to exactly the message of the
+ * equal dense Box for peers without sparse Boxes.
+ */
+class OpenGymSparseBoxTestCase : public TestCase
+{
+public:
+  OpenGymSparseBoxTestCase ();
+  virtual ~OpenGymSparseBoxTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymSparseBoxTestCase::OpenGymSparseBoxTestCase ()
+  : TestCase ("Sparse Box encodings")
+{
+}
+
+OpenGymSparseBoxTestCase::~OpenGymSparseBoxTestCase ()
+{
+}
+
+void
+OpenGymSparseBoxTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {4, 5};
+  Ptr<OpenGymSparseBoxContainer<float> > sparse = CreateObject<OpenGymSparseBoxContainer<float> > (shape);
+  NS_TEST_ASSERT_MSG_EQ (sparse->AddValue (17, 3.5f), true, "add 17");
+  NS_TEST_ASSERT_MSG_EQ (sparse->AddValue (2, -1.0f), true, "add 2");
+  NS_TEST_ASSERT_MSG_EQ (sparse->AddValue (9, 4.0f), true, "add 9");
+  NS_TEST_ASSERT_MSG_EQ (sparse->AddValue (2, 2.0f), true, "replace 2");
+  NS_TEST_ASSERT_MSG_EQ (sparse->AddValue (20, 1.0f), false, "added an index outside the shape");
+  NS_TEST_ASSERT_MSG_EQ ((sparse->GetIndices () == std::vector<uint32_t> {2, 9, 17}), true, "indices not sorted");
+  NS_TEST_ASSERT_MSG_EQ ((sparse->GetValues () == std::vector<float> {2.0f, 4.0f, 3.5f}), true, "values");
+  NS_TEST_ASSERT_MSG_EQ (sparse->GetValue (9), 4.0f, "value at 9");
+  NS_TEST_ASSERT_MSG_EQ (sparse->GetValue (10), 0.0f, "value at 10");
+
+  Ptr<OpenGymSparseBoxContainer<float> > other = CreateObject<OpenGymSparseBoxContainer<float> > (shape);
+  NS_TEST_ASSERT_MSG_EQ (other->SetData ({9, 2, 9}, {1.0f, 2.0f, 3.0f}), false, "accepted a repeated index");
+  NS_TEST_ASSERT_MSG_EQ (other->SetData ({9, 20}, {1.0f, 2.0f}), false, "accepted an index outside the shape");
+  NS_TEST_ASSERT_MSG_EQ (other->SetData ({17, 9, 2}, {3.5f, 4.0f, 2.0f}), true, "set data");
+  NS_TEST_ASSERT_MSG_EQ ((other->GetIndices () == sparse->GetIndices ()), true, "SetData indices not sorted");
+  NS_TEST_ASSERT_MSG_EQ ((other->GetValues () == sparse->GetValues ()), true, "SetData values not permuted along");
+
+  OpenGymWireFormat format;
+  format.typed = true;
+  format.rawBox = true;
+  format.fullDtypes = true;
+  format.sparseBox = true;
+  ns3opengym::DataContainer msg;
+  sparse->FillDataContainerPbMsg (msg, format);
+  NS_TEST_ASSERT_MSG_EQ (msg.has_sparsebox (), true, "no SparseBoxDataContainer");
+  NS_TEST_ASSERT_MSG_EQ (msg.sparsebox ().indices ().size (), 3 * sizeof (uint32_t), "indices size");
+  uint32_t lastIndex;
+  std::memcpy (&lastIndex, msg.sparsebox ().indices ().data () + 2 * sizeof (uint32_t), sizeof (lastIndex));
+  NS_TEST_ASSERT_MSG_EQ (lastIndex, 17, "last index");
+
+  std::vector<float> dense (20, 0.0f);
+  dense[2] = 2.0f;
+  dense[9] = 4.0f;
+  dense[17] = 3.5f;
+  Ptr<OpenGymBoxContainer<float> > box = CreateObject<OpenGymBoxContainer<float> > (shape);
+  box->SetData (dense);
+  // typed and v1, repeated fields and raw data
+  for (uint32_t i = 0; i < 4; ++i)
+    {
+      OpenGymWireFormat denseFormat;
+      denseFormat.typed = i & 1;
+      denseFormat.rawBox = i & 2;
+      ns3opengym::DataContainer sparseMsg;
+      ns3opengym::DataContainer boxMsg;
+      sparse->FillDataContainerPbMsg (sparseMsg, denseFormat);
+      box->FillDataContainerPbMsg (boxMsg, denseFormat);
+      NS_TEST_ASSERT_MSG_EQ (sparseMsg.SerializeAsString () == boxMsg.SerializeAsString (), true,
+                             "dense fallback differs from the Box in format " << i);
+    }
+
+  // without full dtypes the values are widened to the legacy dtype
+  Ptr<OpenGymSparseBoxContainer<int8_t> > narrow = CreateObject<OpenGymSparseBoxContainer<int8_t> > (shape);
+  narrow->SetData ({3, 11}, {-7, 5});
+  format.fullDtypes = false;
+  ns3opengym::DataContainer legacyMsg;
+  narrow->FillDataContainerPbMsg (legacyMsg, format);
+  NS_TEST_ASSERT_MSG_EQ (legacyMsg.sparsebox ().dtype (), ns3opengym::INT, "legacy dtype");
+  NS_TEST_ASSERT_MSG_EQ (legacyMsg.sparsebox ().values ().size (), 2 * sizeof (int32_t), "legacy values size");
+  int32_t first;
+  std::memcpy (&first, legacyMsg.sparsebox ().values ().data (), sizeof (first));
+  NS_TEST_ASSERT_MSG_EQ (first, -7, "legacy value at 3");
+
+  // shrinking the shape drops the elements outside it
+  sparse->SetShape ({2, 5});
+  NS_TEST_ASSERT_MSG_EQ (sparse->GetSize (), 10, "size after SetShape");
+  NS_TEST_ASSERT_MSG_EQ ((sparse->GetIndices () == std::vector<uint32_t> {2, 9}), true, "indices after SetShape");
+  NS_TEST_ASSERT_MSG_EQ ((sparse->GetValues () == std::vector<float> {2.0f, 4.0f}), true, "values after SetShape");
+}
+
+/**
+ * Boxes with a quantization packed as uint8 or uint16 values and restored
+ * within half a step, out of range values clamped.
+ */
+class OpenGymQuantizedLayoutTestCase : public TestCase
+{
+public:
+  OpenGymQuantizedLayoutTestCase ();
+  virtual ~OpenGymQuantizedLayoutTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymQuantizedLayoutTestCase::OpenGymQuantizedLayoutTestCase ()
+  : TestCase ("Quantized layout round trip")
+{
+}
+
+OpenGymQuantizedLayoutTestCase::~OpenGymQuantizedLayoutTestCase ()
+{
+}
+
+void
+OpenGymQuantizedLayoutTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {5};
+  Ptr<OpenGymBoxSpace> coarse = CreateObject<OpenGymBoxSpace> (0, 10, shape, TypeNameGet<float> ());
+  NS_TEST_ASSERT_MSG_EQ (coarse->SetQuantization ("int8"), false, "accepted a signed quantized dtype");
+  NS_TEST_ASSERT_MSG_EQ (coarse->SetQuantization ("uint8", {0.1f, 0.1f}, {0.0f}), false, "accepted two scales for five elements");
+  NS_TEST_ASSERT_MSG_EQ (coarse->SetQuantization ("uint8"), true, "uint8 quantization");
+  // one scale and offset per element
+  std::vector<float> scale = {0.001f, 0.01f, 0.1f, 1.0f, 10.0f};
+  std::vector<float> offset = {-1.0f, 0.0f, 1.0f, 2.0f, 3.0f};
+  Ptr<OpenGymBoxSpace> fine = CreateObject<OpenGymBoxSpace> (-100, 100, shape, TypeNameGet<float> ());
+  NS_TEST_ASSERT_MSG_EQ (fine->SetQuantization ("uint16", scale, offset), true, "uint16 quantization");
+  Ptr<OpenGymTupleSpace> space = CreateObject<OpenGymTupleSpace> ();
+  space->Add (coarse);
+  space->Add (fine);
+
+  OpenGymLayout plain;
+  NS_TEST_ASSERT_MSG_EQ (plain.Compile (space->GetSpaceDescription ()), true, "space has no layout");
+  NS_TEST_ASSERT_MSG_EQ (plain.GetSize (), 2 * 5 * 4, "quantization used without quantize");
+  OpenGymLayout layout;
+  NS_TEST_ASSERT_MSG_EQ (layout.Compile (space->GetSpaceDescription (), true), true, "space has no quantized layout");
+  NS_TEST_ASSERT_MSG_EQ (layout.GetSize (), 5 * 1 + 5 * 2, "quantized layout size");
+
+  std::vector<float> coarseValues = {0.0f, 2.5f, 10.0f, 12.0f, -1.0f};
+  std::vector<float> fineValues = {-0.5f, 100.0f, 2.0f, 1000.0f, 3.0f};
+  Ptr<OpenGymBoxContainer<float> > coarseBox = CreateObject<OpenGymBoxContainer<float> > (shape);
+  coarseBox->SetData (coarseValues);
+  Ptr<OpenGymBoxContainer<float> > fineBox = CreateObject<OpenGymBoxContainer<float> > (shape);
+  fineBox->SetData (fineValues);
+  Ptr<OpenGymTupleContainer> tuple = CreateObject<OpenGymTupleContainer> ();
+  tuple->Add (coarseBox);
+  tuple->Add (fineBox);
+
+  std::string packed;
+  NS_TEST_ASSERT_MSG_EQ (layout.Pack (tuple, packed), true, "container does not fit the layout");
+  NS_TEST_ASSERT_MSG_EQ ((uint32_t)(uint8_t)packed[2], 255, "high end of the range");
+  NS_TEST_ASSERT_MSG_EQ ((uint32_t)(uint8_t)packed[3], 255, "not clamped to the high end");
+  NS_TEST_ASSERT_MSG_EQ ((uint32_t)(uint8_t)packed[4], 0, "not clamped to the low end");
+
+  Ptr<OpenGymTupleContainer> unpacked = DynamicCast<OpenGymTupleContainer> (layout.Unpack (packed));
+  NS_TEST_ASSERT_MSG_NE (unpacked, nullptr, "unpacked no Tuple");
+  Ptr<OpenGymBoxContainer<float> > coarse2 = DynamicCast<OpenGymBoxContainer<float> > (unpacked->Get (0));
+  Ptr<OpenGymBoxContainer<float> > fine2 = DynamicCast<OpenGymBoxContainer<float> > (unpacked->Get (1));
+  NS_TEST_ASSERT_MSG_NE (coarse2, nullptr, "unpacked no float Box");
+  NS_TEST_ASSERT_MSG_NE (fine2, nullptr, "unpacked no float Box");
+  NS_TEST_ASSERT_MSG_EQ (coarse2->GetShape () == shape, true, "shape");
+  std::vector<float> coarseExpected = {0.0f, 2.5f, 10.0f, 10.0f, 0.0f};
+  for (uint32_t i = 0; i < 5; ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ_TOL (coarse2->GetValue (i), coarseExpected[i], 10.0f / 255 / 2, "uint8 element " << i);
+      NS_TEST_ASSERT_MSG_EQ_TOL (fine2->GetValue (i), fineValues[i], scale[i] / 2, "uint16 element " << i);
+    }
+}
+
+/**
+ * The init handshake settles on the lower protocol version and the
+ * Capability bits both sides announce, minus those whose prerequisites
+ * are missing; peers before v10 get the bits of their version.
+ */
+class OpenGymCapabilitiesTestCase : public OpenGymInterfaceTestCase
+{
+public:
+  OpenGymCapabilitiesTestCase ();
+  virtual ~OpenGymCapabilitiesTestCase ();
+
+private:
+  virtual void DoRun (void);
+  // capabilities negotiated with ack, announcing all but disabled
+  uint64_t Negotiate (const ns3opengym::SimInitAck &ack, uint64_t disabled = 0);
+};
+
+OpenGymCapabilitiesTestCase::OpenGymCapabilitiesTestCase ()
+  : OpenGymInterfaceTestCase ("Capability negotiation")
+{
+}
+
+OpenGymCapabilitiesTestCase::~OpenGymCapabilitiesTestCase ()
+{
+}
+
+uint64_t
+OpenGymCapabilitiesTestCase::Negotiate (const ns3opengym::SimInitAck &ack, uint64_t disabled)
+{
+  Ptr<OpenGymInterface> interface = CreateInterface ("capabilities");
+  if (!interface)
+    {
+      return 0;
+    }
+  interface->SetAttribute ("DisabledCapabilities", UintegerValue (disabled));
+  ns3opengym::SimInitMsg init;
+  Start (ack, &init);
+  NS_TEST_EXPECT_MSG_EQ (init.protocolversion (), 10, "protocol version announced");
+  NS_TEST_EXPECT_MSG_EQ (init.capabilities () & disabled, 0, "disabled capabilities announced");
+  uint64_t capabilities = interface->GetCapabilities ();
+  NS_TEST_EXPECT_MSG_EQ (capabilities & ~init.capabilities (), 0, "capabilities not announced were negotiated");
+  Disconnect ();
+  return capabilities;
+}
+
+void
+OpenGymCapabilitiesTestCase::DoRun (void)
+{
+  const uint64_t all = 1023;
+  ns3opengym::SimInitAck ack;
+
+  // agents without a protocol version speak v1
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack), 0, "capabilities of a v1 agent");
+  Ptr<OpenGymInterface> interface = CreateInterface ("version");
+  NS_TEST_ASSERT_MSG_NE (interface, nullptr, "cannot create the segment");
+  ack.set_protocolversion (3);
+  Start (ack);
+  NS_TEST_ASSERT_MSG_EQ (interface->GetProtocolVersion (), 3, "protocol version of a v3 agent");
+  NS_TEST_ASSERT_MSG_EQ (interface->GetCapabilities (), ns3opengym::CAP_TYPED_PAYLOAD | ns3opengym::CAP_RAW_BOX,
+                         "capabilities of a v3 agent");
+  Disconnect ();
+  ack.set_protocolversion (5);
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack) & ns3opengym::CAP_STATE_BATCH, ns3opengym::CAP_STATE_BATCH, "batches of a v5 agent");
+  ack.set_protocolversion (99);
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack), 0, "capabilities of a v10 agent announcing none");
+
+  ack.set_capabilities (all);
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack), all, "all capabilities");
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack, ns3opengym::CAP_RAW_BOX),
+                         all & ~uint64_t (ns3opengym::CAP_RAW_BOX | ns3opengym::CAP_FULL_DTYPES | ns3opengym::CAP_CHUNK_STREAMING),
+                         "dependents of a disabled CAP_RAW_BOX kept");
+  ack.set_capabilities (all & ~uint64_t (ns3opengym::CAP_TYPED_PAYLOAD | ns3opengym::CAP_PACKED_LAYOUT));
+  NS_TEST_ASSERT_MSG_EQ (Negotiate (ack),
+                         all & ~uint64_t (ns3opengym::CAP_TYPED_PAYLOAD | ns3opengym::CAP_DELTA_ENCODING | ns3opengym::CAP_SPARSE_BOX
+                                          | ns3opengym::CAP_PACKED_LAYOUT | ns3opengym::CAP_QUANTIZATION),
+                         "dependents of CAP_TYPED_PAYLOAD and CAP_PACKED_LAYOUT kept");
+}
+
+/**
+ * Box elements filled in place after Resize, and vectors handed over to
+ * the container without copying their storage.
+ */
+class OpenGymBoxAccessTestCase : public TestCase
+{
+public:
+  OpenGymBoxAccessTestCase ();
+  virtual ~OpenGymBoxAccessTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymBoxAccessTestCase::OpenGymBoxAccessTestCase ()
+  : TestCase ("In-place Box data access")
+{
+}
+
+OpenGymBoxAccessTestCase::~OpenGymBoxAccessTestCase ()
+{
+}
+
+void
+OpenGymBoxAccessTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {8};
+  Ptr<OpenGymBoxContainer<int64_t> > box = CreateObject<OpenGymBoxContainer<int64_t> > (shape);
+  box->Resize (8);
+  NS_TEST_ASSERT_MSG_EQ (box->GetSize (), 8, "size after Resize");
+  int64_t *data = box->GetDataPtr ();
+  for (uint32_t i = 0; i < 8; ++i)
+    {
+      data[i] = -int64_t (i);
+    }
+  NS_TEST_ASSERT_MSG_EQ (box->GetValue (7), -7, "element written in place");
+
+  std::vector<int64_t> values (1000, 3);
+  const int64_t *storage = values.data ();
+  box->SetData (std::move (values));
+  NS_TEST_ASSERT_MSG_EQ (box->GetSize (), 1000, "size after SetData");
+  NS_TEST_ASSERT_MSG_EQ (box->GetDataPtr (), storage, "storage copied by SetData");
+
+  int64_t range[] = {4, 5, 6};
+  box->Assign (range, range + 3);
+  NS_TEST_ASSERT_MSG_EQ (box->GetSize (), 3, "size after Assign");
+  NS_TEST_ASSERT_MSG_EQ (box->GetValue (2), 6, "assigned element");
+  box->Reserve (64);
+  storage = box->GetDataPtr ();
+  for (uint32_t i = 3; i < 64; ++i)
+    {
+      box->AddValue (i);
+    }
+  NS_TEST_ASSERT_MSG_EQ (box->GetDataPtr (), storage, "storage reallocated within the reserved size");
+}
+
+/**
+ * Row-major N-dimensional indexing of Box elements and strided views along
+ * one dimension.
+ */
+class OpenGymBoxIndexTestCase : public TestCase
+{
+public:
+  OpenGymBoxIndexTestCase ();
+  virtual ~OpenGymBoxIndexTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymBoxIndexTestCase::OpenGymBoxIndexTestCase ()
+  : TestCase ("N-dimensional Box indexing")
+{
+}
+
+OpenGymBoxIndexTestCase::~OpenGymBoxIndexTestCase ()
+{
+}
+
+void
+OpenGymBoxIndexTestCase::DoRun (void)
+{
+  std::vector<uint32_t> shape = {2, 3, 4};
+  Ptr<OpenGymBoxContainer<int32_t> > box = CreateObject<OpenGymBoxContainer<int32_t> > (shape);
+  std::vector<uint64_t> strides = box->GetStrides ();
+  NS_TEST_ASSERT_MSG_EQ (strides.size (), 3, "strides");
+  NS_TEST_ASSERT_MSG_EQ (strides[0], 12, "stride of dimension 0");
+  NS_TEST_ASSERT_MSG_EQ (strides[1], 4, "stride of dimension 1");
+  NS_TEST_ASSERT_MSG_EQ (strides[2], 1, "stride of dimension 2");
+
+  uint64_t idx;
+  NS_TEST_ASSERT_MSG_EQ (box->GetLinearIndex ({1, 2, 3}, idx), true, "index inside the shape");
+  NS_TEST_ASSERT_MSG_EQ (idx, 23, "linear index");
+  NS_TEST_ASSERT_MSG_EQ (box->GetLinearIndex ({0, 3, 0}, idx), false, "index outside the shape");
+  NS_TEST_ASSERT_MSG_EQ (box->GetLinearIndex ({1, 2}, idx), false, "index of the wrong rank");
+
+  // the first write grows the data to the full shape
+  NS_TEST_ASSERT_MSG_EQ (box->SetValue ({1, 0, 2}, 5), true, "SetValue inside the shape");
+  NS_TEST_ASSERT_MSG_EQ (box->GetSize (), 24, "size after SetValue");
+  NS_TEST_ASSERT_MSG_EQ (box->GetValue (14), 5, "element written by SetValue");
+  NS_TEST_ASSERT_MSG_EQ (box->SetValue ({2, 0, 0}, 5), false, "SetValue outside the shape");
+  for (uint32_t i = 0; i < 24; ++i)
+    {
+      box->GetDataPtr ()[i] = i;
+    }
+  NS_TEST_ASSERT_MSG_EQ (box->GetValue ({1, 1, 1}), 17, "GetValue");
+
+  OpenGymBoxView<int32_t> slice = box->GetSlice (1, {1, 0, 2});
+  NS_TEST_ASSERT_MSG_EQ (slice.GetSize (), 3, "slice size");
+  NS_TEST_ASSERT_MSG_EQ (slice[0], 14, "first element of the slice");
+  NS_TEST_ASSERT_MSG_EQ (slice[1], 18, "second element of the slice");
+  NS_TEST_ASSERT_MSG_EQ (slice[2], 22, "third element of the slice");
+  slice[1] = -1;
+  NS_TEST_ASSERT_MSG_EQ (box->GetValue (18), -1, "element written through the slice");
+  NS_TEST_ASSERT_MSG_EQ (box->GetSlice (3, {0, 0, 0}).GetSize (), 0, "slice along a missing dimension");
+
+  OpenGymBoxView<int32_t> row = box->GetRow (1);
+  NS_TEST_ASSERT_MSG_EQ (row.GetSize (), 12, "row size");
+  NS_TEST_ASSERT_MSG_EQ (row[0], 12, "first element of the row");
+  OpenGymBoxView<int32_t> column = box->GetColumn (5);
+  NS_TEST_ASSERT_MSG_EQ (column.GetSize (), 2, "column size");
+  NS_TEST_ASSERT_MSG_EQ (column[1], 17, "second element of the column");
+  NS_TEST_ASSERT_MSG_EQ (box->GetRow (2).GetSize (), 0, "row outside the shape");
+}
+
+/**
+ * Pooled containers come back cleared once nothing but the pool holds them,
+ * including the elements of released Tuples.
+ */
+class OpenGymContainerPoolTestCase : public TestCase
+{
+public:
+  OpenGymContainerPoolTestCase ();
+  virtual ~OpenGymContainerPoolTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymContainerPoolTestCase::OpenGymContainerPoolTestCase ()
+  : TestCase ("Pooled containers")
+{
+}
+
+OpenGymContainerPoolTestCase::~OpenGymContainerPoolTestCase ()
+{
+}
+
+void
+OpenGymContainerPoolTestCase::DoRun (void)
+{
+  OpenGymContainerPool pool;
+  Ptr<OpenGymBoxContainer<float> > box = pool.Get<OpenGymBoxContainer<float> > ();
+  box->AddValue (1);
+  OpenGymBoxContainer<float> *first = PeekPointer (box);
+  Ptr<OpenGymBoxContainer<float> > held = pool.Get<OpenGymBoxContainer<float> > ();
+  NS_TEST_ASSERT_MSG_NE (PeekPointer (held), first, "container in use handed out again");
+  NS_TEST_ASSERT_MSG_EQ (pool.GetSize (), 2, "containers after two Gets");
+
+  box = 0;
+  box = pool.Get<OpenGymBoxContainer<float> > ();
+  NS_TEST_ASSERT_MSG_EQ (PeekPointer (box), first, "released container not reused");
+  NS_TEST_ASSERT_MSG_EQ (box->GetSize (), 0, "reused container not cleared");
+  Ptr<OpenGymDiscreteContainer> discrete = pool.Get<OpenGymDiscreteContainer> ();
+  NS_TEST_ASSERT_MSG_EQ (pool.GetSize (), 3, "containers of another type");
+
+  // the elements of a released Tuple are reused as well
+  Ptr<OpenGymTupleContainer> tuple = pool.Get<OpenGymTupleContainer> ();
+  tuple->Add (box);
+  tuple->Add (held);
+  box = 0;
+  held = 0;
+  NS_TEST_ASSERT_MSG_NE (pool.Get<OpenGymBoxContainer<float> > (), nullptr, "no container");
+  NS_TEST_ASSERT_MSG_EQ (pool.GetSize (), 5, "containers held by a Tuple reused");
+  tuple = 0;
+  box = pool.Get<OpenGymBoxContainer<float> > ();
+  held = pool.Get<OpenGymBoxContainer<float> > ();
+  tuple = pool.Get<OpenGymTupleContainer> ();
+  NS_TEST_ASSERT_MSG_EQ (pool.GetSize (), 5, "containers of a released Tuple not reused");
+  NS_TEST_ASSERT_MSG_EQ (tuple->Get (0), nullptr, "reused Tuple not cleared");
+}
+
+/**
+ * An observation struct with a Box and a Discrete field, sent like the
+ * equivalent Dict container and decoded back into the struct.
+ */
+struct OpenGymTestObs
+{
+  std::array<std::array<float, 3>, 2> matrix;
+  uint32_t channel;
+
+  static constexpr auto Fields ()
+  {
+    return std::make_tuple (OpenGymBoxField ("matrix", &OpenGymTestObs::matrix, -1, 1),
+                            OpenGymDiscreteField ("channel", &OpenGymTestObs::channel, 4));
+  }
+};
+
+class OpenGymSchemaTestCase : public TestCase
+{
+public:
+  OpenGymSchemaTestCase ();
+  virtual ~OpenGymSchemaTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+OpenGymSchemaTestCase::OpenGymSchemaTestCase ()
+  : TestCase ("Struct schemas")
+{
+}
+
+OpenGymSchemaTestCase::~OpenGymSchemaTestCase ()
+{
+}
+
+void
+OpenGymSchemaTestCase::DoRun (void)
+{
+  OpenGymTestObs value;
+  value.matrix = {{{-1, -0.5, 0}, {0.25, 0.5, 1}}};
+  value.channel = 3;
+  Ptr<OpenGymStructContainer<OpenGymTestObs> > container = CreateObject<OpenGymStructContainer<OpenGymTestObs> > (value);
+
+  std::vector<uint32_t> shape = {2, 3};
+  Ptr<OpenGymBoxContainer<float> > matrix = CreateObject<OpenGymBoxContainer<float> > (shape);
+  matrix->Assign (value.matrix[0].begin (), value.matrix[0].end ());
+  for (float element : value.matrix[1])
+    {
+      matrix->AddValue (element);
+    }
+  Ptr<OpenGymDiscreteContainer> channel = CreateObject<OpenGymDiscreteContainer> (4);
+  channel->SetValue (value.channel);
+  Ptr<OpenGymDictContainer> dict = CreateObject<OpenGymDictContainer> ();
+  dict->Add ("matrix", matrix);
+  dict->Add ("channel", channel);
+
+  Ptr<OpenGymDictSpace> space = CreateObject<OpenGymDictSpace> ();
+  space->Add ("matrix", CreateObject<OpenGymBoxSpace> (-1, 1, shape, TypeNameGet<float> ()));
+  space->Add ("channel", CreateObject<OpenGymDiscreteSpace> (4));
+  NS_TEST_ASSERT_MSG_EQ (OpenGymSchema<OpenGymTestObs>::CreateSpace ()->GetSpaceDescription ().SerializeAsString (),
+                         space->GetSpaceDescription ().SerializeAsString (), "space");
+
+  OpenGymLayout layout;
+  NS_TEST_ASSERT_MSG_EQ (layout.Compile (space->GetSpaceDescription ()), true, "space has no layout");
+  NS_TEST_ASSERT_MSG_EQ (OpenGymSchema<OpenGymTestObs>::GetPackedSize (), layout.GetSize (), "packed size");
+  std::string packed, expected;
+  NS_TEST_ASSERT_MSG_EQ (layout.Pack (container, packed), true, "struct does not fit the layout");
+  NS_TEST_ASSERT_MSG_EQ (layout.Pack (dict, expected), true, "Dict does not fit the layout");
+  NS_TEST_ASSERT_MSG_EQ (packed == expected, true, "packed struct");
+
+  for (bool typed : {false, true})
+    {
+      OpenGymWireFormat format;
+      format.typed = typed;
+      format.rawBox = typed;
+      ns3opengym::DataContainer msg, expectedMsg;
+      container->FillDataContainerPbMsg (msg, format);
+      dict->FillDataContainerPbMsg (expectedMsg, format);
+      NS_TEST_ASSERT_MSG_EQ (msg.SerializeAsString () == expectedMsg.SerializeAsString (), true, "struct sent with typed " << typed);
+
+      OpenGymTestObs decoded;
+      NS_TEST_ASSERT_MSG_EQ (OpenGymSchema<OpenGymTestObs>::Decode (OpenGymDataContainer::CreateFromDataContainerPbMsg (msg), decoded),
+                             true, "struct not decoded with typed " << typed);
+      NS_TEST_ASSERT_MSG_EQ (decoded.matrix == value.matrix, true, "decoded Box field with typed " << typed);
+      NS_TEST_ASSERT_MSG_EQ (decoded.channel, value.channel, "decoded Discrete field with typed " << typed);
+    }
+  NS_TEST_ASSERT_MSG_EQ (OpenGymSchema<OpenGymTestObs>::Decode (channel, value), false, "struct decoded from a Discrete");
+}
+
+/**
+ * Dicts sharing the interned keys of their space are sent by key id and
+ * resolved with the space again, nested Dicts included.
+ */
+class OpenGymDictKeyIdsTestCase : public TestCase
+{
+public:
+  OpenGymDictKeyIdsTestCase ();
+  virtual ~OpenGymDictKeyIdsTestCase ();
 
 private:
   virtual void DoRun (void);
 };
 
-// Add some help text to this case to describe what it is intended to test
-OpengymTestCase1::OpengymTestCase1 ()
-  : TestCase ("Opengym test case (does nothing)")
+OpenGymDictKeyIdsTestCase::OpenGymDictKeyIdsTestCase ()
+  : TestCase ("Dict key id round trip")
 {
 }
 
-// This destructor does nothing but we include it as a reminder that
-// the test case should clean up after itself
-OpengymTestCase1::~OpengymTestCase1 ()
+OpenGymDictKeyIdsTestCase::~OpenGymDictKeyIdsTestCase ()
 {
 }
 
-//
-// This method is the pure virtual method from class TestCase that every
-// TestCase must implement
-//
 void
-OpengymTestCase1::DoRun (void)
+OpenGymDictKeyIdsTestCase::DoRun (void)
 {
-  // A wide variety of test macros are available in src/core/test.h
-  NS_TEST_ASSERT_MSG_EQ (true, true, "true doesn't equal true for some reason");
-  // Use this one for floating point comparisons
-  NS_TEST_ASSERT_MSG_EQ_TOL (0.01, 0.01, 0.001, "Numbers are not equal within tolerance");
+  std::vector<uint32_t> shape = {2};
+  Ptr<OpenGymDictSpace> innerSpace = CreateObject<OpenGymDictSpace> ();
+  innerSpace->Add ("b", CreateObject<OpenGymDiscreteSpace> (4));
+  Ptr<OpenGymDictSpace> space = CreateObject<OpenGymDictSpace> ();
+  space->Add ("zeta", CreateObject<OpenGymDiscreteSpace> (4));
+  space->Add ("alpha", CreateObject<OpenGymBoxSpace> (0, 1, shape, TypeNameGet<float> ()));
+  space->Add ("inner", innerSpace);
+
+  Ptr<OpenGymDictKeys> keys = space->GetKeys ();
+  NS_TEST_ASSERT_MSG_EQ (keys->IsInterned (), true, "space keys not interned");
+  NS_TEST_ASSERT_MSG_EQ (keys->GetSize (), 3, "number of keys");
+  NS_TEST_ASSERT_MSG_EQ (keys->GetName (0), "alpha", "keys not sorted");
+  NS_TEST_ASSERT_MSG_EQ (keys->Find ("zeta"), 2, "id of zeta");
+  NS_TEST_ASSERT_MSG_EQ (keys->Find ("omega"), keys->GetSize (), "id of a missing key");
+
+  Ptr<OpenGymDiscreteContainer> zeta = CreateObject<OpenGymDiscreteContainer> (4);
+  zeta->SetValue (3);
+  Ptr<OpenGymBoxContainer<float> > alpha = CreateObject<OpenGymBoxContainer<float> > (shape);
+  alpha->SetData (std::vector<float> {0.25f, 0.75f});
+  Ptr<OpenGymDiscreteContainer> b = CreateObject<OpenGymDiscreteContainer> (4);
+  b->SetValue (1);
+  Ptr<OpenGymDictContainer> inner = CreateObject<OpenGymDictContainer> (innerSpace->GetKeys ());
+  inner->Set (innerSpace->GetKeys ()->Find ("b"), b);
+  Ptr<OpenGymDictContainer> dict = CreateObject<OpenGymDictContainer> (keys);
+  dict->Set (keys->Find ("zeta"), zeta);
+  dict->Set (keys->Find ("alpha"), alpha);
+  dict->Add ("inner", inner);
+  NS_TEST_ASSERT_MSG_EQ (dict->GetKeys (), keys, "Add of a known key copied the keys");
+
+  OpenGymWireFormat format;
+  format.typed = true;
+  format.rawBox = true;
+  format.dictKeyIds = true;
+  ns3opengym::DataContainer msg;
+  dict->FillDataContainerPbMsg (msg, format);
+  NS_TEST_ASSERT_MSG_EQ (msg.dict ().element_size (), 3, "elements sent");
+  NS_TEST_ASSERT_MSG_EQ (msg.dict ().key_size (), 3, "key ids sent");
+  for (int i = 0; i < msg.dict ().element_size (); ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ (msg.dict ().element (i).name (), "", "name sent with key id " << i);
+    }
+
+  NS_TEST_ASSERT_MSG_EQ (OpenGymDataContainer::CreateFromDataContainerPbMsg (msg), nullptr, "key ids resolved without a space");
+  Ptr<OpenGymDictContainer> decoded = DynamicCast<OpenGymDictContainer> (OpenGymDataContainer::CreateFromDataContainerPbMsg (msg, nullptr, space));
+  NS_TEST_ASSERT_MSG_NE (decoded, nullptr, "decoded no Dict");
+  NS_TEST_ASSERT_MSG_EQ (decoded->GetKeys (), keys, "decoded Dict does not share the space keys");
+  Ptr<OpenGymDiscreteContainer> zeta2 = DynamicCast<OpenGymDiscreteContainer> (decoded->Get ("zeta"));
+  NS_TEST_ASSERT_MSG_NE (zeta2, nullptr, "zeta no Discrete");
+  NS_TEST_ASSERT_MSG_EQ (zeta2->GetValue (), 3, "zeta");
+  Ptr<OpenGymBoxContainer<float> > alpha2 = DynamicCast<OpenGymBoxContainer<float> > (decoded->Get (keys->Find ("alpha")));
+  NS_TEST_ASSERT_MSG_NE (alpha2, nullptr, "alpha no float Box");
+  NS_TEST_ASSERT_MSG_EQ (alpha2->GetData () == alpha->GetData (), true, "alpha");
+  Ptr<OpenGymDictContainer> inner2 = DynamicCast<OpenGymDictContainer> (decoded->Get ("inner"));
+  NS_TEST_ASSERT_MSG_NE (inner2, nullptr, "inner no Dict");
+  NS_TEST_ASSERT_MSG_EQ (inner2->GetKeys (), innerSpace->GetKeys (), "inner Dict does not share the inner space keys");
+  Ptr<OpenGymDiscreteContainer> b2 = DynamicCast<OpenGymDiscreteContainer> (inner2->Get ("b"));
+  NS_TEST_ASSERT_MSG_NE (b2, nullptr, "b no Discrete");
+  NS_TEST_ASSERT_MSG_EQ (b2->GetValue (), 1, "b");
+
+  ns3opengym::DataContainer outOfRange = msg;
+  outOfRange.mutable_dict ()->set_key (0, 7);
+  NS_TEST_ASSERT_MSG_EQ (OpenGymDataContainer::CreateFromDataContainerPbMsg (outOfRange, nullptr, space), nullptr, "resolved a key id out of range");
+
+  // a key outside the space detaches the Dict, which then sends names
+  dict->Add ("extra", b);
+  NS_TEST_ASSERT_MSG_EQ (dict->GetKeys ()->IsInterned (), false, "extra key added to the space keys");
+  NS_TEST_ASSERT_MSG_EQ (keys->GetSize (), 3, "space keys modified");
+  ns3opengym::DataContainer named;
+  dict->FillDataContainerPbMsg (named, format);
+  NS_TEST_ASSERT_MSG_EQ (named.dict ().key_size (), 0, "key ids sent for keys outside the space");
+  Ptr<OpenGymDictContainer> decodedNamed = DynamicCast<OpenGymDictContainer> (OpenGymDataContainer::CreateFromDataContainerPbMsg (named));
+  NS_TEST_ASSERT_MSG_NE (decodedNamed, nullptr, "decoded no Dict");
+  NS_TEST_ASSERT_MSG_NE (decodedNamed->Get ("extra"), nullptr, "extra");
+  NS_TEST_ASSERT_MSG_NE (decodedNamed->Get ("zeta"), nullptr, "zeta by name");
 }
 
-// The TestSuite class names the TestSuite, identifies what type of TestSuite,
-// and enables the TestCases to be run.  Typically, only the constructor for
-// this class must be defined
-//
 class OpengymTestSuite : public TestSuite
 {
 public:
@@ -59,10 +2083,31 @@ public:
 OpengymTestSuite::OpengymTestSuite ()
   : TestSuite ("opengym", UNIT)
 {
-  // TestDuration for TestCase can be QUICK, EXTENSIVE or TAKES_FOREVER
-  AddTestCase (new OpengymTestCase1, TestCase::QUICK);
+  AddTestCase (new OpenGymShmRingTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymShmStaleTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymShmPeerExitTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymPipelinedTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymEnvelopeTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymStateBatchTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymActionRepeatTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymWakeupTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymReplyTimeoutTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymTelemetryTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymTypedPayloadTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymRawBoxTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymLayoutTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymArenaTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymStreamedBoxTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymDeltaTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymSparseBoxTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymQuantizedLayoutTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymCapabilitiesTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymBoxAccessTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymBoxIndexTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymContainerPoolTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymSchemaTestCase, TestCase::QUICK);
+  AddTestCase (new OpenGymDictKeyIdsTestCase, TestCase::QUICK);
 }
 
 // Do not forget to allocate an instance of this TestSuite
 static OpengymTestSuite opengymTestSuite;
-